@@ -3,84 +3,787 @@
  * 
  * Features:
  * - Activates a pin at adjustable BPM rate (40-155 BPM) for 50ms
- * - Button controls: PB0=Increase BPM, PB1=Decrease BPM (±5 BPM steps)
+ * - Button controls: PB0=Increase BPM, PB1=Decrease BPM (±5 BPM steps, auto-repeat when held),
+ *   PB4=Tap tempo
  * - Low power sleep mode between activations
  * - RTC for wake-up timing (dynamically reconfigured) with external 32.768kHz crystal
- * - 3 button inputs with interrupt and proper 50ms blocking debounce
- * - Watchdog timer (8s timeout) for system reliability without affecting sleep
+ * - 3 button inputs with interrupt-driven, timer-based 50ms debounce
+ * - Window watchdog sized to the tempo, reset once per beat (no extra wakes)
+ * - Beat pattern sequencer: accents, rests and up to 4 sub-steps per beat, each
+ *   step with its own pulse width (PB0+PB1 pressed together selects the pattern)
+ * - Supply monitor: VDD sampled every 64 beats, pulse widths shortened on a low battery
+ * - Crystal temperature compensation from the die temperature, every 256 beats
+ * - Serial link on USART0 (-DENABLE_SERIAL): set the tempo, read the status and
+ *   wake log, stream the beat edges
+ * - Beat sync (-DENABLE_SYNC): follow the beat of a leader wired to PA6
  * 
  * Hardware Requirements:
- * - External 32.768kHz crystal connected to TOSC1/TOSC2 (PA0/PA1) for precise timing
+ * - External 32.768kHz crystal connected to TOSC1/TOSC2 (PB3/PB2) for precise timing
  * - Crystal provides ±20 ppm typical accuracy vs ±3% for internal oscillator
  * 
- * Debouncing: Uses blocking delay approach - stays awake for 50ms after button press
- * to properly debounce. Since button presses are infrequent (1-10 every few minutes),
- * this has minimal impact on average power consumption.
+ * Beat Timing: The RTC overflow period is PER+1 ticks of 1024Hz. Since 61440/BPM is
+ * rarely a whole number of ticks, the overflow ISR alternates between two PER values
+ * (Bresenham-style error diffusion) so the long-run beat rate is exact to crystal
+ * accuracy. The values come from a compile-time table, the ISR only does 8-bit math
+ * (and a 32-bit add and compare for the temperature correction).
  * 
- * 50ms Output Pulse: Uses blocking _delay_ms() during activation. This approach
- * is more power efficient than keeping a timer running during sleep. The brief
- * 50ms wake period has minimal impact on overall power consumption.
+ * Debouncing: Event-driven state machine per button. A pin edge arms the RTC
+ * compare interrupt 50ms ahead and the MCU goes back to sleep; the button state
+ * is only sampled when the compare fires. Beats keep firing on time while a button
+ * is held. A held PB0/PB1 auto-repeats at an accelerating rate, timed by the same
+ * RTC compare: the CPU only wakes for the steps, and the new tempo is applied once,
+ * on release.
+ * 
+ * 50ms Output Pulse: The high time is timed by the RTC compare, shared with the
+ * debounce window. The pin is raised, the compare is set 50ms ahead and the CPU
+ * goes straight back to sleep; the compare interrupt drives the pin low again.
+ * Build with -DUSE_BLOCKING_PULSE to busy-wait on the RTC counter instead (at a
+ * reduced CPU clock). Build with -DUSE_EVENT_PULSE to generate the whole
+ * pulse in hardware: the RTC overflow event is routed through EVSYS to TCB0 in
+ * single-shot mode, which drives the output pin (PA5, TCB0 WO) for 50ms while the
+ * CPU stays in standby. Beats that need nothing else only take a short overflow
+ * interrupt that counts them towards the next supply sample (a quiet run); the
+ * CPU still wakes at every beat, and TCB0 keeps OSC20M running in Standby.
+ * 
+ * Sequencer: The pattern (common/sequencer.h) is played on the same RTC. The
+ * overflow is the beat, the sub-steps of a subdivided pattern are one more RTC
+ * compare timer, at whole multiples of the sub-step length from the beat edge, so
+ * every step costs one wake and a table lookup. With -DUSE_EVENT_PULSE, the
+ * overflow event only starts the pulses of the plain beat pattern; any other
+ * pattern wakes the CPU at every step, which starts the pulse with the event
+ * system strobe after setting its width.
+ * 
+ * Tempo Storage: The tempo survives resets and power loss in a wear-leveled ring
+ * of records in the EEPROM (common/tempo_store.h). Button steps are coalesced: the
+ * tempo is written once, TEMPO_SAVE_BEATS beats after the last change, right after
+ * a beat. The ring is scanned at boot, before the RTC starts the first beat.
+ * 
+ * Board Variant: The pins, the RTC clock source and the features of the product
+ * (tempo storage, sequencer) are one constexpr BoardConfig,
+ * -DBOARD_ATTINY1616_LEAN for the lean product; a feature that is off folds away
+ * at compile time.
+ * 
+ * Fast Boot: Build with -DUSE_FAST_BOOT to start beating from OSCULP32K right away
+ * instead of waiting for the crystal: XOSC32K starts in the background and the RTC
+ * ISR hands the RTC over to it at a beat boundary once it is stable.
+ * 
+ * Supply Monitor: Every BATTERY_SAMPLE_BEATS beats the beat wake converts the 1.1V
+ * reference against VDD with ADC0, enabled for that conversion only. A low or
+ * critical battery (common/battery.h) halves or quarters the pulse widths.
+ * 
+ * Temperature Compensation: Every XTAL_TEMP_SAMPLES supply samples, the same wake
+ * converts the temperature sensor. The 1-series RTC has no calibration register,
+ * so the crystal's parabolic offset at that temperature (common/xtal_comp.h) is
+ * corrected in the beat period: one tick less (or more) every 10^9 / ppb ticks.
+ * With -DUSE_EVENT_PULSE the quiet runs keep the sample schedule, and their beats
+ * apply the correction as well.
+ * 
+ * Serial Link: Build with -DENABLE_SERIAL for the command and telemetry link of
+ * common/serial_link.h on USART0 (PA1 TXD, PA2 RXD, 9600 baud: the alternate pins,
+ * the default ones are the crystal's). The receiver's start-of-frame detection
+ * wakes the clock from Standby for a received byte; bytes are sent from the data
+ * register empty interrupt, in Idle sleep, and the replies are formatted in the
+ * main loop right before it sleeps. Nothing runs while the link is idle.
+ * 
+ * Beat Sync: Build with -DENABLE_SYNC to follow a leader: its output pin drives
+ * PA6, a fully asynchronous pin whose rising edge wakes the CPU from any sleep
+ * mode. The PORTA ISR timestamps the edge on RTC.CNT (the position in the beat in
+ * progress) and the PI loop of common/beat_sync.h moves PER by its correction, so
+ * the sync edge is the only wake added. One tick of the 1024Hz RTC is 0.98ms, so
+ * a follower stays within one or two ticks of the leader.
+ * 
+ * Sleep Depth: enter_sleep() sleeps in Standby (Idle while USART0 sends): the RTC
+ * counter times every beat and does not run in Power-Down. It first checks the
+ * core's event word with interrupts off, so an event raised after the last poll is
+ * handled right away instead of at the next wake.
+ * 
+ * CPU Clock: Work runs at 20MHz / 6, busy waits drop CLKCTRL.MCLKCTRLB to 20MHz / 64.
+ * All timing is taken from the RTC, so no delay depends on the CPU clock.
  * 
  * 3.3V Operation: ATTiny1616 operates at 1.8-5.5V, fully compatible with 3.3V
- * Brownout Detection: Internal BOD can be configured via fuses (recommended: 2.6V for 3.3V operation)
+ * Brownout Detection: Internal BOD can be configured via fuses (recommended: 2.6V for 3.3V operation,
+ * 1.8V on a coin cell so the supply monitor levels are reached before a reset)
  */
 
 #include <avr/io.h>
 #include <avr/interrupt.h>
 #include <avr/sleep.h>
 #include <avr/wdt.h>
-#include <util/delay.h>
 #include <stdbool.h>
 
-// Pin configuration
-#define OUTPUT_PIN PIN3_bm  // PA3 - Output pin for periodic activation
-#define BUTTON_INC_PIN PIN0_bm // PB0 - Button to increase BPM
-#define BUTTON_DEC_PIN PIN1_bm // PB1 - Button to decrease BPM
-#define BUTTON3_PIN PIN2_bm    // PB2 - Button 3 (reserved for future use)
+// BPM, pulse and debounce configuration, portable metronome core
+#include "../common/config.h"
+#include "../common/metronome.h"
+
+// Compile-time BPM to tick tables (uses the BPM configuration above)
+#include "../common/bpm_table.h"
+#include "../common/beat_scheduler.h"
+#include "../common/debounce.h"
+#include "../common/instrumentation.h"
+#include "../common/tempo_store.h"
+#include "../common/tap_tempo.h"
+#include "../common/beat_sync.h"
+#include "../common/sequencer.h"
+#include "../common/battery.h"
+#include "../common/xtal_comp.h"
+#include "../common/serial_link.h"
 
-// BPM configuration
-#define BPM_MIN 40
-#define BPM_MAX 155
-#define BPM_DEFAULT 100
-#define BPM_STEP 5
+// Board variant: the pins, the RTC clock source and the features of the product
+// built from this source, in one constexpr description. The pin masks and the
+// unused-pin masks below are derived from it at compile time, so moving a pin
+// changes this table only. A feature that is off is tested in plain ifs on the
+// constant, so its code and state are dropped. Another board or product gets its
+// own BoardConfig in place of this one, under an #if on its -DBOARD_<name> flag.
+// The serial link, beat sync and instrumentation stay on their -DENABLE_* build
+// flags (platformio.ini), and the serial pins are fixed by PORTMUX.
+struct BoardConfig {
+    uint8_t output;                // Pulse output on PORTA, active high (PA5, TCB0 WO, with -DUSE_EVENT_PULSE)
+    uint8_t button[BUTTON_COUNT];  // Buttons to ground on PORTB with pull-ups, by ButtonId
+    uint8_t sync;                  // Sync input on PORTA (-DENABLE_SYNC)
+    uint8_t awake;                 // Awake marker on PORTA (-DENABLE_INSTRUMENTATION)
+    bool rtc_crystal;              // RTC from the 32.768kHz crystal on TOSC1/TOSC2 (XOSC32K), else OSCULP32K (±3%)
+    bool tempo_store;              // Tempo restored from the EEPROM ring, else RAM only (BPM_DEFAULT at reset)
+    bool sequencer;                // Beat patterns, selected with both tempo buttons, else the plain beat only
+};
+
+// ATtiny1616 board with the features of a product
+static constexpr BoardConfig attiny1616(bool tempo_store, bool sequencer) {
+    return {
+#ifdef USE_EVENT_PULSE
+        5,           // PA5 - Output pin, driven by the TCB0 waveform output (WO)
+#else
+        3,           // PA3 - Output pin for periodic activation
+#endif
+        {
+            0,       // PB0 - Button to increase BPM
+            1,       // PB1 - Button to decrease BPM
+            4,       // PB4 - Tap tempo button (PB2 / PB3 are TOSC2 / TOSC1, the crystal)
+        },
+        6,           // PA6 - Sync input, wired to the leader's output pin
+        4,           // PA4 - Debug marker, high while the CPU is awake
+        true,        // 32.768kHz crystal
+        tempo_store,
+        sequencer,
+    };
+}
+
+#if defined(BOARD_ATTINY1616_LEAN)
+static constexpr BoardConfig board = attiny1616(false, false);  // Lean product: tempo in RAM, plain beat
+#else
+static constexpr BoardConfig board = attiny1616(true, true);    // Every feature
+#endif
+
+// Pin masks of the board
+#define OUTPUT_PIN (1 << board.output)
+#define BUTTON_INC_PIN (1 << board.button[BUTTON_INC])
+#define BUTTON_DEC_PIN (1 << board.button[BUTTON_DEC])
+#define BUTTON_TAP_PIN (1 << board.button[BUTTON_TAP])
+#define BUTTON_PINS (BUTTON_INC_PIN | BUTTON_DEC_PIN | BUTTON_TAP_PIN)
+#define TOSC_PINS (board.rtc_crystal ? (PIN2_bm | PIN3_bm) : 0)  // PB2 / PB3 - TOSC2 / TOSC1
+#ifdef ENABLE_SERIAL
+#define SERIAL_TXD_PIN PIN1_bm // PA1 - USART0 TXD (alternate pins, PORTMUX)
+#define SERIAL_RXD_PIN PIN2_bm // PA2 - USART0 RXD
+#else
+#define SERIAL_TXD_PIN 0
+#define SERIAL_RXD_PIN 0
+#endif
+#ifdef ENABLE_SYNC
+#define SYNC_PIN (1 << board.sync)
+#else
+#define SYNC_PIN 0
+#endif
+#define INSTR_AWAKE_PIN (1 << board.awake)
+
+// Pins not used by the firmware, their digital input buffers are disabled
+// PA0 (UPDI), the output pin, the buttons, with -DENABLE_SERIAL PA1 / PA2 (USART0)
+// and with -DENABLE_SYNC the sync input are in use; with the crystal PB2 / PB3
+// (TOSC2 / TOSC1) are taken over by its oscillator. The awake marker is set up by
+// instr_init(), after unused_pins_init().
+#define PORTA_UNUSED_PINS ((PIN1_bm | PIN2_bm | PIN3_bm | PIN4_bm | PIN5_bm | PIN6_bm | PIN7_bm) & \
+                           ~(OUTPUT_PIN | SERIAL_TXD_PIN | SERIAL_RXD_PIN | SYNC_PIN))
+#define PORTB_UNUSED_PINS ((PIN0_bm | PIN1_bm | PIN2_bm | PIN3_bm | PIN4_bm | PIN5_bm) & ~(BUTTON_PINS | TOSC_PINS))
+#define PORTC_UNUSED_PINS (PIN0_bm | PIN1_bm | PIN2_bm | PIN3_bm)
+
+static_assert(board.output >= 1 && board.output <= 7, "The output must be on PA1-PA7 (PA0 is UPDI)");
+#ifdef USE_EVENT_PULSE
+static_assert(board.output == 5, "The event pulse is the TCB0 waveform output, PA5");
+#endif
+static_assert(board.button[BUTTON_INC] <= 5 && board.button[BUTTON_DEC] <= 5 && board.button[BUTTON_TAP] <= 5,
+              "The buttons must be on PB0-PB5");
+static_assert(board.button[BUTTON_INC] != board.button[BUTTON_DEC] && board.button[BUTTON_INC] != board.button[BUTTON_TAP] &&
+              board.button[BUTTON_DEC] != board.button[BUTTON_TAP], "Each button needs its own pin");
+static_assert((BUTTON_PINS & TOSC_PINS) == 0, "PB2 / PB3 are taken by the crystal");
+static_assert((OUTPUT_PIN & (SERIAL_TXD_PIN | SERIAL_RXD_PIN | SYNC_PIN)) == 0 &&
+              (SYNC_PIN & (SERIAL_TXD_PIN | SERIAL_RXD_PIN)) == 0, "PORTA pin used twice");
+#ifdef ENABLE_SYNC
+static_assert(board.sync == 2 || board.sync == 6,
+              "The sync input needs a fully asynchronous pin (PA2 / PA6) to wake on a rising edge");
+#endif
+#ifdef ENABLE_INSTRUMENTATION
+static_assert(board.awake >= 1 && board.awake <= 7 &&
+              (INSTR_AWAKE_PIN & (OUTPUT_PIN | SERIAL_TXD_PIN | SERIAL_RXD_PIN | SYNC_PIN)) == 0,
+              "The awake marker needs a free pin on PA1-PA7");
+#endif
+#ifdef USE_FAST_BOOT
+static_assert(board.rtc_crystal, "Fast boot hands the RTC over to the crystal");
+#endif
+static_assert(board.sequencer || SEQ_DEFAULT_PATTERN == 0, "A board without the sequencer plays the plain beat (pattern 0)");
+
+// HAL policy for the metronome core, defined below
+struct AttinyHal {
+    static constexpr bool persistent = board.tempo_store;
+    static constexpr bool patterns = board.sequencer;
+    
+    static void set_tempo(uint16_t bpm);
+    static void pulse(uint8_t kind);
+    static void sleep();
+    static void watchdog_kick();
+    static void save_tempo(uint16_t bpm);
+    static void align_beat(uint16_t bpm);
+    static void set_pattern(uint8_t pattern);
+    static uint16_t measure_supply();
+    static void set_power_level(uint8_t level);
+    static int16_t measure_temperature();
+    static void set_xtal_trim(int32_t ppb);
+    static uint8_t irq_save();
+    static void irq_restore(uint8_t state);
+};
+typedef Metronome<AttinyHal> App;
 
 // Timing configuration
-volatile uint16_t current_bpm = BPM_DEFAULT;
-volatile uint16_t activation_period_ms = 60000 / BPM_DEFAULT;  // Calculate period from BPM
-#define ACTIVATION_DURATION_MS 50 // Active for 50ms
+volatile uint16_t activation_period_ms = bpm_table_ms.entry[bpm_index(BPM_DEFAULT)].ticks;  // Period from BPM
+
+// Tempo storage: ring of records (common/tempo_store.h) at the start of the EEPROM,
+// read through the memory-mapped EEPROM
+#define TEMPO_RING ((TempoRecord*)EEPROM_START)
+
+static_assert(TEMPO_STORE_SLOTS * sizeof(TempoRecord) <= EEPROM_SIZE, "Tempo ring must fit the EEPROM");
+
+// Debouncing - RTC compare fires 50ms after the last edge
+#define DEBOUNCE_RTC_TICKS ((DEBOUNCE_DELAY_MS * 1024UL) / 1000)  // 1024Hz RTC ticks
+
+// Supply monitor: ADC0 converts the internal 1.1V reference against VDD (10 bits),
+// reading = 1100 * 1023 / VDD in mV (common/battery.h)
+#define SUPPLY_SCALE (1100UL * 1023)
+#define SUPPLY_ADC_CTRLC (ADC_SAMPCAP_bm | ADC_REFSEL_VDDREF_gc | ADC_PRESC_DIV4_gc)
+
+// Temperature sensor: against the 1.1V reference, sampled for at least 32µs
+// (31 + 2 ADC clocks, 40µs at 833kHz)
+#define TEMPSENSE_ADC_CTRLC (ADC_SAMPCAP_bm | ADC_REFSEL_INTREF_gc | ADC_PRESC_DIV4_gc)
+#define TEMPSENSE_SAMPLEN 31
+
+// Instrumentation (-DENABLE_INSTRUMENTATION)
+#define INSTR_TCA_PRESCALER TCA_SINGLE_CLKSEL_DIV8_gc  // Awake time unit: 8 CLK_PER cycles
+
+// Output pulse length of each step kind in 1024Hz RTC ticks (rounded, ~1ms resolution)
+static constexpr PulseWidthTable pulse_width_rtc = make_pulse_width_table<1024>();
+
+// Hardware pulse (-DUSE_EVENT_PULSE): TCB0 counts CLK_PER / 2, with CLK_PER fixed at
+// OSC20M / 16 so the longest pulse fits its 16-bit compare register
+#define EVENT_PULSE_CLK_PER_HZ (20000000UL / 16)  // OSC20M fused to 20MHz (default)
+#define EVENT_PULSE_STROBE (1 << 0)               // EVSYS.ASYNCSTROBE bit of asynchronous channel 0
+
+#ifdef USE_EVENT_PULSE
+static constexpr PulseWidthTable pulse_width_tcb = make_pulse_width_table<EVENT_PULSE_CLK_PER_HZ / 2>();
+#endif
+
+// CPU clock: OSC20M prescaler (CLKCTRL.MCLKCTRLB) for work and for busy waits
+// Nothing is timed by CPU cycles, except TCB0 with -DUSE_EVENT_PULSE and the USART0
+// baud rate with -DENABLE_SERIAL, which need a fixed CLK_PER
+#ifdef USE_EVENT_PULSE
+#define CLK_PRESCALER_RUN  (CLKCTRL_PDIV_16X_gc | CLKCTRL_PEN_bm)  // 1.25MHz, TCB0 time base
+#define CLK_PER_HZ EVENT_PULSE_CLK_PER_HZ
+#else
+#define CLK_PRESCALER_RUN  (CLKCTRL_PDIV_6X_gc | CLKCTRL_PEN_bm)   // 3.33MHz (reset default)
+#define CLK_PER_HZ (20000000UL / 6)
+#endif
+#if defined(USE_EVENT_PULSE) || defined(ENABLE_SERIAL)
+#define CLK_PRESCALER_WAIT CLK_PRESCALER_RUN
+#else
+#define CLK_PRESCALER_WAIT (CLKCTRL_PDIV_64X_gc | CLKCTRL_PEN_bm)  // 312.5kHz
+#endif
+
+// Set the CPU clock prescaler (protected register, the CCP sequence blocks interrupts)
+static inline void clock_set(uint8_t prescaler) {
+    _PROTECTED_WRITE(CLKCTRL.MCLKCTRLB, prescaler);
+}
+
+// Drop the CPU clock for a busy wait, returns the prescaler to restore (can nest)
+static inline uint8_t clock_wait_begin() {
+    uint8_t prescaler = CLKCTRL.MCLKCTRLB;
+    if (CLK_PRESCALER_WAIT != CLK_PRESCALER_RUN) {
+        clock_set(CLK_PRESCALER_WAIT);
+    }
+    return prescaler;
+}
+
+static inline void clock_wait_end(uint8_t prescaler) {
+    if (CLK_PRESCALER_WAIT != CLK_PRESCALER_RUN) {
+        clock_set(prescaler);
+    }
+}
+
+// Initialize the CPU clock (called first in main())
+void clock_init() {
+    clock_set(CLK_PRESCALER_RUN);
+}
+
+// RTC compare timers: the compare channel is shared by the debounce window, the
+// end of the output pulse and the next sub-step. A deadline is an RTC.CNT value
+// within the beat, the compare is programmed with the nearest one. Interrupt
+// context or interrupts disabled.
+enum RtcTimer : uint8_t {
+    RTC_TIMER_DEBOUNCE,
+    RTC_TIMER_PULSE,
+    RTC_TIMER_STEP,
+    RTC_TIMER_COUNT
+};
+
+static uint16_t rtc_timer_deadline[RTC_TIMER_COUNT];
+static uint8_t rtc_timer_active;  // Bit mask of running timers
+
+// Beat period state (entries of bpm_table_1024hz) - owned by the RTC ISR
+static BeatState beat_state;
+static DriftState xtal_drift;  // Crystal temperature correction (common/xtal_comp.h), owned by the RTC ISR
+
+// Pattern sequencer (common/sequencer.h) - owned by the RTC ISR
+static Sequencer sequencer = { &seq_patterns[SEQ_DEFAULT_PATTERN], nullptr, 0, 0 };
+static uint16_t step_ticks;  // Sub-step length in the beat in progress
+
+// Sequencer steps for the RTC ISR: on a board without the sequencer every step is
+// a plain beat, these fold to constants and the sequencer is dropped
+static inline uint8_t pattern_beat() {
+    return board.sequencer ? seq_beat(&sequencer) : (uint8_t)STEP_BEAT;
+}
+
+static inline uint8_t pattern_subdiv() {
+    return board.sequencer ? seq_subdiv(&sequencer) : 1;
+}
 
-// Debouncing - using blocking delay for true 50ms debounce
-#define DEBOUNCE_DELAY_MS 50  // 50ms debounce for snappy response
+// The plain beat plays and no other pattern is pending
+static inline bool pattern_plain() {
+    return !board.sequencer || (seq_plain(&sequencer) && !sequencer.pending);
+}
+
+// Sub-step lengths in 1024Hz RTC ticks
+static constexpr SubStepTable substep_table_1024hz = make_substep_table<TICKS_PER_MINUTE_1024HZ>();
+
+#ifdef USE_EVENT_PULSE
+static bool event_pulse_auto;  // The overflow event starts the beat pulses (plain pattern), owned by the RTC ISR
+#endif
+
+static volatile uint8_t pulse_shift;  // Pulse widths are shifted right by this (battery level), set by the main loop
+
+#ifdef USE_FAST_BOOT
+// The RTC runs from OSCULP32K until XOSC32K is stable - owned by the RTC ISR
+static volatile bool boot_timebase;
+#endif
+
+// Tempo storage state (main loop only, board.tempo_store)
+static TempoStore tempo_store;
+
+// Debounce state machine (common/debounce.h), one per button (indexed by ButtonId)
+static const uint8_t button_pins[BUTTON_COUNT] = { BUTTON_INC_PIN, BUTTON_DEC_PIN, BUTTON_TAP_PIN };
+volatile ButtonState button_state[BUTTON_COUNT] = { BUTTON_IDLE, BUTTON_IDLE, BUTTON_IDLE };
+static volatile RepeatState button_repeat;  // Auto-repeat on the debounce timer, owned by the ISRs
+
+// Auto-repeat steps in 1024Hz RTC ticks. The RTC compare deadline wraps around the
+// beat once, so a step must be shorter than the fastest beat.
+static constexpr RepeatTable repeat_table_1024hz = make_repeat_table<1024>();
+static_assert(REPEAT_DELAY_MS < 60000UL / BPM_MAX && REPEAT_START_MS < 60000UL / BPM_MAX,
+              "Repeat steps must fit in one beat");
+
+// Tap tempo: taps are timestamped on a tap clock, RTC ticks since the start of the
+// beat in which the run of taps started. The RTC ISR advances it by the length of
+// every beat that ends while it runs; it stops once no tap came for longer than
+// tap_max_interval(), so it costs nothing when not tapping.
+static TapTempo tap_tempo;         // Owned by the ISRs
+static volatile bool tap_clock_on;  // The tap clock runs (the beat ISR advances it)
+static uint16_t tap_clock;         // Tap clock at the start of the beat in progress
+static uint16_t tap_edge;          // Tap clock at the press edge being debounced
+static uint16_t tap_last;          // Tap clock at the press edge of the last tap
+
+#ifdef ENABLE_SERIAL
+// Serial link state (common/serial_link.h)
+static SerialLink serial_link;
+
+static inline bool serial_streaming() {
+    return serial_link.streaming;
+}
+#else
+static inline bool serial_streaming() {
+    return false;
+}
+#endif
+
+#ifdef ENABLE_SYNC
+// Beat sync with a leader (common/beat_sync.h), owned by the ISRs
+static BeatSync beat_sync;
+static bool sync_adjusted;  // PER of the beat in progress holds a sync correction
+static constexpr uint16_t sync_window_1024hz = sync_window_ticks<1024>();
+#define SYNC_GUARD_TICKS 2  // Ticks needed to move the end of the beat (PER synchronization)
 
-volatile bool activation_flag = false;
-volatile bool reconfigure_rtc = false;
+// Sync correction carried to the beat that starts now (called at each overflow)
+static inline int8_t sync_beat_ticks() {
+    int8_t ticks = sync_next(&beat_sync);
+    sync_adjusted = ticks != 0;
+    return ticks;
+}
+
+static inline bool sync_adjusting() {
+    return sync_adjusted || beat_sync.carry;
+}
+#else
+static inline int8_t sync_beat_ticks() {
+    return 0;
+}
 
-// Button press flags set by ISR, processed in main loop
-volatile bool button_inc_pressed = false;
-volatile bool button_dec_pressed = false;
-volatile bool button3_pressed = false;
+static inline bool sync_adjusting() {
+    return false;
+}
+#endif
 
-// Calculate RTC period based on BPM
-uint16_t calculate_rtc_period(uint16_t bpm) {
-    // BPM = beats per minute, period in ms = 60000 / BPM
+// Look up the RTC period table entry for a BPM setting
+const BpmPeriod* calculate_rtc_period(uint16_t bpm) {
+    // BPM = beats per minute, period in RTC ticks = 61440 / BPM
     // 32768 Hz / 32 = 1024 Hz (approximately 1ms per tick with prescaler)
-    // RTC ticks = period_ms * 1.024
-    uint32_t period_ms = 60000UL / bpm;
-    return (uint16_t)(period_ms * 1024 / 1000);
+    return &bpm_table_1024hz.entry[bpm_index(bpm)];
+}
+
+// Program RTC.PER for the beat that starts now (called at each overflow)
+// Error diffusion: the beat is one tick longer whenever the carried fraction
+// reaches a whole tick, so the average period is exactly 61440 / BPM ticks.
+// The crystal temperature correction then takes a tick off (or adds one to) a
+// beat now and then, and a follower (-DENABLE_SYNC) adds a sync correction that
+// came too late for the beat that ended.
+static void rtc_next_period() {
+    uint16_t ticks = beat_next(&beat_state);
+    RTC.PER = ticks + drift_next(&xtal_drift, ticks) + sync_beat_ticks() - 1;  // Overflow period is PER + 1 ticks
+}
+
+#ifdef USE_EVENT_PULSE
+// The beat only needs the CPU to latch a tempo or pattern change, to count the
+// beats until the tempo is saved, to run the tap clock, to play a pattern other
+// than the plain beat, to sample the supply, to stamp the beat stream of the serial
+// link (-DENABLE_SERIAL), to restore PER after a sync correction (-DENABLE_SYNC) or
+// to poll XOSC32K (-DUSE_FAST_BOOT); otherwise the beat starts a quiet run. The
+// fractional period and the crystal correction are set by the quiet beats as well.
+static bool beat_needs_cpu() {
+#ifdef USE_FAST_BOOT
+    if (boot_timebase) {
+        return true;  // The beat ISR polls the crystal
+    }
+#endif
+    return beat_state.pending || App::save_pending() || tap_clock_on || !pattern_plain() ||
+           App::supply_due() || serial_streaming() || sync_adjusting();
+}
+
+// Quiet run: the beats up to the one before the next supply sample only take the
+// overflow interrupt, which counts them, sets PER for the beat that starts
+// (rtc_next_period()) and returns without waking the main loop.
+// No counter of the 1-series counts the beats while the CPU sleeps (the RTC wraps
+// at every beat, TCA0 stops in Standby and TCB0 times the pulse), so this short
+// wake is what keeps the sample schedule; the beat that ends the run hands the
+// count to the core with on_beat(). Anything that needs the CPU again ends the run early
+// with beat_wakes_resume().
+static volatile uint8_t quiet_left;  // Beats of the run still to count, 0: full beat ISR (RTC ISR, beat_wakes_resume())
+static uint8_t quiet_beats;          // Beats counted since the last on_beat() (RTC ISR)
+#endif
+
+// Wait until writes to the RTC registers in busy_mask are synchronized into the
+// RTC clock domain (a few 32kHz cycles), at the reduced CPU clock
+static void rtc_sync_wait(uint8_t busy_mask) {
+    if (!(RTC.STATUS & busy_mask)) {
+        return;
+    }
+    uint8_t prescaler = clock_wait_begin();
+    while (RTC.STATUS & busy_mask);
+    clock_wait_end(prescaler);
+}
+
+// RTC ticks from start until now, within the beat period (PER + 1 ticks)
+static uint16_t rtc_ticks_between(uint16_t start, uint16_t now) {
+    return now >= start ? now - start : now + (RTC.PER + 1) - start;
+}
+
+// Program the compare with the nearest running timer, or disable it
+static void rtc_timer_program() {
+    if (!rtc_timer_active) {
+        RTC.INTCTRL &= ~RTC_CMP_bm;
+        return;
+    }
+    
+    uint16_t now = RTC.CNT;
+    uint16_t next = 0;
+    uint16_t nearest = 0xFFFF;
+    for (uint8_t i = 0; i < RTC_TIMER_COUNT; i++) {
+        if (!(rtc_timer_active & (1 << i))) {
+            continue;
+        }
+        uint16_t ticks = rtc_ticks_between(now, rtc_timer_deadline[i]);
+        if (ticks < nearest) {
+            nearest = ticks;
+            next = rtc_timer_deadline[i];
+        }
+    }
+    
+    rtc_sync_wait(RTC_CMPBUSY_bm);
+    RTC.CMP = next;
+    RTC.INTFLAGS = RTC_CMP_bm;  // Drop any stale compare match
+    RTC.INTCTRL |= RTC_CMP_bm;
+}
+
+// Start (or restart) a timer that expires at a deadline within the beat
+static void rtc_timer_at(uint8_t timer, uint16_t deadline) {
+    rtc_timer_deadline[timer] = deadline;
+    rtc_timer_active |= 1 << timer;
+    rtc_timer_program();
+}
+
+// Start (or restart) a timer that expires the given number of ticks from now
+static void rtc_timer_start(uint8_t timer, uint16_t ticks) {
+    uint16_t per = RTC.PER;
+    uint16_t deadline = RTC.CNT + ticks;
+    if (deadline > per) {
+        deadline -= per + 1;  // Wrap around the beat period
+    }
+    rtc_timer_at(timer, deadline);
+}
+
+static void rtc_timer_stop(uint8_t timer) {
+    if (rtc_timer_active & (1 << timer)) {
+        rtc_timer_active &= ~(1 << timer);
+        rtc_timer_program();
+    }
+}
+
+// Compare match: returns the mask of timers that expired and reprograms the compare
+// for the remaining ones (called from the RTC ISR)
+static uint8_t rtc_timer_expired() {
+    uint16_t cmp = RTC.CMP;
+    uint8_t expired = 0;
+    for (uint8_t i = 0; i < RTC_TIMER_COUNT; i++) {
+        if ((rtc_timer_active & (1 << i)) && rtc_timer_deadline[i] == cmp) {
+            expired |= 1 << i;
+        }
+    }
+    
+    rtc_timer_active &= ~expired;
+    rtc_timer_program();
+    return expired;
+}
+
+// Change the length of the beat in progress to per + 1 ticks (interrupts disabled,
+// per must be above CNT). The running timers keep their remaining ticks: their deadlines
+// are rebuilt around the new period.
+static void rtc_set_beat_end(uint16_t per) {
+    uint16_t now = RTC.CNT;
+    uint16_t remaining[RTC_TIMER_COUNT];
+    for (uint8_t i = 0; i < RTC_TIMER_COUNT; i++) {
+        remaining[i] = rtc_ticks_between(now, rtc_timer_deadline[i]);
+    }
+    
+    rtc_sync_wait(RTC_PERBUSY_bm);
+    RTC.PER = per;
+    
+    for (uint8_t i = 0; i < RTC_TIMER_COUNT; i++) {
+        uint16_t deadline = now + remaining[i];
+        if (deadline > per) {
+            deadline -= per + 1;  // Wrap around the beat period
+        }
+        rtc_timer_deadline[i] = deadline;
+    }
+    rtc_timer_program();
+}
+
+// Watchdog: window mode, sized to the tempo and reset once per beat
+// The WDT counts OSCULP32K / 32 (1.024kHz nominal). The beat wake is the only one
+// that resets it, so no wake exists just to feed the watchdog, and a wake that is
+// not a beat never touches it. Per tempo, the closed window (a reset in it is a
+// system reset) lasts at most half a beat and closed + open window at least two
+// beats, over the whole oscillator tolerance: a hang is caught within ~2 beats and
+// a runaway loop that keeps resetting the WDT is caught at once.
+#define WDT_CLOCK_HZ      1024
+#define WDT_TOLERANCE_PCT 30    // OSCULP32K tolerance assumed over voltage and temperature
+
+// WDT.CTRLA (WINDOW and PERIOD fields) for each BPM step
+struct WdtConfigTable {
+    uint8_t ctrla[BPM_TABLE_SIZE];
+};
+
+// WINDOW / PERIOD codes: code n selects 8 << (n - 1) WDT cycles (8 to 8K)
+#define WDT_CODE_MAX 11
+
+// Largest code with at most the given number of cycles
+constexpr uint8_t wdt_code_at_most(uint32_t cycles) {
+    uint8_t code = 1;
+    while (code < WDT_CODE_MAX && (8UL << code) <= cycles) {
+        code++;
+    }
+    return code;
+}
+
+// Smallest code with at least the given number of cycles
+constexpr uint8_t wdt_code_at_least(uint32_t cycles) {
+    uint8_t code = 1;
+    while (code < WDT_CODE_MAX && (8UL << (code - 1)) < cycles) {
+        code++;
+    }
+    return code;
+}
+
+constexpr WdtConfigTable make_wdt_config_table() {
+    WdtConfigTable table{};
+    for (uint8_t i = 0; i < BPM_TABLE_SIZE; i++) {
+        uint32_t beat_ms = bpm_table_ms.entry[i].ticks;
+        
+        // Closed window <= 1/2 beat with the oscillator at its slowest
+        uint32_t closed_max = beat_ms * WDT_CLOCK_HZ * (100 - WDT_TOLERANCE_PCT) / (2 * 100 * 1000UL);
+        uint8_t window = wdt_code_at_most(closed_max);
+        
+        // Closed + open window >= 2 beats with the oscillator at its fastest
+        uint32_t total_min = 2 * beat_ms * WDT_CLOCK_HZ * (100 + WDT_TOLERANCE_PCT) / (100 * 1000UL);
+        uint32_t closed = 8UL << (window - 1);
+        uint8_t period = wdt_code_at_least(total_min - closed);
+        
+        table.ctrla[i] = (uint8_t)((window << WDT_WINDOW_gp) | (period << WDT_PERIOD_gp));
+    }
+    return table;
+}
+
+static constexpr WdtConfigTable wdt_config_table = make_wdt_config_table();
+
+#ifndef USE_LOW_LEAKAGE_PROFILE
+static uint8_t watchdog_ctrla;  // Window configuration in use, 0: boot timeout (no window)
+
+// Wait until the last WDR or CTRLA write is synchronized (2-3 WDT cycles, ~3ms),
+// at the reduced CPU clock. Only needed to change the configuration.
+static void wdt_sync_wait() {
+    if (!(WDT.STATUS & WDT_SYNCBUSY_bm)) {
+        return;
+    }
+    uint8_t prescaler = clock_wait_begin();
+    while (WDT.STATUS & WDT_SYNCBUSY_bm);
+    clock_wait_end(prescaler);
+}
+
+#ifdef USE_EVENT_PULSE
+// With the pulse in hardware, the beats of a quiet run do not reach the main loop,
+// so the overflow interrupt resets the watchdog for them. The window in use still
+// fits (the run keeps the tempo), and the reset is only given if the main loop
+// went back to sleep since the previous one: a main loop stuck with interrupts
+// on still runs into the timeout.
+static volatile bool watchdog_slept;  // Main loop slept since the last reset (enter_sleep(), RTC ISR)
+
+static inline void watchdog_sleep() {
+    watchdog_slept = true;
+}
+
+static inline void watchdog_quiet_beat() {
+    if (watchdog_slept) {
+        watchdog_slept = false;
+        wdt_reset();
+    }
+}
+#else
+static inline void watchdog_sleep() {}
+#endif
+
+// Reset the watchdog at a beat and size its window to the beat that starts now
+// The beat ISR latches a tempo change before this runs, so the window always
+// matches the interval to the next reset. The reset comes first, inside the open
+// window of the previous configuration; the new one follows only on a tempo change.
+static void watchdog_beat() {
+    wdt_reset();
+    
+    cli();  // 16-bit pointer owned by the RTC ISR
+    uint8_t i = beat_state.period - bpm_table_1024hz.entry;
+    sei();
+    
+    uint8_t ctrla = wdt_config_table.ctrla[i];
+    if (ctrla != watchdog_ctrla) {
+        watchdog_ctrla = ctrla;
+        wdt_sync_wait();
+        _PROTECTED_WRITE(WDT.CTRLA, ctrla);
+    }
+}
+
+// The beat in progress was shortened or stretched (tap tempo): until its end,
+// drop the window and use the boot timeout. The next watchdog_beat() sets the
+// window for the tempo from there on.
+static void watchdog_relax() {
+    if (!watchdog_ctrla) {
+        return;  // No window in use
+    }
+    watchdog_ctrla = 0;
+    wdt_sync_wait();
+    _PROTECTED_WRITE(WDT.CTRLA, WDT_PERIOD_8KCLK_gc);
+}
+#else
+// -DUSE_LOW_LEAKAGE_PROFILE: the WDT stays off
+static inline void watchdog_beat() {}
+static inline void watchdog_relax() {}
+static inline void watchdog_sleep() {}
+static inline void watchdog_quiet_beat() {}
+#endif
+
+#ifdef USE_EVENT_PULSE
+// End a quiet run (interrupt context or interrupts disabled): the next beat runs
+// the beat ISR in full and counts the run towards the supply sample
+static void beat_wakes_resume() {
+    quiet_left = 0;
+}
+#endif
+
+#ifdef USE_FAST_BOOT
+// Start XOSC32K without waiting for it: ENABLE and RUNSTDBY keep the oscillator
+// (and its start-up counter) running in Standby before the RTC requests it
+void xosc32k_start() {
+    _PROTECTED_WRITE(CLKCTRL.XOSC32KCTRLA, CLKCTRL_ENABLE_bm | CLKCTRL_RUNSTDBY_bm);
+}
+
+// Called by the RTC ISR at each beat until the crystal is in use: once XOSC32K is
+// stable, switch the RTC over to it at this beat boundary. CNT and the period
+// are kept, the counter only stops for the CTRLA synchronizations (~100µs, below
+// one tick), so the crystal beats continue the phase of the boot beats.
+static void boot_handover_poll() {
+    if (!(CLKCTRL.MCLKSTATUS & CLKCTRL_XOSC32KS_bm)) {
+        return;
+    }
+    
+    // CLKSEL may only change while the RTC is disabled
+    RTC.CTRLA = RTC_PRESCALER_DIV32_gc | RTC_RUNSTDBY_bm;
+    rtc_sync_wait(RTC_CTRLABUSY_bm);
+    RTC.CLKSEL = RTC_CLKSEL_TOSC32K_gc;
+    RTC.CTRLA = RTC_PRESCALER_DIV32_gc | RTC_RTCEN_bm | RTC_RUNSTDBY_bm;
+    boot_timebase = false;
 }
+#endif
 
 // Initialize RTC for periodic wake-up
 void rtc_init() {
     // Disable RTC during configuration
-    while (RTC.STATUS > 0);
+    rtc_sync_wait(0xFF);
     
-    // Select 32.768kHz external crystal for precise timing (±20 ppm typical)
-    // External crystal connected to TOSC1/TOSC2 pins (PA0/PA1)
-    // For internal oscillator (±3% accuracy), use: RTC_CLKSEL_INT32K_gc
-    RTC.CLKSEL = RTC_CLKSEL_TOSC32K_gc; // Use external 32.768kHz crystal
+#ifdef USE_FAST_BOOT
+    // Beat from OSCULP32K right away, the crystal starts in the background and
+    // the RTC ISR switches over once it is stable (see boot_handover_poll())
+    RTC.CLKSEL = RTC_CLKSEL_INT32K_gc;
+    boot_timebase = true;
+    xosc32k_start();
+#else
+    if (board.rtc_crystal) {
+        // Select 32.768kHz external crystal for precise timing (±20 ppm typical)
+        // External crystal connected to TOSC1/TOSC2 pins (PB3/PB2)
+        RTC.CLKSEL = RTC_CLKSEL_TOSC32K_gc; // Use external 32.768kHz crystal
+    } else {
+        RTC.CLKSEL = RTC_CLKSEL_INT32K_gc;  // Internal OSCULP32K (±3% accuracy)
+    }
+#endif
     
     // Set period based on current BPM
-    RTC.PER = calculate_rtc_period(current_bpm);
+    beat_init(&beat_state, calculate_rtc_period(App::bpm()));
+    rtc_next_period();
     
     // Enable periodic interrupt
     RTC.INTCTRL = RTC_OVF_bm;
@@ -90,18 +793,308 @@ void rtc_init() {
 }
 
 // Update RTC period when BPM changes
-void update_rtc_period() {
-    // Disable RTC
-    RTC.CTRLA = 0;
-    while (RTC.STATUS > 0);
+// The RTC keeps counting: the new period is latched by the overflow ISR at the
+// next beat boundary, so the beat in progress keeps its length and phase is preserved
+void update_rtc_period(uint16_t bpm) {
+    const BpmPeriod* period = calculate_rtc_period(bpm);
     
-    // Update period
-    RTC.PER = calculate_rtc_period(current_bpm);
-    activation_period_ms = 60000 / current_bpm;
+    cli();  // 16-bit pointer shared with the RTC ISR
+    beat_request(&beat_state, period);
+#ifdef USE_EVENT_PULSE
+    beat_wakes_resume();  // The overflow ISR latches the change at the next beat
+#endif
+    sei();
     
-    // Re-enable RTC
-    RTC.CTRLA = RTC_PRESCALER_DIV32_gc | RTC_RTCEN_bm | RTC_RUNSTDBY_bm;
+    activation_period_ms = bpm_table_ms.entry[bpm_index(bpm)].ticks;
+}
+
+// Restore the saved tempo (called before rtc_init(), which starts the beat at App::bpm())
+// Without board.tempo_store every reset starts at BPM_DEFAULT: the core never
+// saves, and no EEPROM access is left in the build
+void tempo_restore() {
+    if (board.tempo_store) {
+        App::restore(tempo_store_restore(&tempo_store, TEMPO_RING));
+    }
+    activation_period_ms = bpm_table_ms.entry[bpm_index(App::bpm())].ticks;
+}
+
+// Save the tempo into the next slot of the ring
+// The record is loaded into the EEPROM page buffer through the mapped EEPROM, then
+// NVMCTRL erases and writes only the loaded bytes (~4ms). The write runs on its own
+// and completes while the CPU sleeps, so the core goes straight back to sleep.
+void tempo_save(uint16_t bpm) {
+    TempoRecord rec;
+    uint8_t slot;
+    if (!tempo_store_next(&tempo_store, bpm, &rec, &slot)) {
+        return;
+    }
+    
+    while (NVMCTRL.STATUS & NVMCTRL_EEBUSY_bm);  // Saves are beats apart, never busy in practice
+    
+    const uint8_t* src = (const uint8_t*)&rec;
+    volatile uint8_t* dst = (volatile uint8_t*)&TEMPO_RING[slot];
+    for (uint8_t i = 0; i < sizeof(rec); i++) {
+        dst[i] = src[i];
+    }
+    _PROTECTED_WRITE_SPM(NVMCTRL.CTRLA, NVMCTRL_CMD_PAGEERASEWRITE_gc);
+}
+
+// Set up ADC0 for the supply samples, left disabled until a conversion
+// The internal 1.1V reference is the input, VDD the reference; CLK_ADC = CLK_PER / 4
+// (833kHz, 312kHz with -DUSE_EVENT_PULSE), and the first conversion after enabling
+// waits INITDLY for the reference to start up (at least 32µs at either clock)
+void supply_init() {
+    VREF.CTRLA = VREF_ADC0REFSEL_1V1_gc;
+    ADC0.CTRLA = 0;  // Disabled, 10 bits
+    ADC0.CTRLC = SUPPLY_ADC_CTRLC;
+    ADC0.CTRLD = ADC_INITDLY_DLY32_gc;
+    ADC0.MUXPOS = ADC_MUXPOS_INTREF_gc;
+    App::supply_init(SUPPLY_SCALE);
+}
+
+// One supply conversion (called by the core in a beat wake, every BATTERY_SAMPLE_BEATS)
+// ADC0 and the reference are only on for the ~60µs of the conversion; the wait runs
+// at the work clock, the ADC is clocked from it
+uint16_t supply_measure() {
+    ADC0.CTRLA = ADC_ENABLE_bm;
+    ADC0.COMMAND = ADC_STCONV_bm;
+    while (!(ADC0.INTFLAGS & ADC_RESRDY_bm));
+    uint16_t reading = ADC0.RES;  // Clears RESRDY
+    ADC0.CTRLA = 0;
+    return reading;
+}
+
+// Die temperature in °C (called by the core right after supply_measure(), every
+// XTAL_TEMP_SAMPLES supply samples): one conversion of the temperature sensor, with
+// the factory gain and offset of the signature row (multiply and shift, no division)
+int16_t temperature_measure() {
+    ADC0.CTRLC = TEMPSENSE_ADC_CTRLC;
+    ADC0.MUXPOS = ADC_MUXPOS_TEMPSENSE_gc;
+    ADC0.SAMPCTRL = TEMPSENSE_SAMPLEN;
+    ADC0.CTRLA = ADC_ENABLE_bm;
+    ADC0.COMMAND = ADC_STCONV_bm;
+    while (!(ADC0.INTFLAGS & ADC_RESRDY_bm));
+    uint16_t reading = ADC0.RES;  // Clears RESRDY
+    ADC0.CTRLA = 0;
+    
+    // Back to the supply conversion
+    ADC0.SAMPCTRL = 0;
+    ADC0.CTRLC = SUPPLY_ADC_CTRLC;
+    ADC0.MUXPOS = ADC_MUXPOS_INTREF_gc;
+    
+    uint32_t kelvin = (uint32_t)(reading - (int8_t)SIGROW.TEMPSENSE1) * SIGROW.TEMPSENSE0;
+    return (int16_t)((kelvin + 0x80) >> 8) - 273;
+}
+
+// New crystal correction (main loop): applied by the RTC ISR from the next beat
+// Without the crystal there is no curve to correct, OSCULP32K beats uncorrected.
+void xtal_trim_apply(int32_t ppb) {
+    if (!board.rtc_crystal) {
+        return;
+    }
+    cli();  // 32-bit state shared with the RTC ISR
+    drift_set(&xtal_drift, ppb);
+#ifdef USE_EVENT_PULSE
+    // The overflow ISR corrects the beats
+    if (xtal_drift.step) {
+        beat_wakes_resume();
+    }
+#endif
+    sei();
+}
+
+// Battery level changed (main loop, in a beat wake): shorten or restore the pulses
+void power_level_apply(uint8_t level) {
+    pulse_shift = battery_width_shift(level);
+#ifdef USE_EVENT_PULSE
+    // The plain pattern leaves the width in CCMP for the overflow event. This runs
+    // in the beat wake, far earlier in the pulse than its shortest width, so the
+    // pulse in progress already ends at the new width.
+    cli();  // 16-bit register, also written by the RTC ISR
+    if (event_pulse_auto) {
+        TCB0.CCMP = pulse_width_tcb.ticks[STEP_BEAT] >> pulse_shift;
+    }
+    sei();
+#endif
+}
+
+// Disable the digital input buffer of the unused pins on a port
+// A floating pin with its input buffer enabled can draw leakage current in sleep
+static void port_disable_unused(PORT_t* port, uint8_t unused_pins) {
+    volatile uint8_t* pinctrl = &port->PIN0CTRL;
+    for (uint8_t pin = 0; pin < 8; pin++) {
+        if (unused_pins & (1 << pin)) {
+            pinctrl[pin] = PORT_ISC_INPUT_DISABLE_gc;
+        }
+    }
+}
+
+// Put all unused pins into their lowest leakage state
+void unused_pins_init() {
+    port_disable_unused(&PORTA, PORTA_UNUSED_PINS);
+    port_disable_unused(&PORTB, PORTB_UNUSED_PINS);
+    port_disable_unused(&PORTC, PORTC_UNUSED_PINS);
+}
+
+#ifdef ENABLE_INSTRUMENTATION
+WakeLog wake_log;
+static volatile WakeState wake_state;
+
+// Stack area: the free RAM from the end of the static data (__heap_start, nothing
+// is allocated on the heap) up to RAMEND, which the stack grows down into
+extern uint8_t __heap_start;
+#define STACK_AREA_SIZE ((uint16_t)((uint8_t*)(RAMEND + 1) - &__heap_start))
+
+// Paint the stack area below the stack pointer with STACK_PAINT before main() runs
+// (.init3: SP is set and no interrupt is enabled yet, .data and .bss lie below
+// __heap_start). Naked with no call: it runs inline in the startup code.
+__attribute__((naked, used, section(".init3"))) static void stack_paint() {
+    for (uint8_t* p = &__heap_start; p < (uint8_t*)SP; p++) {
+        *p = STACK_PAINT;
+    }
+}
+
+// Awake time is counted by TCA0 at CLK_PER/8 (16 bits, ~157ms at 3.33MHz); the
+// count runs slower while a busy wait has the CPU clock reduced.
+// TCA0 is only enabled while the CPU is awake. Must run after unused_pins_init(),
+// which disables the marker's input buffer.
+void instr_init() {
+    TCA0.SINGLE.PER = 0xFFFF;
+    
+    // Awake marker: output, high (we are awake until the first sleep)
+    (&PORTA.PIN0CTRL)[board.awake] = 0;
+    PORTA.DIRSET = INSTR_AWAKE_PIN;
+    PORTA.OUTSET = INSTR_AWAKE_PIN;
+    
+    // Log a watchdog reset, then clear the reset flags
+    if (RSTCTRL.RSTFR & RSTCTRL_WDRF_bm) {
+        wake_log_push(&wake_log, WAKE_WDT_RESET, 0, 0);
+    }
+    RSTCTRL.RSTFR = RSTCTRL.RSTFR;  // Write 1 to clear
+}
+
+// Called at the start of every ISR that can wake the CPU
+static inline void instr_wake(uint8_t cause) {
+    if (wake_state_begin(&wake_state, cause)) {
+        TCA0.SINGLE.CNT = 0;
+        TCA0.SINGLE.CTRLA = INSTR_TCA_PRESCALER | TCA_SINGLE_ENABLE_bm;
+        PORTA.OUTSET = INSTR_AWAKE_PIN;
+    }
+}
+
+static inline void instr_beat_error(int16_t error) {
+    wake_state.beat_error = error;
+}
+
+// Called right before sleeping, with interrupts disabled (enter_sleep() enables
+// them right before the SLEEP instruction)
+static inline void instr_sleep() {
+    TCA0.SINGLE.CTRLA = 0;
+    wake_state_end(&wake_state, &wake_log, TCA0.SINGLE.CNT);
+    PORTA.OUTCLR = INSTR_AWAKE_PIN;
+}
+
+// Stack high-water scan every STACK_CHECK_BEATS beats (main loop, interrupts
+// enabled, about 5 cycles per painted byte left)
+static inline void instr_stack_check() {
+    static uint32_t checked;  // wake_log.beats at the last scan
+    if (stack_check_due(&wake_log, checked)) {
+        checked = wake_log.beats;
+        wake_log.stack_free = stack_unused(&__heap_start, STACK_AREA_SIZE);
+    }
+}
+#else
+static inline void instr_init() {}
+static inline void instr_wake(uint8_t) {}
+static inline void instr_beat_error(int16_t) {}
+static inline void instr_sleep() {}
+static inline void instr_stack_check() {}
+#endif
+
+#ifdef ENABLE_SERIAL
+// USART0 BAUD register: 64 * CLK_PER / (16 * baud), rounded (1389 at 3.33MHz, 521
+// at 1.25MHz with -DUSE_EVENT_PULSE)
+#define SERIAL_BAUD_REG ((uint16_t)((4UL * CLK_PER_HZ + SERIAL_BAUD / 2) / SERIAL_BAUD))
+
+static_assert(SERIAL_BAUD_REG >= 64, "USART0 BAUD must be 64 or more");
+
+// Values of the serial replies, read by serial_fill() in the main loop
+struct SerialSource {
+    static void status(SerialStatus* status) {
+        status->bpm = App::bpm();
+        status->pattern = App::pattern();
+        status->level = App::power_level();
+        status->mv = battery_mv(SUPPLY_SCALE, App::supply_reading());
+        status->ppb = App::xtal_trim();
+#ifdef ENABLE_INSTRUMENTATION
+        status->wakes = ::wake_log.wakes;
+        status->beats = ::wake_log.beats;
+#endif
+    }
+    
+    static const WakeLog* wake_log() {
+#ifdef ENABLE_INSTRUMENTATION
+        return &::wake_log;
+#else
+        return nullptr;
+#endif
+    }
+    
+    static uint8_t irq_save() {
+        return AttinyHal::irq_save();
+    }
+    
+    static void irq_restore(uint8_t state) {
+        AttinyHal::irq_restore(state);
+    }
+};
+
+// Set up USART0, 8N1 at SERIAL_BAUD on its alternate pins: TXD PA1, RXD PA2 (pulled
+// up while unconnected). The default pins PB2 / PB3 are TOSC2 / TOSC1.
+// Start-of-frame detection restarts OSC20M from Standby for a received byte.
+void usart_init() {
+    serial_init(&serial_link);
+    PORTMUX.CTRLB |= PORTMUX_USART0_bm;  // Alternate pins
+    PORTA.OUTSET = SERIAL_TXD_PIN;  // The line idles high
+    PORTA.DIRSET = SERIAL_TXD_PIN;
+    PORTA.PIN2CTRL = PORT_PULLUPEN_bm;
+    USART0.BAUD = SERIAL_BAUD_REG;
+    USART0.CTRLA = USART_RXCIE_bm;
+    USART0.CTRLB = USART_RXEN_bm | USART_TXEN_bm | USART_SFDEN_bm;
+}
+
+// Format the replies and beat stamps into the ring and start sending them (main
+// loop, right before the sleep). The data register empty interrupt takes it from
+// there.
+static void serial_service() {
+    serial_fill<SerialSource>(&serial_link);
+    
+    cli();  // CTRLA is also written by the USART0 ISRs
+    if (serial_tx_pending(&serial_link)) {
+        USART0.CTRLA |= USART_DREIE_bm;
+    }
+    sei();
+}
+
+// A request or a stamp waits for serial_service() (interrupts disabled)
+static inline bool serial_pending() {
+    return serial_work_pending(&serial_link);
+}
+
+// Bytes are being sent: USART0 is not clocked in Standby, the CPU sleeps in Idle
+// until the last one is out (interrupts disabled)
+static inline bool serial_tx_busy() {
+    return USART0.CTRLA & (USART_DREIE_bm | USART_TXCIE_bm);
+}
+#else
+static inline void serial_service() {}
+static inline bool serial_pending() {
+    return false;
+}
+static inline bool serial_tx_busy() {
+    return false;
 }
+#endif
 
 // Initialize output pin
 void output_pin_init() {
@@ -109,35 +1102,331 @@ void output_pin_init() {
     PORTA.OUTCLR = OUTPUT_PIN;  // Start low
 }
 
+#ifdef USE_EVENT_PULSE
+// Route the RTC overflow (beat edge) to TCB0 and let TCB0 time the output pulse
+// TCB0 single-shot: the event sets WO and starts the counter, WO is cleared when
+// the counter reaches CCMP. Must run after output_pin_init() (pin direction).
+// CLK_PER is set to OSC20M / 16 by clock_init().
+void event_pulse_init() {
+    // RTC overflow -> asynchronous channel 0 -> TCB0 (asynchronous user 0)
+    EVSYS.ASYNCCH0 = EVSYS_ASYNCCH0_RTC_OVF_gc;
+    EVSYS.ASYNCUSER0 = EVSYS_ASYNCUSER0_ASYNCCH0_gc;
+    
+    // The plain beat pattern leaves the beat pulses to the overflow event, any
+    // other pattern has the RTC ISR strobe the channel (see event_pulse_beat())
+    event_pulse_auto = pattern_plain();
+    if (!event_pulse_auto) {
+        EVSYS.ASYNCCH0 = EVSYS_ASYNCCH0_OFF_gc;
+    }
+    
+    // Single-shot, waveform output on PA5, output set asynchronously on the event
+    TCB0.CCMP = pulse_width_tcb.ticks[STEP_BEAT];
+    TCB0.CTRLB = TCB_CNTMODE_SINGLE_gc | TCB_CCMPEN_bm | TCB_ASYNC_bm;
+    TCB0.EVCTRL = TCB_CAPTEI_bm;  // Start on the rising edge of the event
+    
+    // RUNSTDBY: TCB0 keeps clocking in standby, the CPU does not wake for the pulse
+    // The pulse starts without the CPU, so TCB0 must be ready in Standby at every beat:
+    // CLK_PER (OSC20M) stays requested in every Standby sleep, not only for the pulse
+    TCB0.CTRLA = TCB_CLKSEL_CLKDIV2_gc | TCB_RUNSTDBY_bm | TCB_ENABLE_bm;
+}
+
+// Start the pulse of a step from the RTC ISR: TCB0 is idle (every pulse ends
+// before the next step), so its width can be set before the channel is strobed
+static void event_pulse_step(uint8_t kind) {
+    if (kind == STEP_REST) {
+        return;
+    }
+    TCB0.CCMP = pulse_width_tcb.ticks[kind] >> pulse_shift;
+    EVSYS.ASYNCSTROBE = EVENT_PULSE_STROBE;
+}
+
+// Called by the RTC ISR at a beat, once the pattern is latched: route the overflow
+// event for the next beats and start this beat's pulse if the event did not. The
+// first beat after leaving the plain pattern keeps the pulse the event started.
+static void event_pulse_beat(uint8_t kind) {
+    bool started = event_pulse_auto;
+    bool plain = !board.sequencer || seq_plain(&sequencer);
+    if (plain != started) {
+        EVSYS.ASYNCCH0 = plain ? EVSYS_ASYNCCH0_RTC_OVF_gc : EVSYS_ASYNCCH0_OFF_gc;
+        event_pulse_auto = plain;
+    }
+    if (!started) {
+        event_pulse_step(kind);
+    }
+}
+#else
+static inline void event_pulse_step(uint8_t) {}
+static inline void event_pulse_beat(uint8_t) {}
+#endif
+
+// Called by the RTC ISR at a beat, after the period of the beat is set: time the
+// first sub-step of a subdivided pattern from the beat edge (CNT 0)
+static void step_timer_beat() {
+    uint8_t subdiv = pattern_subdiv();
+    if (subdiv == 1) {
+        rtc_timer_stop(RTC_TIMER_STEP);
+        return;
+    }
+    
+    step_ticks = substep_table_1024hz.ticks[subdiv - 2][beat_state.period - bpm_table_1024hz.entry];
+    rtc_timer_at(RTC_TIMER_STEP, step_ticks);
+}
+
+// Sub-step timer expired (called from the RTC ISR): start the step and time the
+// next one. Deadlines are whole multiples of the sub-step length from the beat
+// edge, so the steps do not drift with the interrupt latency; a step that would
+// fall past the end of a realigned beat is dropped.
+static void step_timer_expired() {
+    uint8_t kind = seq_step(&sequencer);
+    event_pulse_step(kind);
+    App::on_step(kind);
+    
+    uint16_t next = rtc_timer_deadline[RTC_TIMER_STEP] + step_ticks;
+    if (seq_steps_left(&sequencer) && next <= RTC.PER) {
+        rtc_timer_at(RTC_TIMER_STEP, next);
+    }
+}
+
+// Select a pattern, started by the RTC ISR at the next beat
+void sequencer_request(uint8_t pattern) {
+    cli();  // 16-bit pointer shared with the RTC ISR
+    seq_request(&sequencer, &seq_patterns[pattern]);
+#ifdef USE_EVENT_PULSE
+    beat_wakes_resume();  // The overflow ISR latches the change at the next beat
+#endif
+    sei();
+}
+
 // Initialize button pins with interrupts
 void button_init() {
     // Configure buttons as inputs with pull-up
-    PORTB.DIRCLR = BUTTON_INC_PIN | BUTTON_DEC_PIN | BUTTON3_PIN;
+    PORTB.DIRCLR = BUTTON_PINS;
+    
+    // Enable pull-ups and interrupts on both edges (press and release), which
+    // wake the CPU from Standby on any pin
+    for (uint8_t i = 0; i < BUTTON_COUNT; i++) {
+        (&PORTB.PIN0CTRL)[board.button[i]] = PORT_PULLUPEN_bm | PORT_ISC_BOTHEDGES_gc;
+    }
+}
+
+// Tap clock now (interrupt context or interrupts disabled): if CNT has wrapped and
+// the RTC ISR has not run yet, the beat that just ended is added here
+static uint16_t tap_clock_now() {
+    uint16_t cnt = RTC.CNT;
+    if (RTC.INTFLAGS & RTC_OVF_bm) {
+        return tap_clock + RTC.PER + 1 + RTC.CNT;
+    }
+    return tap_clock + cnt;
+}
+
+// Called by the RTC ISR at each beat, before the period of the next beat is set:
+// advance the tap clock, stop it once the run of taps has timed out
+static void tap_clock_beat() {
+    if (!tap_clock_on) {
+        return;
+    }
+    tap_clock += RTC.PER + 1;
+    if ((uint16_t)(tap_clock - tap_edge) > tap_max_interval(&bpm_table_1024hz)) {
+        tap_clock_on = false;
+        tap_reset(&tap_tempo);
+    }
+}
+
+// Press edge on the tap button (called from the PORTB ISR): timestamp it, starting
+// the tap clock for the first tap of a run
+static void tap_press_edge() {
+    if (!tap_clock_on) {
+        tap_clock = 0;
+        tap_clock_on = true;
+        tap_reset(&tap_tempo);
+#ifdef USE_EVENT_PULSE
+        beat_wakes_resume();  // The beat ISR has to advance the clock
+#endif
+    }
+    tap_edge = tap_clock_now();
+}
+
+// Tap press confirmed (called from the RTC ISR): hand the tempo of the run to the core
+static void tap_confirmed() {
+    uint16_t bpm = tap_next(&tap_tempo, &bpm_table_1024hz, tap_edge - tap_last);
+    tap_last = tap_edge;
+    if (bpm) {
+        App::on_tap(bpm);
+    }
+}
+
+// Move the end of the beat in progress to one beat at bpm after the last tap
+// (main loop, after the tempo was handed to set_tempo()). The new period starts at
+// that edge, so the beats fall on the phase of the taps. Skipped if the edge has
+// already passed or an overflow is waiting for the ISR; the next tap aligns.
+void tap_align_beat(uint16_t bpm) {
+    uint16_t period = bpm_table_1024hz.entry[bpm_index(bpm)].ticks;
+    
+    cli();  // RTC registers and the tap clock are shared with the RTC ISR
+    if (!tap_clock_on || (RTC.INTFLAGS & RTC_OVF_bm)) {
+        sei();
+        return;
+    }
+    uint16_t cnt = RTC.CNT;
+    uint16_t elapsed = tap_clock + cnt - tap_last;
+    if (elapsed + 2 >= period) {
+        sei();
+        return;
+    }
+    rtc_set_beat_end(cnt + (period - elapsed) - 1);
+    sei();
+    
+    watchdog_relax();
+}
+
+#ifdef ENABLE_SYNC
+// Sync input edge from the leader (called from the PORTA ISR): timestamp it on CNT,
+// as a position in the beat in progress, and move the end of the beat by the
+// correction of the loop. Skipped while an overflow waits for the RTC ISR (CNT
+// already counts the next beat, PER not yet) and while the RTC runs from the
+// internal oscillator at boot. The realign only lengthens the beat, to less than
+// two periods, and a correction shortens it by at most the window: both stay
+// inside the watchdog window of the tempo.
+static void sync_input_edge() {
+    uint16_t cnt = RTC.CNT;
+    if (RTC.INTFLAGS & RTC_OVF_bm) {
+        return;
+    }
+#ifdef USE_FAST_BOOT
+    if (boot_timebase) {
+        return;
+    }
+#endif
+    
+    int16_t ticks;
+    if (sync_edge(&beat_sync, cnt, RTC.PER + 1, sync_window_1024hz, SYNC_GUARD_TICKS, &ticks)) {
+        rtc_set_beat_end(RTC.PER + ticks);
+        sync_adjusted = true;
+    }
+#ifdef USE_EVENT_PULSE
+    // The beat ISR has to set the period of the next beat
+    if (sync_adjusting()) {
+        beat_wakes_resume();
+    }
+#endif
+}
+
+// Sync input on PA6, rising edges (the leader's pulses). PA6 is a fully
+// asynchronous pin: the edge wakes the CPU from Standby. No pull-up, it would
+// draw current while the leader holds the line low, so -DENABLE_SYNC units need
+// the leader connected (a floating input toggles at random).
+void sync_input_init() {
+    sync_init(&beat_sync);
+    PORTA.DIRCLR = SYNC_PIN;
+    (&PORTA.PIN0CTRL)[board.sync] = PORT_ISC_RISING_gc;
+}
+#endif
+
+// Arm the debounce timer: RTC compare interrupt DEBOUNCE_DELAY_MS from now
+// Re-arming on every edge restarts the window, so contacts must be quiet for 50ms
+void debounce_timer_arm() {
+    rtc_timer_start(RTC_TIMER_DEBOUNCE, DEBOUNCE_RTC_TICKS);
+}
+
+// Arm the debounce timer for the next auto-repeat step of a held button
+void repeat_timer_arm(uint8_t stage) {
+    rtc_timer_start(RTC_TIMER_DEBOUNCE, repeat_table_1024hz.ticks[stage]);
+}
+
+// Advance the state machines on a pin edge (called from the PORTB ISR)
+void debounce_edge(uint8_t pin_flags) {
+    for (uint8_t i = 0; i < BUTTON_COUNT; i++) {
+        if (!(pin_flags & button_pins[i])) {
+            continue;
+        }
+        if (i == BUTTON_TAP && button_state[i] == BUTTON_IDLE) {
+            tap_press_edge();  // First edge of a press: the tap time
+        }
+        debounce_on_edge(&button_state[i]);
+    }
+    repeat_on_edge(&button_repeat);
+    debounce_timer_arm();
+}
+
+// Advance the state machines once contacts have settled or a repeat step is due
+// (called from the RTC ISR)
+void debounce_timer_expired() {
+    uint8_t pins = PORTB.IN;
+    bool repeat_tick = button_repeat.armed;
+    bool held = false;
+    for (uint8_t i = 0; i < BUTTON_COUNT; i++) {
+        bool down = !(pins & button_pins[i]);  // Active low
+        bool repeats = BUTTON_REPEAT_MASK & (1 << i);
+        
+        DebounceEvent event = debounce_on_settle(&button_state[i], down, repeat_tick);
+        if (event == DEBOUNCE_PRESS) {
+            App::on_button(i);  // Confirmed press, action runs in main loop
+            if (i == BUTTON_TAP) {
+                tap_confirmed();
+            }
+        } else if (event == DEBOUNCE_REPEAT && repeats) {
+            App::on_repeat(i);
+        }
+        held |= repeats && button_state[i] == BUTTON_HELD;
+    }
     
-    // Enable pull-ups and falling edge interrupts
-    PORTB.PIN0CTRL = PORT_PULLUPEN_bm | PORT_ISC_FALLING_gc;  // Increase BPM
-    PORTB.PIN1CTRL = PORT_PULLUPEN_bm | PORT_ISC_FALLING_gc;  // Decrease BPM
-    PORTB.PIN2CTRL = PORT_PULLUPEN_bm | PORT_ISC_FALLING_gc;  // Reserved
+    // Held: the same timer times the next repeat step
+    uint8_t stage = repeat_on_settle(&button_repeat, held);
+    if (stage == REPEAT_STOP) {
+        App::on_repeat_end();
+    } else {
+        repeat_timer_arm(stage);
+    }
 }
 
 // Activate output pin for specified duration
-// Note: Uses blocking delay (_delay_ms). This keeps the MCU awake during the 50ms pulse.
-// The RTC continues running during this time, so timing accuracy is maintained.
-// Alternative timer-based approach would require keeping a timer running during sleep,
-// which increases power consumption more than this brief wake period.
-void activate_output() {
+#if defined(USE_EVENT_PULSE)
+// The pulse is generated by TCB0, started by the RTC overflow event or by the RTC
+// ISR (see event_pulse_beat()), nothing to do here
+void activate_output(uint8_t) {
+}
+#elif defined(USE_BLOCKING_PULSE)
+// Note: Busy-waits on the RTC counter. This keeps the MCU awake during the pulse,
+// at the reduced wait clock. Timed by the RTC, so it is correct at any CPU clock.
+void activate_output(uint8_t kind) {
+    uint16_t width = pulse_width_rtc.ticks[kind] >> pulse_shift;
+    
+    cli();  // 16-bit RTC reads share the RTC TEMP register with the ISRs
     PORTA.OUTSET = OUTPUT_PIN;  // Set pin high
-    _delay_ms(ACTIVATION_DURATION_MS);  // Blocking delay for 50ms pulse
+    uint16_t start = RTC.CNT;
+    sei();
+    
+    uint8_t prescaler = clock_wait_begin();
+    uint16_t elapsed;
+    do {
+        cli();
+        elapsed = rtc_ticks_between(start, RTC.CNT);
+        sei();
+    } while (elapsed < width);
+    clock_wait_end(prescaler);
+    
     PORTA.OUTCLR = OUTPUT_PIN;  // Set pin low
 }
+#else
+// Raise the pin and set the pulse timer on the RTC compare, the CPU goes back to
+// sleep right away; the compare interrupt ends the pulse
+void activate_output(uint8_t kind) {
+    cli();
+    PORTA.OUTSET = OUTPUT_PIN;  // Set pin high
+    rtc_timer_start(RTC_TIMER_PULSE, pulse_width_rtc.ticks[kind] >> pulse_shift);
+    sei();
+}
+#endif
 
 // Enter ultra-low power sleep mode (~1-2µA current consumption)
-// This function puts the ATTiny1616 into Power-Down mode, the deepest sleep state.
+// This function puts the ATTiny1616 into Standby, the deepest sleep state in which
+// the RTC counter keeps timing the beat (Power-Down only keeps the RTC PIT).
 // 
 // Sleep mode behavior:
 //   - CPU is stopped
 //   - All peripherals are disabled EXCEPT:
-//     * RTC (configured with RUNSTDBY to wake periodically)
+//     * RTC (configured with RUNSTDBY to wake periodically, Standby only)
+//     * TCB0 with -DUSE_EVENT_PULSE (RUNSTDBY, Standby only)
 //     * Watchdog Timer (WDT)
 //     * Pin-change interrupts (for buttons)
 //   - Execution resumes when an interrupt occurs (RTC overflow or button press)
@@ -145,144 +1434,277 @@ void activate_output() {
 // Wake-up sources:
 //   - RTC overflow interrupt (periodic, based on BPM setting)
 //   - Button press interrupts (PORTB pin changes)
+//   - RTC compare interrupt (end of a debounce window or of the output pulse, sub-step)
 //   - Watchdog timer timeout (system recovery)
+//   - USART0 start of frame, received byte, transmit interrupts (-DENABLE_SERIAL;
+//     Idle sleep while a transmission is in progress)
+//
+// With -DUSE_EVENT_PULSE, EVSYS and TCB0 (RUNSTDBY) keep running in Standby and
+// generate the output pulse without waking the CPU.
+// 
+// Interrupts stay off from the event check to the SLEEP instruction: SEI only lets
+// an interrupt in after the next instruction, so an event raised after the core's
+// last poll (or an interrupt that becomes pending right after SEI) is taken as a
+// wake from SLEEP, never slept through until the next beat.
 void enter_sleep() {
-    wdt_reset();  // Reset watchdog timer to prevent timeout during sleep
+    serial_service();  // Replies and beat stamps of the serial link
+    instr_stack_check();
+    
+    cli();
+    if (App::events_pending() || serial_pending()) {
+        sei();  // Back to the core, which takes the events
+        return;
+    }
     
-    set_sleep_mode(SLEEP_MODE_PWR_DOWN);  // Configure deepest sleep mode
+    instr_sleep();  // Close the wake record and drop the awake marker
+    watchdog_sleep();  // The main loop got here: the next quiet beat may reset the WDT
+    
+    // No transmission can start between the mode selection and the SLEEP instruction
+    if (serial_tx_busy()) {
+        set_sleep_mode(SLEEP_MODE_IDLE);      // USART0 sends
+    } else {
+        set_sleep_mode(SLEEP_MODE_STANDBY);   // RTC counter / TCB0 keep running
+    }
     sleep_enable();                        // Set Sleep Enable bit in MCU control register
-    sei();                                 // Ensure global interrupts are enabled (required for wake-up)
+    sei();                                 // Enabled after the next instruction (required for wake-up)
     sleep_cpu();                          // Execute SLEEP instruction - MCU enters sleep HERE
                                           // *** Execution pauses at this point until wake-up interrupt ***
     sleep_disable();                      // Clear Sleep Enable bit after wake-up (safety/best practice)
 }
 
-// RTC overflow interrupt - triggers based on BPM setting
+// RTC interrupt - overflow triggers based on BPM setting, compare ends a debounce window
+// and / or the output pulse, or starts a sub-step
 ISR(RTC_CNT_vect) {
-    RTC.INTFLAGS = RTC_OVF_bm;  // Clear interrupt flag
-    activation_flag = true;
-}
-
-// Button interrupt handler - sets flags for main loop processing
-ISR(PORTB_PORT_vect) {
-    uint8_t flags = PORTB.INTFLAGS;
-    PORTB.INTFLAGS = flags;  // Clear interrupt flags
-    
-    // Set flags for button presses - actual debouncing and processing in main loop
-    if (flags & BUTTON_INC_PIN) {
-        button_inc_pressed = true;
-    }
+    uint8_t flags = RTC.INTFLAGS & RTC.INTCTRL;
+    RTC.INTFLAGS = flags;  // Clear interrupt flags
     
-    if (flags & BUTTON_DEC_PIN) {
-        button_dec_pressed = true;
+#ifdef USE_EVENT_PULSE
+    // Beat of a quiet run: the overflow event started the pulse, the beat is counted
+    // and PER set for the next one (error diffusion, crystal correction)
+    if ((flags & RTC_OVF_bm) && quiet_left) {
+        instr_wake(WAKE_BEAT);
+        rtc_next_period();
+        quiet_beats++;
+        quiet_left--;
+        watchdog_quiet_beat();
+        flags &= ~RTC_OVF_bm;
     }
+#endif
     
-    if (flags & BUTTON3_PIN) {
-        button3_pressed = true;
-    }
-}
-
-// Process a single button press with proper debouncing
-// Returns true if button was successfully processed
-bool process_single_button(uint8_t pin_mask, bool* pressed_flag, void (*action)()) {
-    if (!*pressed_flag) {
-        return false;
+    if (flags & RTC_OVF_bm) {
+        instr_wake(WAKE_BEAT);
+#ifdef ENABLE_INSTRUMENTATION
+        instr_beat_error(RTC.CNT);  // Ticks since the overflow (beat edge)
+#endif
+        
+        // Beat boundary: CNT just wrapped to 0, so PER written now applies to this beat
+        // (PER synchronizes within a few RTC clocks, well before the next tick)
+        // A pending tempo change is applied here, without losing phase
+        tap_clock_beat();
+#ifdef ENABLE_SERIAL
+        serial_beat(&serial_link, RTC.PER + 1);  // PER still holds the beat that ended
+#endif
+        rtc_next_period();
+#ifdef USE_FAST_BOOT
+        if (boot_timebase) {
+            boot_handover_poll();
+        }
+#endif
+        
+        // Step of the pattern that starts at this beat, a pending pattern applies
+        // from here on
+        uint8_t kind = pattern_beat();
+        step_timer_beat();
+        event_pulse_beat(kind);
+#ifdef USE_EVENT_PULSE
+        // The pulse was already started by the overflow event or event_pulse_beat(),
+        // the main loop only resets the watchdog and counts the beat (pulse() does nothing).
+        // A beat that needs nothing else starts a quiet run, up to the supply sample.
+        uint8_t skipped = quiet_beats;
+        quiet_beats = 0;
+        if (!skipped && !beat_needs_cpu()) {
+            quiet_left = App::supply_quiet_beats();
+        }
+        App::on_beat(kind, skipped);
+#else
+        App::on_beat(kind);
+#endif
     }
     
-    *pressed_flag = false;
-    _delay_ms(DEBOUNCE_DELAY_MS);  // Wait for bounce to settle
-    
-    // Check if button still pressed after debounce (active low)
-    if (!(PORTB.IN & pin_mask)) {
-        if (action) {
-            action();
+    if (flags & RTC_CMP_bm) {
+        uint8_t expired = rtc_timer_expired();
+        
+        if (expired & (1 << RTC_TIMER_DEBOUNCE)) {
+            instr_wake(WAKE_DEBOUNCE);
+            debounce_timer_expired();
+        }
+        
+        if (expired & (1 << RTC_TIMER_PULSE)) {
+            instr_wake(WAKE_PULSE);
+            PORTA.OUTCLR = OUTPUT_PIN;  // Set pin low
         }
         
-        // Wait for button release
-        while (!(PORTB.IN & pin_mask)) {
-            _delay_ms(10);
+        if (board.sequencer && (expired & (1 << RTC_TIMER_STEP))) {  // Never started without the sequencer
+            instr_wake(WAKE_STEP);
+            step_timer_expired();
         }
-        _delay_ms(DEBOUNCE_DELAY_MS);  // Debounce release
-        return true;
     }
+}
+
+// Button interrupt handler - feeds pin edges into the debounce state machines
+ISR(PORTB_PORT_vect) {
+    uint8_t flags = PORTB.INTFLAGS;
+    PORTB.INTFLAGS = flags;  // Clear interrupt flags
     
-    return false;
+    if (flags & BUTTON_PINS) {
+        instr_wake(WAKE_BUTTON);
+        debounce_edge(flags);
+    }
 }
 
-// Button action handlers
-void button_inc_action() {
-    if (current_bpm <= BPM_MAX - BPM_STEP) {
-        current_bpm += BPM_STEP;
-    } else {
-        current_bpm = BPM_MAX;
+#ifdef ENABLE_SYNC
+// Sync input interrupt - rising edge from the leader
+ISR(PORTA_PORT_vect) {
+    PORTA.INTFLAGS = SYNC_PIN;  // Clear interrupt flag
+    instr_wake(WAKE_SYNC);
+    sync_input_edge();
+}
+#endif
+
+#ifdef ENABLE_SERIAL
+// USART0 receive interrupt - one byte of a command line
+ISR(USART0_RXC_vect) {
+    instr_wake(WAKE_SERIAL);
+    uint8_t command = serial_rx_byte(&serial_link, USART0.RXDATAL);
+    
+    if (command == SERIAL_CMD_TEMPO) {
+        App::on_remote_tempo(serial_tempo(&serial_link));
+    }
+#ifdef USE_EVENT_PULSE
+    // The overflow ISR stamps the beats of the stream
+    if (command == SERIAL_CMD_STREAM && serial_streaming()) {
+        beat_wakes_resume();
     }
-    reconfigure_rtc = true;
+#endif
 }
 
-void button_dec_action() {
-    if (current_bpm >= BPM_MIN + BPM_STEP) {
-        current_bpm -= BPM_STEP;
+// USART0 data register empty interrupt - next byte of the ring, then wait for the
+// last one to leave the shift register
+ISR(USART0_DRE_vect) {
+    instr_wake(WAKE_SERIAL);
+    uint8_t c;
+    if (serial_tx_byte(&serial_link, &c)) {
+        USART0.STATUS = USART_TXCIF_bm;  // Set again once this byte is out with none after it
+        USART0.TXDATAL = c;
     } else {
-        current_bpm = BPM_MIN;
+        USART0.CTRLA = (USART0.CTRLA & ~USART_DREIE_bm) | USART_TXCIE_bm;
     }
-    reconfigure_rtc = true;
 }
 
-void button3_action() {
-    // Reserved for future functionality
+// USART0 transmit complete interrupt - the line is idle, Standby is allowed again
+ISR(USART0_TXC_vect) {
+    instr_wake(WAKE_SERIAL);
+    USART0.STATUS = USART_TXCIF_bm;
+    USART0.CTRLA &= ~USART_TXCIE_bm;
+}
+#endif
+
+// HAL policy for the metronome core (common/metronome.h)
+// Static dispatch: these inline into the core's main loop
+inline void AttinyHal::set_tempo(uint16_t bpm) {
+    update_rtc_period(bpm);
+}
+
+inline void AttinyHal::pulse(uint8_t kind) {
+    activate_output(kind);
+}
+
+inline void AttinyHal::sleep() {
+    enter_sleep();
+}
+
+inline void AttinyHal::watchdog_kick() {
+    watchdog_beat();
+}
+
+inline void AttinyHal::save_tempo(uint16_t bpm) {
+    tempo_save(bpm);
+}
+
+inline void AttinyHal::align_beat(uint16_t bpm) {
+    tap_align_beat(bpm);
+}
+
+inline void AttinyHal::set_pattern(uint8_t pattern) {
+    sequencer_request(pattern);
+}
+
+inline uint16_t AttinyHal::measure_supply() {
+    return supply_measure();
+}
+
+inline void AttinyHal::set_power_level(uint8_t level) {
+    power_level_apply(level);
+}
+
+inline int16_t AttinyHal::measure_temperature() {
+    return temperature_measure();
+}
+
+inline void AttinyHal::set_xtal_trim(int32_t ppb) {
+    xtal_trim_apply(ppb);
+}
+
+inline uint8_t AttinyHal::irq_save() {
+    uint8_t sreg = SREG;
+    cli();
+    return sreg;
 }
 
-// Process button press with proper debouncing
-// Stays awake for 50ms to debounce - acceptable since button presses are infrequent
-void process_button_presses() {
-    process_single_button(BUTTON_INC_PIN, &button_inc_pressed, button_inc_action);
-    process_single_button(BUTTON_DEC_PIN, &button_dec_pressed, button_dec_action);
-    process_single_button(BUTTON3_PIN, &button3_pressed, button3_action);
+inline void AttinyHal::irq_restore(uint8_t state) {
+    SREG = state;
 }
 
 int main(void) {
+    clock_init();
+    
     // Disable unused peripherals to save power
-    // Turn off ADC
-    ADC0.CTRLA &= ~ADC_ENABLE_bm;
+    // ADC0 stays off between the supply samples
+    supply_init();
     
     // Turn off AC (Analog Comparator)
     AC0.CTRLA &= ~AC_ENABLE_bm;
     
+#ifndef USE_LOW_LEAKAGE_PROFILE
     // Initialize watchdog timer (WDT) for system reliability
-    // 8 second timeout - provides protection without affecting sleep mode
+    // 8 second timeout without a window until the first beat, which sizes the
+    // window to the tempo (see watchdog_beat())
     // WDT continues running in all sleep modes on ATTiny1616
     wdt_enable(WDTO_8S);
+#endif
     
     // Initialize peripherals
+    unused_pins_init();
+    instr_init();
     output_pin_init();
+#ifdef USE_EVENT_PULSE
+    event_pulse_init();
+#endif
     button_init();
+#ifdef ENABLE_SERIAL
+    usart_init();
+#endif
+#ifdef ENABLE_SYNC
+    sync_input_init();
+#endif
+    tempo_restore();
     rtc_init();
     
     // Enable global interrupts
     sei();
     
-    // Main loop
-    while (1) {
-        // Reset watchdog timer
-        wdt_reset();
-        
-        // Process any pending button presses with proper debouncing
-        process_button_presses();
-        
-        // Update RTC period if BPM changed
-        if (reconfigure_rtc) {
-            reconfigure_rtc = false;
-            update_rtc_period();
-        }
-        
-        if (activation_flag) {
-            activation_flag = false;
-            activate_output();
-        }
-        
-        // Enter low power sleep mode
-        enter_sleep();
-    }
+    // Main loop: button actions, tempo changes, output pulse, sleep
+    App::run();
     
     return 0;
 }
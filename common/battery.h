@@ -0,0 +1,128 @@
+/**
+ * Supply voltage monitor shared by both firmwares
+ *
+ * Each firmware converts its internal voltage reference with the ADC against the
+ * supply, which gives a reading inversely proportional to VDD:
+ * reading = scale / VDD in mV, with scale the reference in mV times its full-scale
+ * reading (ATtiny: 1.1V against VDD, 10 bits; STM32: the factory VREFINT reading at
+ * 3.0V, 12 bits). battery_init() turns the thresholds into readings once at boot,
+ * so a sample only costs compares, no division.
+ *
+ * The core takes a sample every BATTERY_SAMPLE_BEATS beats (and at the first beat),
+ * in the beat wake right after the pulse started: the supply under the output load,
+ * the one a coin cell browns out at. The ADC is only powered for that conversion.
+ *
+ * battery_update() moves to a lower level as soon as a sample is below its
+ * threshold, and back up only once a sample is BATTERY_HYST_MV above it, so a cell
+ * sagging around a threshold does not toggle between two levels. Each level down
+ * halves the output pulse widths (battery_width_shift()), the output load being most
+ * of the charge drawn per beat.
+ *
+ * BATTERY_* (config.h) must be defined before including this header.
+ *
+ * Pure logic, no hardware access: also built by the host simulator (sim/).
+ */
+
+#ifndef BATTERY_H
+#define BATTERY_H
+
+#include <stdint.h>
+#include "config.h"
+
+enum BatteryLevel : uint8_t {
+    BATTERY_OK,        // Full pulse widths
+    BATTERY_LOW,       // Below BATTERY_LOW_MV: pulse widths halved
+    BATTERY_CRITICAL,  // Below BATTERY_CRITICAL_MV: pulse widths quartered
+    BATTERY_LEVEL_COUNT
+};
+
+static_assert(BATTERY_CRITICAL_MV + BATTERY_HYST_MV < BATTERY_LOW_MV, "Battery thresholds must not overlap");
+static_assert((SEQ_SUB_MS >> (BATTERY_LEVEL_COUNT - 1)) >= 1, "The shortest pulse must stay 1ms or longer");
+
+struct BatteryMonitor {
+    uint16_t enter[BATTERY_LEVEL_COUNT];  // A reading above this enters the level (index 0 unused)
+    uint16_t leave[BATTERY_LEVEL_COUNT];  // A reading below this leaves it (index 0 unused)
+    uint16_t reading;                     // Last sample
+    uint16_t peak;                        // Highest reading since boot: the lowest supply seen
+    uint8_t level;                        // BatteryLevel of the last sample
+    uint8_t beats;                        // Beats until the next sample, 0: at the next beat
+};
+
+// ADC reading at a supply voltage
+static inline uint16_t battery_reading(uint32_t scale, uint16_t mv) {
+    return (uint16_t)(scale / mv);
+}
+
+// Supply voltage of a reading in mV, for debugging (one division)
+static inline uint16_t battery_mv(uint32_t scale, uint16_t reading) {
+    return reading ? (uint16_t)(scale / reading) : 0;
+}
+
+// Boot only: thresholds for the reading scale of the firmware's ADC
+static inline void battery_init(BatteryMonitor* mon, uint32_t scale) {
+    mon->enter[BATTERY_OK] = 0;
+    mon->leave[BATTERY_OK] = 0;
+    mon->enter[BATTERY_LOW] = battery_reading(scale, BATTERY_LOW_MV);
+    mon->leave[BATTERY_LOW] = battery_reading(scale, BATTERY_LOW_MV + BATTERY_HYST_MV);
+    mon->enter[BATTERY_CRITICAL] = battery_reading(scale, BATTERY_CRITICAL_MV);
+    mon->leave[BATTERY_CRITICAL] = battery_reading(scale, BATTERY_CRITICAL_MV + BATTERY_HYST_MV);
+    mon->reading = 0;
+    mon->peak = 0;
+    mon->level = BATTERY_OK;
+    mon->beats = 0;
+}
+
+// Called at every beat: returns true when a sample is due in this beat wake
+static inline bool battery_due(BatteryMonitor* mon) {
+    if (mon->beats) {
+        mon->beats--;
+        return false;
+    }
+    mon->beats = BATTERY_SAMPLE_BEATS - 1;
+    return true;
+}
+
+// Beats that passed without a beat wake, counted before battery_due() of the beat
+// after them
+static inline void battery_skip(BatteryMonitor* mon, uint8_t beats) {
+    mon->beats = beats < mon->beats ? mon->beats - beats : 0;
+}
+
+// Beats that can pass without a wake after the beat in progress (not yet counted
+// by battery_due()) so that the beat after them still takes the sample
+static inline uint8_t battery_quiet_beats(const BatteryMonitor* mon) {
+    return mon->beats ? mon->beats - 1 : 0;
+}
+
+// A sample at the next beat
+static inline bool battery_sample_next(const BatteryMonitor* mon) {
+    return mon->beats == 0;
+}
+
+// New sample: returns true if the level changed
+static inline bool battery_update(BatteryMonitor* mon, uint16_t reading) {
+    mon->reading = reading;
+    if (reading > mon->peak) {
+        mon->peak = reading;
+    }
+    
+    // The reading rises as the supply falls
+    uint8_t level = mon->level;
+    while (level + 1 < BATTERY_LEVEL_COUNT && reading > mon->enter[level + 1]) {
+        level++;
+    }
+    while (level > BATTERY_OK && reading < mon->leave[level]) {
+        level--;
+    }
+    
+    bool changed = level != mon->level;
+    mon->level = level;
+    return changed;
+}
+
+// Pulse width policy: widths are shifted right by this at a level
+static inline uint8_t battery_width_shift(uint8_t level) {
+    return level;
+}
+
+#endif // BATTERY_H
@@ -0,0 +1,61 @@
+/**
+ * Beat period sequencing shared by both firmwares
+ * 
+ * The beat period in RTC ticks is ticks + rem / bpm (see bpm_table.h). At every
+ * beat boundary beat_next() returns the length of the beat that starts now, which
+ * is either ticks or ticks + 1: the fractional remainder is accumulated 
+ * (Bresenham-style error diffusion) so the long-run rate is exact.
+ * 
+ * A tempo change is latched with beat_request() and applied by beat_next() at the
+ * next beat boundary, so the beat phase is preserved. beat_next() is called from
+ * interrupt context and only does 8-bit math.
+ * 
+ * Pure logic, no hardware access: also built by the host simulator (sim/).
+ */
+
+#ifndef BEAT_SCHEDULER_H
+#define BEAT_SCHEDULER_H
+
+#include <stdint.h>
+#include "bpm_table.h"
+
+struct BeatState {
+    const BpmPeriod* period;               // Active table entry, owned by the beat ISR
+    const BpmPeriod* volatile pending;     // Latched at the next beat boundary
+    uint8_t error_acc;                     // Carried fractional ticks (< bpm)
+};
+
+static inline void beat_init(BeatState* state, const BpmPeriod* period) {
+    state->period = period;
+    state->pending = nullptr;
+    state->error_acc = 0;
+}
+
+// Select a new tempo, applied at the next beat boundary
+// On 8-bit targets the caller must make the pointer write atomic
+static inline void beat_request(BeatState* state, const BpmPeriod* period) {
+    state->pending = period;
+}
+
+// Called at a beat boundary: length in ticks of the beat that starts now
+static inline uint16_t beat_next(BeatState* state) {
+    const BpmPeriod* pending = state->pending;
+    if (pending) {
+        state->period = pending;
+        state->error_acc = 0;
+        state->pending = nullptr;
+    }
+    
+    const BpmPeriod* period = state->period;
+    uint8_t rem = period->rem;
+    uint8_t room = period->bpm - rem;
+    
+    if (state->error_acc >= room) {
+        state->error_acc -= room;  // acc + rem - bpm, without 8-bit overflow
+        return period->ticks + 1;
+    }
+    state->error_acc += rem;
+    return period->ticks;
+}
+
+#endif // BEAT_SCHEDULER_H
@@ -0,0 +1,152 @@
+/**
+ * Leader / follower beat synchronization shared by both firmwares
+ *
+ * Units built with -DENABLE_SYNC follow the beat of a leader: the leader's output
+ * pin is wired to the follower's sync input, and every rising edge on it is
+ * timestamped on the follower's RTC, as a position in the follower's own beat in
+ * progress. An edge within SYNC_WINDOW_MS of the own beat edge is a phase error
+ * (sync_phase_error()): positive when the leader's beat comes after the own one.
+ *
+ * sync_edge() runs a PI loop on that error, in 1/256 ticks:
+ *
+ * - frequency term: the error integrated with gain 1 / 2^SYNC_KI_SHIFT, the ticks
+ *   per beat the leader's crystal runs ahead of or behind the own one
+ * - phase term: the error with gain 1 / 2^SYNC_KP_SHIFT
+ *
+ * Both are added to the beat in progress right away, with the fraction of a tick
+ * carried to the next edge, with nothing timed but the edge: no wake is added
+ * besides the sync edge itself. Both units round their beats to whole ticks of
+ * their own RTC, so the follower's beats stay within a tick or two of the
+ * leader's: below 0.5ms at 4096Hz, mostly within one tick (0.98ms) and at worst
+ * two at 1024Hz. A correction that would end the beat in progress less than guard
+ * ticks after the edge is carried to the next beat (sync_next()).
+ *
+ * Edges outside the window (the leader's sub-steps, or a follower out of phase)
+ * are ignored while locked. After SYNC_LOST_EDGES of them in a row the lock is
+ * dropped; then an edge that comes at the same position in the beat as the last
+ * one outside the window (one beat later) realigns the follower: the beat in
+ * progress is stretched to end one beat after that edge. Lock is gained by the
+ * first edge in the window. Leaders and followers must run the same tempo; the
+ * leader plays the plain beat pattern while followers lock, so they lock onto its
+ * beats instead of its sub-steps.
+ *
+ * SYNC_* (config.h) must be defined before including this header.
+ *
+ * Pure logic, no hardware access: also built by the host simulator (sim/).
+ */
+
+#ifndef BEAT_SYNC_H
+#define BEAT_SYNC_H
+
+#include <stdint.h>
+#include "config.h"
+#include "sequencer.h"
+
+#define SYNC_FRAC_BITS 8   // Corrections are carried in 1/256 ticks
+#define SYNC_KP_SHIFT 3    // Phase gain 1/8
+#define SYNC_KI_SHIFT 6    // Frequency gain 1/64
+#define SYNC_FREQ_MAX (1 << (SYNC_FRAC_BITS - 1))  // Frequency term limit: half a tick per beat
+
+static_assert(SYNC_WINDOW_MS < 60000UL / BPM_MAX / SEQ_MAX_SUBDIV / 2,
+              "Sub-step edges of the leader must fall outside the sync window");
+
+// Sync window in ticks of a clock at TICK_HZ
+template <uint32_t TICK_HZ>
+constexpr uint16_t sync_window_ticks() {
+    return (uint16_t)(SYNC_WINDOW_MS * TICK_HZ / 1000);
+}
+
+struct BeatSync {
+    int16_t freq;        // Frequency term in 1/256 ticks per beat, positive: the leader's beat is longer
+    int16_t frac;        // Fraction of a tick carried to the next correction (0 .. 255)
+    uint16_t candidate;  // Position in the beat of the last edge outside the window
+    int8_t carry;        // Ticks to add to the next beat, the part of a correction that came too late
+    uint8_t misses;      // Edges outside the window since the last one in it
+    bool locked;         // The last edges were in the window
+};
+
+static inline void sync_init(BeatSync* sync) {
+    sync->freq = 0;
+    sync->frac = 0;
+    sync->candidate = 0;
+    sync->carry = 0;
+    sync->misses = SYNC_LOST_EDGES;
+    sync->locked = false;
+}
+
+// Phase error in ticks of an edge pos ticks into a beat of period ticks, positive
+// when the edge comes after the own beat edge, negative when it comes before the next
+static inline int16_t sync_phase_error(uint16_t pos, uint16_t period) {
+    return pos < period / 2 ? (int16_t)pos : (int16_t)pos - (int16_t)period;
+}
+
+// Sync edge pos ticks into the own beat in progress, period ticks long (interrupt
+// context). Returns true with the ticks to add to the beat in progress (negative:
+// shorten it), false to leave it as it is. The firmware needs guard ticks to move
+// the end of the beat in progress.
+static inline bool sync_edge(BeatSync* sync, uint16_t pos, uint16_t period, uint16_t window, uint16_t guard,
+                             int16_t* ticks) {
+    int16_t error = sync_phase_error(pos, period);
+    
+    if (error < -(int16_t)window || error > (int16_t)window) {
+        if (sync->misses < SYNC_LOST_EDGES) {
+            sync->misses++;
+            return false;  // Locked: a sub-step of the leader, or one stray edge
+        }
+        sync->locked = false;
+        
+        // Same position as the last edge outside the window: realign to it
+        uint16_t last = sync->candidate;
+        sync->candidate = pos;
+        uint16_t apart = pos > last ? pos - last : last - pos;
+        if (apart > window && period - apart > window) {
+            return false;
+        }
+        sync->frac = 0;
+        *ticks = (int16_t)pos;  // The beat in progress ends one beat after the edge
+        return true;
+    }
+    sync->misses = 0;
+    sync->locked = true;
+    
+    // The edge lies somewhere in the tick it was counted in: take the middle
+    int32_t phase = ((int32_t)error << SYNC_FRAC_BITS) + (1 << (SYNC_FRAC_BITS - 1));
+    int32_t freq = sync->freq + (phase >> SYNC_KI_SHIFT);
+    if (freq > SYNC_FREQ_MAX) {
+        freq = SYNC_FREQ_MAX;
+    } else if (freq < -SYNC_FREQ_MAX) {
+        freq = -SYNC_FREQ_MAX;
+    }
+    sync->freq = (int16_t)freq;
+    
+    int32_t total = (phase >> SYNC_KP_SHIFT) + freq + sync->frac;
+    int16_t adjust = (int16_t)(total >> SYNC_FRAC_BITS);  // Rounded down, the fraction is carried
+    sync->frac = (int16_t)(total - ((int32_t)adjust << SYNC_FRAC_BITS));
+    
+    // The beat in progress ends guard ticks after the edge or later: a correction
+    // too late for it goes to the next beat
+    int16_t left = (int16_t)period - (int16_t)pos;
+    if (left <= (int16_t)guard) {
+        sync->carry = (int8_t)adjust;
+        return false;
+    }
+    int16_t shortest = (int16_t)guard - left;
+    if (adjust < shortest) {
+        sync->carry = (int8_t)(adjust - shortest);
+        adjust = shortest;
+    }
+    if (!adjust) {
+        return false;
+    }
+    *ticks = adjust;
+    return true;
+}
+
+// Called at a beat boundary: ticks to add to the beat that starts now
+static inline int8_t sync_next(BeatSync* sync) {
+    int8_t carry = sync->carry;
+    sync->carry = 0;
+    return carry;
+}
+
+#endif // BEAT_SYNC_H
@@ -0,0 +1,70 @@
+/**
+ * Compile-time BPM to tick-count tables shared by both firmwares
+ * 
+ * For every BPM setting from BPM_MIN to BPM_MAX in BPM_STEP steps, the beat period
+ * in ticks of a clock running at TICKS_PER_MINUTE / 60 Hz is split into whole ticks
+ * and a fractional remainder:
+ * 
+ *     TICKS_PER_MINUTE / bpm = ticks + rem / bpm
+ * 
+ * The tables are generated by the compiler and stored as constant data in flash,
+ * so tempo changes and interrupt handlers do a single table lookup instead of a
+ * 32-bit division (hundreds of cycles on AVR, no hardware divider on Cortex-M0+).
+ * The remainder lets the caller carry the fractional tick from beat to beat so the
+ * long-run rate is exact.
+ * 
+ * BPM_MIN, BPM_MAX and BPM_STEP must be defined before including this header.
+ */
+
+#ifndef BPM_TABLE_H
+#define BPM_TABLE_H
+
+#include <stdint.h>
+
+#define BPM_TABLE_SIZE ((BPM_MAX - BPM_MIN) / BPM_STEP + 1)
+
+// Tick rates used by the firmwares, expressed as ticks per minute
+#define TICKS_PER_MINUTE_MS      60000UL          // Milliseconds
+#define TICKS_PER_MINUTE_1024HZ  (60UL * 1024)    // ATtiny RTC: 32.768kHz / 32
+#define TICKS_PER_MINUTE_4096HZ  (60UL * 4096)    // STM32 RTC sub-second counter: LSE / 8
+
+static_assert(BPM_MAX <= 255, "BPM is stored as an 8-bit denominator");
+static_assert((BPM_MAX - BPM_MIN) % BPM_STEP == 0, "BPM range must be a whole number of steps");
+
+// Beat period for one BPM setting
+struct BpmPeriod {
+    uint16_t ticks;  // Whole ticks per beat
+    uint8_t rem;     // Fractional ticks per beat (numerator)
+    uint8_t bpm;     // Fractional ticks per beat (denominator)
+};
+
+struct BpmPeriodTable {
+    BpmPeriod entry[BPM_TABLE_SIZE];
+};
+
+// Build a period table at compile time, one entry per BPM step
+template <uint32_t TICKS_PER_MINUTE>
+constexpr BpmPeriodTable make_bpm_period_table() {
+    static_assert(TICKS_PER_MINUTE / BPM_MIN <= 0xFFFF, "Beat period must fit in 16 bits");
+    
+    BpmPeriodTable table{};
+    for (uint8_t i = 0; i < BPM_TABLE_SIZE; i++) {
+        uint16_t bpm = BPM_MIN + i * BPM_STEP;
+        table.entry[i].ticks = (uint16_t)(TICKS_PER_MINUTE / bpm);
+        table.entry[i].rem = (uint8_t)(TICKS_PER_MINUTE % bpm);
+        table.entry[i].bpm = (uint8_t)bpm;
+    }
+    return table;
+}
+
+// Table index of a BPM setting (division by a constant, no runtime divide)
+static inline uint8_t bpm_index(uint16_t bpm) {
+    return (uint8_t)((bpm - BPM_MIN) / BPM_STEP);
+}
+
+// Tables for each clock configuration; only the ones a firmware uses are emitted
+static constexpr BpmPeriodTable bpm_table_ms = make_bpm_period_table<TICKS_PER_MINUTE_MS>();
+static constexpr BpmPeriodTable bpm_table_1024hz = make_bpm_period_table<TICKS_PER_MINUTE_1024HZ>();
+static constexpr BpmPeriodTable bpm_table_4096hz = make_bpm_period_table<TICKS_PER_MINUTE_4096HZ>();
+
+#endif // BPM_TABLE_H
@@ -0,0 +1,48 @@
+/**
+ * Application configuration shared by both firmwares and the host simulator
+ */
+
+#ifndef CONFIG_H
+#define CONFIG_H
+
+// BPM configuration
+#define BPM_MIN 40
+#define BPM_MAX 155
+#define BPM_DEFAULT 100
+#define BPM_STEP 5
+
+// Output pulse and button timing
+#define ACTIVATION_DURATION_MS 50  // Active for 50ms
+#define DEBOUNCE_DELAY_MS 50       // 50ms debounce for snappy response
+
+// Beat pattern sequencer (common/sequencer.h), ACTIVATION_DURATION_MS is the beat width
+#define SEQ_ACCENT_MS 80       // Accented beat pulse width
+#define SEQ_SUB_MS 20          // Sub-step click pulse width
+#define SEQ_DEFAULT_PATTERN 0  // Pattern at power-up (0: plain beat)
+
+// Auto-repeat of a held button (common/debounce.h)
+#define REPEAT_DELAY_MS 350   // Hold time after the press is confirmed before the first repeat
+#define REPEAT_START_MS 250   // First repeat interval
+#define REPEAT_ACCEL_PCT 75   // Each interval is this percentage of the previous one
+#define REPEAT_MIN_MS 60      // Fastest repeat interval
+
+// Tempo persistence
+#define TEMPO_SAVE_BEATS 8  // Beats without a tempo change before the tempo is saved
+
+// Supply monitor (common/battery.h)
+#define BATTERY_SAMPLE_BEATS 64   // Beats between two supply samples
+#define BATTERY_LOW_MV 2500       // Below: pulse widths halved
+#define BATTERY_CRITICAL_MV 2200  // Below: pulse widths quartered
+#define BATTERY_HYST_MV 100       // A level is left once the supply is this far above its threshold
+
+// Crystal temperature compensation (common/xtal_comp.h)
+#define XTAL_TEMP_SAMPLES 4     // Supply samples per temperature sample (every 256 beats)
+#define XTAL_TURNOVER_C 25      // Turnover temperature of the 32.768kHz crystal
+#define XTAL_PARABOLIC_PPB 34   // ppb slow per °C squared away from the turnover
+#define XTAL_OFFSET_PPB 0       // Measured offset of the unit at the turnover in ppb, positive: fast
+
+// Leader / follower beat synchronization (common/beat_sync.h, -DENABLE_SYNC)
+#define SYNC_WINDOW_MS 20   // Sync edges this close to the own beat edge are phase errors
+#define SYNC_LOST_EDGES 8   // Edges outside the window in a row that drop the lock
+
+#endif // CONFIG_H
@@ -0,0 +1,118 @@
+/**
+ * Event-driven button debounce state machine shared by both firmwares
+ * 
+ * Each button has one state. A pin edge (either direction) moves it to a pending
+ * state and the caller (re)arms its debounce timer; the pin is only sampled when
+ * the timer expires, i.e. once contacts have been quiet for the debounce delay.
+ * The state machine functions run in interrupt context.
+ * 
+ * Auto-repeat: a button held past REPEAT_DELAY_MS repeats its action, with the
+ * interval shrinking from REPEAT_START_MS by REPEAT_ACCEL_PCT per step down to
+ * REPEAT_MIN_MS. The firmwares time all buttons with one debounce timer, so the
+ * repeat steps run on the same timer: once no debounce window is open and a
+ * repeating button is held, the caller re-arms it with the next interval of the
+ * schedule (repeat_on_settle()). The CPU sleeps between repeat steps.
+ * 
+ * Pure logic, no hardware access: also built by the host simulator (sim/).
+ */
+
+#ifndef DEBOUNCE_H
+#define DEBOUNCE_H
+
+#include <stdint.h>
+#include "config.h"
+
+#define REPEAT_STAGES 8    // Entries in the repeat schedule, the last one repeats until release
+#define REPEAT_STOP   0xFF // repeat_on_settle(): no button repeating, leave the timer off
+
+enum ButtonState : uint8_t {
+    BUTTON_IDLE,            // Released, waiting for a press edge
+    BUTTON_PRESS_PENDING,   // Press edge seen, waiting for contacts to settle
+    BUTTON_HELD,            // Press confirmed, waiting for a release edge
+    BUTTON_RELEASE_PENDING  // Release edge seen, waiting for contacts to settle
+};
+
+// Result of a settled debounce timer for one button
+enum DebounceEvent : uint8_t {
+    DEBOUNCE_NONE,
+    DEBOUNCE_PRESS,   // Press confirmed
+    DEBOUNCE_REPEAT   // Auto-repeat step of a held button
+};
+
+// Auto-repeat progress, shared by all buttons (one timer)
+struct RepeatState {
+    bool armed;     // The debounce timer times a repeat step, not a debounce window
+    uint8_t stage;  // Schedule entry of the running step
+};
+
+// Debounce timer ticks of each repeat step: the hold time before the first step,
+// then the accelerating intervals
+struct RepeatTable {
+    uint16_t ticks[REPEAT_STAGES];
+};
+
+// Build the repeat schedule at compile time for a timer running at TICK_HZ
+template <uint32_t TICK_HZ>
+constexpr RepeatTable make_repeat_table() {
+    RepeatTable table{};
+    uint32_t ms = REPEAT_START_MS;
+    table.ticks[0] = (uint16_t)((REPEAT_DELAY_MS * TICK_HZ + 999) / 1000);
+    for (uint8_t i = 1; i < REPEAT_STAGES; i++) {
+        table.ticks[i] = (uint16_t)((ms * TICK_HZ + 999) / 1000);
+        ms = ms * REPEAT_ACCEL_PCT / 100;
+        if (ms < REPEAT_MIN_MS) {
+            ms = REPEAT_MIN_MS;
+        }
+    }
+    return table;
+}
+
+// Pin edge seen, the caller restarts the debounce timer afterwards
+static inline void debounce_on_edge(volatile ButtonState* state) {
+    if (*state == BUTTON_IDLE) {
+        *state = BUTTON_PRESS_PENDING;
+    } else if (*state == BUTTON_HELD) {
+        *state = BUTTON_RELEASE_PENDING;
+    }
+}
+
+// Debounce timer expired with the sampled pin level; repeat_tick is set when the
+// timer timed a repeat step (RepeatState::armed)
+static inline DebounceEvent debounce_on_settle(volatile ButtonState* state, bool down, bool repeat_tick) {
+    if (*state == BUTTON_PRESS_PENDING) {
+        *state = down ? BUTTON_HELD : BUTTON_IDLE;  // Not down: glitch
+        return down ? DEBOUNCE_PRESS : DEBOUNCE_NONE;
+    }
+    if (*state == BUTTON_RELEASE_PENDING) {
+        *state = down ? BUTTON_HELD : BUTTON_IDLE;
+        return DEBOUNCE_NONE;  // Down: bounce, the repeat goes on at the next step
+    }
+    if (*state == BUTTON_HELD && repeat_tick) {
+        return DEBOUNCE_REPEAT;
+    }
+    return DEBOUNCE_NONE;
+}
+
+// A pin edge restarts the timer as a debounce window
+static inline void repeat_on_edge(volatile RepeatState* repeat) {
+    repeat->armed = false;
+}
+
+// Called after all buttons have settled, with whether a repeating button is held;
+// returns the schedule entry to re-arm the timer with, or REPEAT_STOP. A step that
+// just ran moves the schedule on, a debounce window (press or another button's
+// edge) keeps the current entry.
+static inline uint8_t repeat_on_settle(volatile RepeatState* repeat, bool held) {
+    if (!held) {
+        repeat->armed = false;
+        repeat->stage = 0;
+        return REPEAT_STOP;
+    }
+    if (repeat->armed && repeat->stage < REPEAT_STAGES - 1) {
+        repeat->stage++;
+    }
+    repeat->armed = true;
+    return repeat->stage;
+}
+
+#endif // DEBOUNCE_H
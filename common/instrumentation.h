@@ -0,0 +1,124 @@
+/**
+ * On-target wake instrumentation shared by both firmwares
+ *
+ * Only compiled in with -DENABLE_INSTRUMENTATION. Every wake from sleep is logged
+ * into a small RAM ring buffer:
+ *
+ * - cause:        bit mask of the interrupts that were serviced during the wake
+ * - awake_cycles: time from the first interrupt of the wake until going back to
+ *                 sleep, in cycles of the firmware's cycle timer
+ * - beat_error:   for beat wakes, how late the beat interrupt ran after the
+ *                 scheduled beat edge, in RTC ticks
+ *
+ * Each firmware provides the cycle timer and the "awake" debug GPIO marker around
+ * wake_state_begin() (called from its interrupt handlers) and wake_state_end()
+ * (called right before entering sleep). The log is read with the debugger
+ * (`wake_log`), wakes / beats gives the average number of wakes per beat.
+ *
+ * Stack high-water: each firmware paints the free RAM between its static data and
+ * the stack with STACK_PAINT at boot, and every STACK_CHECK_BEATS beats the main
+ * loop counts the painted bytes the stack never reached (stack_unused()) into
+ * wake_log.stack_free, before its sleep entry. It is the margin left for the size
+ * budget's stack reserve (tools/size_budget.py).
+ *
+ * The types are always available so that the instrumentation hooks compile to
+ * nothing when the layer is disabled.
+ */
+
+#ifndef INSTRUMENTATION_H
+#define INSTRUMENTATION_H
+
+#include <stdint.h>
+
+#define WAKE_LOG_SIZE 32     // Records in the ring buffer, must be a power of 2
+#define STACK_PAINT 0xC5     // Fill of the stack area not used yet
+#define STACK_CHECK_BEATS 64 // Beat wakes between two stack high-water scans, must be a power of 2
+
+static_assert((WAKE_LOG_SIZE & (WAKE_LOG_SIZE - 1)) == 0, "WAKE_LOG_SIZE must be a power of 2");
+static_assert((STACK_CHECK_BEATS & (STACK_CHECK_BEATS - 1)) == 0, "STACK_CHECK_BEATS must be a power of 2");
+
+// Wake causes, combined when several interrupts are serviced in one wake
+enum WakeCause : uint8_t {
+    WAKE_BEAT      = 1 << 0,  // RTC beat interrupt
+    WAKE_BUTTON    = 1 << 1,  // Button pin edge
+    WAKE_DEBOUNCE  = 1 << 2,  // Debounce timer expired
+    WAKE_PULSE     = 1 << 3,  // End of output pulse (hardware timed pulse)
+    WAKE_STEP      = 1 << 4,  // Sub-step of the beat pattern (common/sequencer.h)
+    WAKE_SERIAL    = 1 << 5,  // Serial link byte received or sent (common/serial_link.h)
+    WAKE_SYNC      = 1 << 6,  // Sync input edge from the leader (common/beat_sync.h)
+    WAKE_WDT_RESET = 1 << 7   // Boot after a watchdog reset (logged once at startup)
+};
+
+struct WakeRecord {
+    uint32_t awake_cycles;
+    int16_t beat_error;
+    uint8_t cause;
+};
+
+struct WakeLog {
+    WakeRecord entry[WAKE_LOG_SIZE];
+    uint8_t head;        // Next record to write
+    uint32_t wakes;      // Total wakes logged
+    uint32_t beats;      // Total beat wakes logged
+    uint16_t stack_free; // Painted stack bytes never used since boot, at the last scan
+};
+
+// Wake currently being measured, filled in from interrupt context
+struct WakeState {
+    bool awake;
+    uint8_t cause;
+    int16_t beat_error;
+};
+
+// Append a finished wake to the ring buffer (oldest record is overwritten)
+static inline void wake_log_push(WakeLog* log, uint8_t cause, uint32_t awake_cycles, int16_t beat_error) {
+    WakeRecord* rec = &log->entry[log->head];
+    rec->awake_cycles = awake_cycles;
+    rec->beat_error = beat_error;
+    rec->cause = cause;
+    log->head = (log->head + 1) & (WAKE_LOG_SIZE - 1);
+    log->wakes++;
+    if (cause & WAKE_BEAT) {
+        log->beats++;
+    }
+}
+
+// Record a wake cause; returns true for the first interrupt of a wake, when the
+// caller has to start its cycle timer and raise the awake marker
+static inline bool wake_state_begin(volatile WakeState* state, uint8_t cause) {
+    state->cause |= cause;
+    if (state->awake) {
+        return false;
+    }
+    state->awake = true;
+    return true;
+}
+
+// Finish the current wake (interrupts must be disabled by the caller)
+static inline void wake_state_end(volatile WakeState* state, WakeLog* log, uint32_t awake_cycles) {
+    if (!state->awake) {
+        return;
+    }
+    wake_log_push(log, state->cause, awake_cycles, state->beat_error);
+    state->awake = false;
+    state->cause = 0;
+    state->beat_error = 0;
+}
+
+// Painted bytes from the bottom of the stack area (its far end, the stack grows
+// down towards it) up to the first one the stack has overwritten, at most size
+static inline uint16_t stack_unused(const volatile uint8_t* bottom, uint16_t size) {
+    uint16_t unused = 0;
+    while (unused < size && bottom[unused] == STACK_PAINT) {
+        unused++;
+    }
+    return unused;
+}
+
+// A stack scan is due once every STACK_CHECK_BEATS logged beats (checked:
+// log->beats at the last scan)
+static inline bool stack_check_due(const WakeLog* log, uint32_t checked) {
+    return (log->beats ^ checked) & ~(uint32_t)(STACK_CHECK_BEATS - 1);
+}
+
+#endif // INSTRUMENTATION_H
@@ -0,0 +1,360 @@
+/**
+ * Portable metronome core shared by both firmwares
+ * 
+ * Owns the tempo, the button actions and the main loop. Everything that touches
+ * hardware goes through a HAL policy class, resolved at compile time: all calls
+ * are static, so with -flto they inline to the same code as hand-written
+ * firmware (no virtual calls, no function pointers, no extra RAM).
+ * 
+ * HAL policy (static member functions, and two constants for the features of the
+ * board: a false one drops the core's code for it at compile time):
+ * 
+ *     struct Hal {
+ *         static constexpr bool persistent = true; // save_tempo() stores the tempo, else it is kept in RAM only
+ *         static constexpr bool patterns = true;   // Sequencer patterns built in, else the plain beat only
+ *         static void set_tempo(uint16_t bpm);  // Latch a new beat period, applied at the next beat
+ *         static void pulse(uint8_t kind);      // Output pulse for the step that just started (StepKind, not a rest)
+ *         static void sleep();                  // Sleep until the next interrupt, unless events_pending()
+ *         static void watchdog_kick();          // Reload the watchdog, once per beat
+ *         static void save_tempo(uint16_t bpm); // Store the tempo in non-volatile memory
+ *         static void align_beat(uint16_t bpm); // End the beat in progress one beat at bpm after the last tap
+ *         static void set_pattern(uint8_t pattern); // Latch a new sequencer pattern, started at the next beat
+ *         static uint16_t measure_supply();     // One ADC conversion of the supply (common/battery.h reading)
+ *         static void set_power_level(uint8_t level); // Apply a BatteryLevel: pulse width shift
+ *         static int16_t measure_temperature(); // Die temperature in °C, right after measure_supply()
+ *         static void set_xtal_trim(int32_t ppb); // Correct the RTC rate, positive: the crystal is slow
+ *         static uint8_t irq_save();            // Mask interrupts, returns the previous mask state
+ *         static void irq_restore(uint8_t state); // Restore the mask state of irq_save()
+ *     };
+ * 
+ * The firmware's interrupt handlers report events with on_beat(), on_button()
+ * and, for a held button, on_repeat() / on_repeat_end(). The firmware runs the
+ * beat pattern sequencer (common/sequencer.h) on its beat timer and reports the
+ * kind of every beat with on_beat() and of every sub-step with on_step(); only
+ * beats reload the watchdog and count towards a save. Pressing both tempo buttons
+ * together selects the next pattern instead of changing the tempo. A tap tempo
+ * estimate is reported with on_tap(), and the core hands it to the HAL like a
+ * button step, then lets the HAL move the beat phase onto the last tap. A tempo
+ * received over the serial link (common/serial_link.h) is reported with
+ * on_remote_tempo() and applied like a button step. main() passes the stored
+ * tempo to restore(), then calls run() after initializing the hardware. A tempo
+ * change is saved TEMPO_SAVE_BEATS beats after the last one, so a run of button
+ * steps costs a single write. Auto-repeat steps only move the tempo setting: the
+ * HAL gets the new tempo once, when the repeat ends. The supply is sampled every
+ * BATTERY_SAMPLE_BEATS beats in the beat wake (main() passes the reading scale of
+ * its ADC to supply_init() at boot), and the HAL is told of every change of the
+ * battery level. A firmware whose beats can pass without a wake reports how many
+ * did with the next on_beat(), so they still count towards the sample
+ * (supply_quiet_beats() tells how many may pass). Every XTAL_TEMP_SAMPLES supply
+ * samples the die temperature is taken as well, and the HAL gets the crystal
+ * correction for it (common/xtal_comp.h) when it changes. A firmware that runs
+ * all of its work in interrupt handlers calls service() from its lowest priority
+ * handler after every wake instead of run().
+ * 
+ * Every interrupt handler event sets its bit in a single event word (EVENT_*),
+ * with interrupts masked for the read-modify-write, and each poll() takes the
+ * whole word at once with one masked fetch-and-clear. Hal::sleep() must check
+ * events_pending() with interrupts masked and only sleep if it is false, in a
+ * form where an interrupt that became pending after the check still ends the
+ * sleep (AVR: cli, check, sei; sleep - SEI delays interrupts by one instruction;
+ * Cortex-M: check and WFI with PRIMASK set). An event raised after the last poll()
+ * is then handled before the next sleep instead of a wake later.
+ */
+
+#ifndef METRONOME_H
+#define METRONOME_H
+
+#include <stdint.h>
+#include "config.h"
+#include "tempo.h"
+#include "sequencer.h"
+#include "battery.h"
+#include "xtal_comp.h"
+
+enum ButtonId : uint8_t {
+    BUTTON_INC,   // Increase BPM
+    BUTTON_DEC,   // Decrease BPM
+    BUTTON_TAP,   // Tap tempo (the firmware times the taps, see on_tap())
+    BUTTON_COUNT
+};
+
+#define BUTTON_REPEAT_MASK ((1 << BUTTON_INC) | (1 << BUTTON_DEC))  // Buttons that auto-repeat while held
+
+// Event word bits, set by the interrupt handlers and taken by poll()
+#define EVENT_BUTTON(button) (1 << (button))      // Debounced press or repeat step of a button
+#define EVENT_BEAT (1 << BUTTON_COUNT)            // Beat boundary
+#define EVENT_STEP (1 << (BUTTON_COUNT + 1))      // Sub-step of the pattern
+#define EVENT_TAP (1 << (BUTTON_COUNT + 2))       // Tap tempo estimate in tap_bpm
+#define EVENT_REPEAT_END (1 << (BUTTON_COUNT + 3)) // A held back tempo change may be applied
+#define EVENT_REMOTE (1 << (BUTTON_COUNT + 4))    // Tempo set over the serial link in remote_bpm
+
+static_assert(BUTTON_COUNT + 5 <= 8, "The events must fit in the 8-bit event word");
+
+template <class Hal>
+class Metronome {
+public:
+    // Beat boundary reached, kind of its step (interrupt context). skipped: beats
+    // since the last on_beat() that did not wake the CPU, they count towards the
+    // next supply sample. The count adds up until poll() takes the beat, so beats
+    // that coalesce into one event are not lost.
+    static void on_beat(uint8_t kind, uint8_t skipped = 0) {
+        uint8_t state = Hal::irq_save();
+        beat_kind = kind;
+        skipped_beats += skipped;
+        events |= EVENT_BEAT;
+        Hal::irq_restore(state);
+    }
+    
+    // Sub-step of the pattern between two beats (interrupt context)
+    static void on_step(uint8_t kind) {
+        step_kind = kind;
+        raise(EVENT_STEP);
+    }
+    
+    // Debounced button press confirmed (interrupt context)
+    static void on_button(uint8_t button) {
+        raise(EVENT_BUTTON(button));
+    }
+    
+    // Auto-repeat step of a held button (interrupt context)
+    static void on_repeat(uint8_t button) {
+        repeat_hold = true;
+        raise(EVENT_BUTTON(button));
+    }
+    
+    // No button is repeating any more (interrupt context)
+    static void on_repeat_end() {
+        repeat_hold = false;
+        raise(EVENT_REPEAT_END);
+    }
+    
+    // Tempo of a run of taps, a BPM step (interrupt context)
+    static void on_tap(uint16_t bpm) {
+        tap_bpm = (uint8_t)bpm;
+        raise(EVENT_TAP);
+    }
+    
+    // Tempo set over the serial link, a BPM step (interrupt context)
+    static void on_remote_tempo(uint8_t bpm) {
+        remote_bpm = bpm;
+        raise(EVENT_REMOTE);
+    }
+    
+    // An event is waiting for poll(): Hal::sleep() must not sleep (read with
+    // interrupts masked)
+    static bool events_pending() {
+        return events != 0;
+    }
+    
+    static uint16_t bpm() {
+        return current_bpm;
+    }
+    
+    // Index of the selected pattern in seq_patterns
+    static uint8_t pattern() {
+        return current_pattern;
+    }
+    
+    // Tempo loaded from non-volatile memory at boot, before the hardware is set up
+    static void restore(uint16_t bpm) {
+        current_bpm = bpm;
+    }
+    
+    // A tempo change is waiting to be saved (may be read from interrupt context)
+    static bool save_pending() {
+        return save_beats != 0;
+    }
+    
+    // Reading scale of the firmware's supply conversion (common/battery.h), at boot
+    static void supply_init(uint32_t scale) {
+        battery_init(&battery, scale);
+    }
+    
+    // The next beat wake samples the supply (may be read from interrupt context)
+    static bool supply_due() {
+        return battery_sample_next(&battery);
+    }
+    
+    // Beats that may skip the CPU before the supply sample, when the beat being
+    // reported needs no wake otherwise (may be read from interrupt context)
+    static uint8_t supply_quiet_beats() {
+        return battery_quiet_beats(&battery);
+    }
+    
+    // Battery level of the last supply sample
+    static uint8_t power_level() {
+        return battery.level;
+    }
+    
+    // Last supply sample (common/battery.h reading), 0 before the first one
+    static uint16_t supply_reading() {
+        return battery.reading;
+    }
+    
+    // Crystal correction in use in ppb, from the last temperature sample
+    static int32_t xtal_trim() {
+        return xtal.ppb;
+    }
+    
+    // One main loop iteration: button actions, tempo change, watchdog reload and output pulses
+    static void poll() {
+        uint8_t skipped;
+        uint8_t taken = take_events(&skipped);
+        process_button_presses(taken);
+        
+        // Serial tempo command: applied like a button step
+        if (taken & EVENT_REMOTE) {
+            set_bpm(remote_bpm);
+        }
+        
+        // Tap tempo: the tempo of the taps, on the phase of the last one
+        uint8_t tap = 0;
+        if (taken & EVENT_TAP) {
+            tap = tap_bpm;
+            set_bpm(tap);
+        }
+        
+        // Select the new beat period, the HAL applies it at the next beat boundary;
+        // while a button repeats, only once the repeat ends
+        if (reconfigure && !repeat_hold) {
+            reconfigure = false;
+            Hal::set_tempo(current_bpm);
+            if (Hal::persistent) {
+                save_beats = TEMPO_SAVE_BEATS;
+            }
+        }
+        
+        // After set_tempo(): the realigned beat edge is the one that applies the tempo
+        if (tap) {
+            Hal::align_beat(tap);
+        }
+        
+        // The watchdog is only reloaded at beats: the firmwares run it in window
+        // mode with the window sized to the beat, so other wakes must not touch it
+        if (taken & EVENT_BEAT) {
+            Hal::watchdog_kick();
+            if (beat_kind != STEP_REST) {
+                Hal::pulse(beat_kind);
+            }
+            
+            // Deferred save, right after the beat: the write is as far as it can be
+            // from the next beat edge. Held back while a repeat holds back a tempo
+            // change, the countdown restarts when the change is applied.
+            if (Hal::persistent && save_beats && !reconfigure && --save_beats == 0) {
+                Hal::save_tempo(current_bpm);
+            }
+            
+            // Supply sample in the same wake, while the pulse loads the supply, and
+            // now and then the temperature for the crystal correction
+            battery_skip(&battery, skipped);
+            if (battery_due(&battery)) {
+                if (battery_update(&battery, Hal::measure_supply())) {
+                    Hal::set_power_level(battery.level);
+                }
+                if (xtal_due(&xtal) && xtal_update(&xtal, Hal::measure_temperature())) {
+                    Hal::set_xtal_trim(xtal.ppb);
+                }
+            }
+        }
+        
+        if (taken & EVENT_STEP) {
+            if (step_kind != STEP_REST) {
+                Hal::pulse(step_kind);
+            }
+        }
+    }
+    
+    // The work of one wake: one poll() iteration
+    static void service() {
+        poll();
+    }
+    
+    // Main loop, never returns
+    static void run() {
+        while (1) {
+            service();
+            Hal::sleep();
+        }
+    }
+    
+private:
+    // Set event bits (interrupt context, the handlers may preempt each other)
+    static void raise(uint8_t bits) {
+        uint8_t state = Hal::irq_save();
+        events |= bits;
+        Hal::irq_restore(state);
+    }
+    
+    // Fetch and clear the event word, and with it the skipped beats of the beat event
+    static uint8_t take_events(uint8_t *skipped) {
+        uint8_t state = Hal::irq_save();
+        uint8_t taken = events;
+        events = 0;
+        *skipped = skipped_beats;
+        skipped_beats = 0;
+        Hal::irq_restore(state);
+        return taken;
+    }
+    
+    static void set_bpm(uint16_t bpm) {
+        if (bpm != current_bpm) {
+            current_bpm = bpm;
+            reconfigure = true;
+        }
+    }
+    
+    // Process the debounced button presses among the taken events
+    // Never blocks - debouncing is done by the firmware in interrupt context
+    // Tap presses are timed by the firmware and reported with on_tap()
+    static void process_button_presses(uint8_t taken) {
+        // Both tempo buttons confirmed by the same debounce window: next pattern.
+        // Held together, their repeat steps do nothing, and so does the press on a
+        // board without the patterns.
+        const uint8_t both = EVENT_BUTTON(BUTTON_INC) | EVENT_BUTTON(BUTTON_DEC);
+        if ((taken & both) == both) {
+            if (Hal::patterns && !repeat_hold) {
+                current_pattern = current_pattern + 1 < SEQ_PATTERN_COUNT ? current_pattern + 1 : 0;
+                Hal::set_pattern(current_pattern);
+            }
+            return;
+        }
+        
+        if (taken & EVENT_BUTTON(BUTTON_INC)) {
+            set_bpm(tempo_step_up(current_bpm));
+        }
+        
+        if (taken & EVENT_BUTTON(BUTTON_DEC)) {
+            set_bpm(tempo_step_down(current_bpm));
+        }
+    }
+    
+    static uint16_t current_bpm;                        // Main loop only
+    static bool reconfigure;                            // Main loop only
+    static uint8_t current_pattern;                     // Main loop only
+    static volatile uint8_t save_beats;                 // Beats until the save, written by the main loop
+    static volatile uint8_t events;                     // EVENT_* bits, set by the ISRs, taken by poll()
+    static volatile uint8_t beat_kind;                  // Set by the beat ISR, StepKind of the beat
+    static volatile uint8_t skipped_beats;              // Added up by the beat ISR, taken with EVENT_BEAT
+    static volatile uint8_t step_kind;                  // StepKind of the sub-step
+    static volatile bool repeat_hold;                   // Set by the debounce ISR while a button repeats
+    static volatile uint8_t tap_bpm;                    // Set by the debounce ISR with EVENT_TAP
+    static volatile uint8_t remote_bpm;                 // Set by the serial ISR with EVENT_REMOTE
+    static BatteryMonitor battery;                      // Main loop only (beats read by supply_due())
+    static XtalComp xtal;                               // Main loop only
+};
+
+template <class Hal> uint16_t Metronome<Hal>::current_bpm = BPM_DEFAULT;
+template <class Hal> bool Metronome<Hal>::reconfigure = false;
+template <class Hal> uint8_t Metronome<Hal>::current_pattern = SEQ_DEFAULT_PATTERN;
+template <class Hal> volatile uint8_t Metronome<Hal>::save_beats = 0;
+template <class Hal> volatile uint8_t Metronome<Hal>::events = 0;
+template <class Hal> volatile uint8_t Metronome<Hal>::beat_kind = STEP_BEAT;
+template <class Hal> volatile uint8_t Metronome<Hal>::skipped_beats = 0;
+template <class Hal> volatile uint8_t Metronome<Hal>::step_kind = STEP_REST;
+template <class Hal> volatile bool Metronome<Hal>::repeat_hold = false;
+template <class Hal> volatile uint8_t Metronome<Hal>::tap_bpm = 0;
+template <class Hal> volatile uint8_t Metronome<Hal>::remote_bpm = BPM_DEFAULT;
+template <class Hal> BatteryMonitor Metronome<Hal>::battery = {};
+template <class Hal> XtalComp Metronome<Hal>::xtal = {};
+
+#endif // METRONOME_H
@@ -0,0 +1,202 @@
+/**
+ * Beat pattern sequencer shared by both firmwares
+ *
+ * A pattern is a bar of steps in flash: every beat is split into subdiv steps
+ * (1 to SEQ_MAX_SUBDIV), and each step is a rest, a sub-step click, a beat or an
+ * accented beat, each with its own pulse width. The firmware calls seq_beat() at
+ * every beat edge and seq_step() at each of the subdiv - 1 sub-step edges it
+ * schedules in between on the same RTC / LPTIM timer as the beat, so every step
+ * costs one wake. Both return the kind of the step that starts now: one table
+ * read and an index increment, the same cost at any subdivision or tempo.
+ *
+ * Sub-step edges come from make_substep_table(), the beat period split evenly
+ * (rounded down, the beat edge itself stays exact). A sub-step that did not fire
+ * before the beat (e.g. the beat was realigned to a tap) is skipped, so the
+ * beats stay on their steps of the bar.
+ *
+ * A pattern change is latched with seq_request() and applied by seq_beat() at
+ * the next beat, which starts the new pattern from its first step.
+ *
+ * BPM_MIN, BPM_MAX, BPM_STEP and the pulse widths (config.h) must be defined
+ * before including this header.
+ *
+ * Pure logic, no hardware access: also built by the host simulator (sim/).
+ */
+
+#ifndef SEQUENCER_H
+#define SEQUENCER_H
+
+#include <stdint.h>
+#include "config.h"
+#include "bpm_table.h"
+
+#define SEQ_MAX_SUBDIV 4   // Most steps per beat
+#define SEQ_MAX_STEPS 16   // Most steps per bar
+
+enum StepKind : uint8_t {
+    STEP_REST,    // No pulse
+    STEP_SUB,     // Sub-step click
+    STEP_BEAT,    // Beat
+    STEP_ACCENT,  // Accented beat
+    STEP_KIND_COUNT
+};
+
+// Every pulse must end before the next step starts, at the fastest step rate
+static_assert(SEQ_ACCENT_MS < 60000UL / BPM_MAX / SEQ_MAX_SUBDIV &&
+              ACTIVATION_DURATION_MS < 60000UL / BPM_MAX / SEQ_MAX_SUBDIV &&
+              SEQ_SUB_MS < 60000UL / BPM_MAX / SEQ_MAX_SUBDIV,
+              "Pulse widths must be shorter than a sub-step at BPM_MAX");
+
+struct SeqPattern {
+    uint8_t subdiv;               // Steps per beat
+    uint8_t length;               // Steps per bar, a multiple of subdiv
+    uint8_t step[SEQ_MAX_STEPS];  // StepKind of each step
+};
+
+// Pattern table, selected with the tempo buttons pressed together (entry 0 is
+// the plain beat every firmware starts with by default)
+static constexpr SeqPattern seq_patterns[] = {
+    { 1, 1, { STEP_BEAT } },                                            // Plain beat
+    { 1, 4, { STEP_ACCENT, STEP_BEAT, STEP_BEAT, STEP_BEAT } },         // 4/4, accent on 1
+    { 1, 3, { STEP_ACCENT, STEP_BEAT, STEP_BEAT } },                    // 3/4, accent on 1
+    { 2, 8, { STEP_ACCENT, STEP_SUB, STEP_BEAT, STEP_SUB,
+              STEP_BEAT, STEP_SUB, STEP_BEAT, STEP_SUB } },             // 4/4 eighths
+    { 3, 3, { STEP_BEAT, STEP_SUB, STEP_SUB } },                        // Triplets
+    { 3, 3, { STEP_BEAT, STEP_REST, STEP_SUB } },                       // Shuffle
+    { 4, 4, { STEP_BEAT, STEP_SUB, STEP_SUB, STEP_SUB } },              // Sixteenths
+};
+
+#define SEQ_PATTERN_COUNT ((uint8_t)(sizeof(seq_patterns) / sizeof(seq_patterns[0])))
+
+constexpr bool seq_patterns_valid() {
+    for (uint8_t i = 0; i < SEQ_PATTERN_COUNT; i++) {
+        const SeqPattern& p = seq_patterns[i];
+        if (p.subdiv < 1 || p.subdiv > SEQ_MAX_SUBDIV || p.length == 0 || p.length > SEQ_MAX_STEPS ||
+            p.length % p.subdiv != 0) {
+            return false;
+        }
+    }
+    return true;
+}
+
+static_assert(seq_patterns_valid(), "Every pattern must be whole beats of 1 to SEQ_MAX_SUBDIV steps");
+static_assert(SEQ_DEFAULT_PATTERN < SEQ_PATTERN_COUNT, "SEQ_DEFAULT_PATTERN must be in the pattern table");
+
+// Pulse width of each step kind in ticks of a timer running at TICK_HZ (rounded)
+struct PulseWidthTable {
+    uint16_t ticks[STEP_KIND_COUNT];
+};
+
+template <uint32_t TICK_HZ>
+constexpr PulseWidthTable make_pulse_width_table() {
+    static_assert(SEQ_ACCENT_MS * TICK_HZ / 1000 <= 0xFFFF, "Pulse widths must fit in 16 bits");
+    
+    PulseWidthTable table{};
+    table.ticks[STEP_REST] = 0;
+    table.ticks[STEP_SUB] = (uint16_t)((SEQ_SUB_MS * TICK_HZ + 500) / 1000);
+    table.ticks[STEP_BEAT] = (uint16_t)((ACTIVATION_DURATION_MS * TICK_HZ + 500) / 1000);
+    table.ticks[STEP_ACCENT] = (uint16_t)((SEQ_ACCENT_MS * TICK_HZ + 500) / 1000);
+    return table;
+}
+
+// Sub-step length in ticks for every subdivision (2 to SEQ_MAX_SUBDIV, index
+// subdiv - 2) and BPM step, the whole-tick beat period split evenly (rounded down)
+struct SubStepTable {
+    uint16_t ticks[SEQ_MAX_SUBDIV - 1][BPM_TABLE_SIZE];
+};
+
+template <uint32_t TICKS_PER_MINUTE>
+constexpr SubStepTable make_substep_table() {
+    SubStepTable table{};
+    for (uint8_t s = 2; s <= SEQ_MAX_SUBDIV; s++) {
+        for (uint8_t i = 0; i < BPM_TABLE_SIZE; i++) {
+            uint16_t bpm = BPM_MIN + i * BPM_STEP;
+            table.ticks[s - 2][i] = (uint16_t)(TICKS_PER_MINUTE / bpm / s);
+        }
+    }
+    return table;
+}
+
+struct Sequencer {
+    const SeqPattern* pattern;            // Pattern playing, owned by the beat ISR
+    const SeqPattern* volatile pending;   // Latched at the next beat
+    uint8_t step;                         // Index of the next step in the bar
+    uint8_t sub_left;                     // Sub-steps left in the beat in progress
+};
+
+static inline void seq_init(Sequencer* seq, const SeqPattern* pattern) {
+    seq->pattern = pattern;
+    seq->pending = nullptr;
+    seq->step = 0;
+    seq->sub_left = 0;
+}
+
+// Select a new pattern, started from its first step at the next beat
+// On 8-bit targets the caller must make the pointer write atomic
+static inline void seq_request(Sequencer* seq, const SeqPattern* pattern) {
+    seq->pending = pattern;
+}
+
+// Drop the sub-steps left in the beat in progress (the next edge is the beat)
+static inline void seq_skip(Sequencer* seq) {
+    uint8_t step = seq->step + seq->sub_left;
+    if (step >= seq->pattern->length) {
+        step -= seq->pattern->length;
+    }
+    seq->step = step;
+    seq->sub_left = 0;
+}
+
+// Kind of the next step of the bar
+static inline uint8_t seq_advance(Sequencer* seq) {
+    const SeqPattern* pattern = seq->pattern;
+    uint8_t kind = pattern->step[seq->step];
+    if (++seq->step == pattern->length) {
+        seq->step = 0;
+    }
+    return kind;
+}
+
+// Called at a beat edge: kind of the step that starts now
+static inline uint8_t seq_beat(Sequencer* seq) {
+    seq_skip(seq);
+    
+    const SeqPattern* pending = seq->pending;
+    if (pending) {
+        seq->pattern = pending;
+        seq->pending = nullptr;
+        seq->step = 0;
+    }
+    
+    seq->sub_left = seq->pattern->subdiv - 1;
+    return seq_advance(seq);
+}
+
+// Called at a sub-step edge: kind of the step that starts now (a rest if the
+// beat has no sub-step left)
+static inline uint8_t seq_step(Sequencer* seq) {
+    if (!seq->sub_left) {
+        return STEP_REST;
+    }
+    seq->sub_left--;
+    return seq_advance(seq);
+}
+
+// Sub-steps left before the next beat
+static inline bool seq_steps_left(const Sequencer* seq) {
+    return seq->sub_left != 0;
+}
+
+// Steps per beat of the pattern playing
+static inline uint8_t seq_subdiv(const Sequencer* seq) {
+    return seq->pattern->subdiv;
+}
+
+// Every step is a beat of the default width: the firmware may start the pulses
+// in hardware at the beat edge
+static inline bool seq_plain(const Sequencer* seq) {
+    const SeqPattern* pattern = seq->pattern;
+    return pattern->length == 1 && pattern->step[0] == STEP_BEAT;
+}
+
+#endif // SEQUENCER_H
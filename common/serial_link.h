@@ -0,0 +1,408 @@
+/**
+ * Serial command and telemetry link shared by both firmwares
+ *
+ * Only compiled in with -DENABLE_SERIAL. A line based ASCII protocol at
+ * SERIAL_BAUD, 8N1, commands end with '\n' (a '\r' before it is ignored):
+ *
+ *     B<bpm>   Set the tempo (clamped to the range, rounded to a BPM step)
+ *              reply: B <bpm>
+ *     S        Status
+ *              reply: S <bpm> <pattern> <battery level> <supply mV> <crystal ppb> <wakes> <beats>
+ *     L        Wake log of the instrumentation layer (-DENABLE_INSTRUMENTATION),
+ *              oldest first, one line per record: L <cause> <awake cycles> <beat error>
+ *     T1, T0   Start / stop the beat stream: T <beat> <ticks> at every beat, the
+ *              beats and the RTC ticks of the firmware (ATtiny 1024Hz, STM32 4096Hz)
+ *              from the first beat of the stream to the beat edge
+ *
+ * Anything else, or a line longer than SERIAL_LINE_MAX, is answered with E.
+ * Empty lines are ignored.
+ *
+ * The interrupt handlers only move bytes and post requests: the receive handler
+ * runs the line assembler (serial_rx_byte()), the beat handler posts a beat stamp
+ * (serial_beat()), the transmit handler sends the next byte of the ring
+ * (serial_tx_byte()). The replies are formatted by serial_fill() in the main
+ * loop, right before it sleeps, where the state they report is consistent and no
+ * handler is held up. The ring has a single writer (serial_fill()) and a single
+ * reader (the transmit handler). Numbers are formatted by subtracting powers of
+ * ten, no division.
+ *
+ * Pure logic, no hardware access: also built by the host simulator (sim/).
+ */
+
+#ifndef SERIAL_LINK_H
+#define SERIAL_LINK_H
+
+#include <stdint.h>
+#include "config.h"
+#include "instrumentation.h"
+
+#define SERIAL_BAUD 9600         // The STM32 LPUART1 runs from the LSE, 9600 baud at most
+#define SERIAL_LINE_MAX 8        // Longest command line, without the '\n'
+#define SERIAL_TX_SIZE 64        // Transmit ring in bytes, must be a power of 2
+#define SERIAL_TX_LINE_MAX 56    // Longest reply line (S), formatted once the ring has room for it
+#define SERIAL_TX_LINE_SHORT 24  // Longest line of the other replies and of a beat stamp
+
+static_assert((SERIAL_TX_SIZE & (SERIAL_TX_SIZE - 1)) == 0, "SERIAL_TX_SIZE must be a power of 2");
+static_assert(SERIAL_TX_LINE_MAX < SERIAL_TX_SIZE, "A reply line must fit in the transmit ring");
+
+// Command of a complete line, returned by serial_rx_byte()
+enum SerialCommand : uint8_t {
+    SERIAL_CMD_NONE,        // Line not complete yet, or empty
+    SERIAL_CMD_TEMPO,       // B<bpm>: the firmware hands serial_tempo() to the core
+    SERIAL_CMD_STATUS,      // S
+    SERIAL_CMD_LOG,         // L
+    SERIAL_CMD_STREAM,      // T1 / T0
+    SERIAL_CMD_ERROR        // Not a command: E is sent
+};
+
+// Replies requested by the receive handler
+enum SerialReply : uint8_t {
+    SERIAL_REPLY_TEMPO  = 1 << 0,
+    SERIAL_REPLY_STATUS = 1 << 1,
+    SERIAL_REPLY_LOG    = 1 << 2,
+    SERIAL_REPLY_ERROR  = 1 << 3
+};
+
+// Values of the status reply
+struct SerialStatus {
+    uint16_t bpm;
+    uint8_t pattern;
+    uint8_t level;     // BatteryLevel
+    uint16_t mv;       // Supply of the last sample, 0 before the first one
+    int32_t ppb;       // Crystal correction in use
+    uint32_t wakes;    // Instrumentation totals, 0 without -DENABLE_INSTRUMENTATION
+    uint32_t beats;
+};
+
+struct SerialLink {
+    // Receive handler
+    char line[SERIAL_LINE_MAX];     // Command line being received
+    uint8_t length;                 // Bytes in line, SERIAL_LINE_MAX + 1: too long, dropped
+    volatile uint8_t requests;      // SerialReply bits, taken by serial_fill()
+    volatile uint8_t request_bpm;   // Tempo of the last B command
+    volatile bool streaming;        // T1 received
+    
+    // Beat handler
+    bool stream_started;            // The stream counters run
+    uint32_t stream_beat;           // Beats since the first beat of the stream
+    uint32_t stream_ticks;          // RTC ticks since the first beat of the stream
+    volatile bool stamp_pending;    // A beat stamp waits for serial_fill()
+    uint32_t stamp_beat;            // Beat stamp, valid with stamp_pending
+    uint32_t stamp_ticks;
+    
+    // Main loop
+    uint8_t replies;                // SerialReply bits taken from requests
+    uint8_t reply_bpm;              // Tempo of the B reply
+    uint8_t log_next;               // Wake log record of the next L line
+    uint8_t log_left;               // L lines left
+    
+    // Transmit ring: written by serial_fill(), read by the transmit handler
+    uint8_t tx[SERIAL_TX_SIZE];
+    volatile uint8_t head;          // Next byte to write
+    volatile uint8_t tail;          // Next byte to send
+};
+
+static inline void serial_init(SerialLink* link) {
+    link->length = 0;
+    link->requests = 0;
+    link->streaming = false;
+    link->stream_started = false;
+    link->stamp_pending = false;
+    link->replies = 0;
+    link->log_left = 0;
+    link->head = 0;
+    link->tail = 0;
+}
+
+// Nearest BPM step of a requested tempo, clamped to the range
+static inline uint8_t serial_tempo_step(uint32_t bpm) {
+    if (bpm <= BPM_MIN) {
+        return BPM_MIN;
+    }
+    if (bpm >= BPM_MAX) {
+        return BPM_MAX;
+    }
+    uint8_t steps = (uint8_t)((bpm - BPM_MIN + BPM_STEP / 2) / BPM_STEP);
+    return BPM_MIN + steps * BPM_STEP;
+}
+
+// Decimal argument of a command (up to 5 digits), false if it is not a number
+static inline bool serial_parse_uint(const char* digits, uint8_t count, uint32_t* value) {
+    if (count == 0 || count > 5) {
+        return false;
+    }
+    uint32_t v = 0;
+    for (uint8_t i = 0; i < count; i++) {
+        uint8_t d = (uint8_t)(digits[i] - '0');
+        if (d > 9) {
+            return false;
+        }
+        v = v * 10 + d;
+    }
+    *value = v;
+    return true;
+}
+
+// Command of a whole line, its reply requested
+static inline uint8_t serial_parse_line(SerialLink* link) {
+    const char* line = link->line;
+    uint8_t length = link->length;
+    uint32_t value;
+    
+    if (line[0] == 'B' && serial_parse_uint(line + 1, length - 1, &value)) {
+        link->request_bpm = serial_tempo_step(value);
+        link->requests |= SERIAL_REPLY_TEMPO;
+        return SERIAL_CMD_TEMPO;
+    }
+    if (length == 1 && line[0] == 'S') {
+        link->requests |= SERIAL_REPLY_STATUS;
+        return SERIAL_CMD_STATUS;
+    }
+#ifdef ENABLE_INSTRUMENTATION
+    if (length == 1 && line[0] == 'L') {
+        link->requests |= SERIAL_REPLY_LOG;
+        return SERIAL_CMD_LOG;
+    }
+#endif
+    if (length == 2 && line[0] == 'T' && (line[1] == '0' || line[1] == '1')) {
+        link->streaming = line[1] == '1';
+        return SERIAL_CMD_STREAM;
+    }
+    
+    link->requests |= SERIAL_REPLY_ERROR;
+    return SERIAL_CMD_ERROR;
+}
+
+// Byte received (receive handler): the SerialCommand of the line it completes
+static inline uint8_t serial_rx_byte(SerialLink* link, uint8_t c) {
+    if (c == '\r') {
+        return SERIAL_CMD_NONE;
+    }
+    if (c == '\n') {
+        uint8_t command = SERIAL_CMD_ERROR;
+        if (link->length == 0) {
+            command = SERIAL_CMD_NONE;
+        } else if (link->length <= SERIAL_LINE_MAX) {
+            command = serial_parse_line(link);
+        } else {
+            link->requests |= SERIAL_REPLY_ERROR;
+        }
+        link->length = 0;
+        return command;
+    }
+    if (link->length < SERIAL_LINE_MAX) {
+        link->line[link->length] = (char)c;
+        link->length++;
+    } else {
+        link->length = SERIAL_LINE_MAX + 1;  // Too long, answered with E at its end
+    }
+    return SERIAL_CMD_NONE;
+}
+
+// Tempo of the last B command, for the core (receive handler)
+static inline uint8_t serial_tempo(const SerialLink* link) {
+    return link->request_bpm;
+}
+
+// Beat edge (beat handler), ticks: length of the beat that just ended. Stamps the
+// beat that starts now while the stream is on; a stamp that was not formatted yet
+// is replaced, the beat numbers show the gap.
+static inline void serial_beat(SerialLink* link, uint16_t ticks) {
+    if (!link->streaming) {
+        link->stream_started = false;
+        return;
+    }
+    if (link->stream_started) {
+        link->stream_beat++;
+        link->stream_ticks += ticks;
+    } else {
+        link->stream_started = true;
+        link->stream_beat = 0;
+        link->stream_ticks = 0;
+    }
+    link->stamp_beat = link->stream_beat;
+    link->stamp_ticks = link->stream_ticks;
+    link->stamp_pending = true;
+}
+
+// A request or a stamp waits for serial_fill(): checked with interrupts masked,
+// next to the core's events_pending(), before sleeping
+static inline bool serial_work_pending(const SerialLink* link) {
+    return link->requests || link->stamp_pending;
+}
+
+// Lines are left to format once the ring has drained
+static inline bool serial_fill_pending(const SerialLink* link) {
+    return link->replies || link->log_left;
+}
+
+// Bytes waiting in the ring
+static inline bool serial_tx_pending(const SerialLink* link) {
+    return link->head != link->tail;
+}
+
+// Bytes free in the ring
+static inline uint8_t serial_tx_room(const SerialLink* link) {
+    return (uint8_t)(SERIAL_TX_SIZE - 1 - ((link->head - link->tail) & (SERIAL_TX_SIZE - 1)));
+}
+
+// Next byte to send (transmit handler), false once the ring is empty
+static inline bool serial_tx_byte(SerialLink* link, uint8_t* c) {
+    uint8_t tail = link->tail;
+    if (link->head == tail) {
+        return false;
+    }
+    *c = link->tx[tail];
+    link->tail = (tail + 1) & (SERIAL_TX_SIZE - 1);
+    return true;
+}
+
+// Append a byte (the caller checked the room)
+static inline void serial_put(SerialLink* link, uint8_t c) {
+    uint8_t head = link->head;
+    link->tx[head] = c;
+    link->head = (head + 1) & (SERIAL_TX_SIZE - 1);
+}
+
+// Decimal, by subtracting powers of ten (no division on 8-bit targets)
+static inline void serial_put_uint(SerialLink* link, uint32_t value) {
+    static const uint32_t powers[] = { 1000000000UL, 100000000UL, 10000000UL, 1000000UL,
+                                       100000UL, 10000UL, 1000UL, 100UL, 10UL };
+    bool digits = false;
+    for (uint8_t i = 0; i < sizeof(powers) / sizeof(powers[0]); i++) {
+        uint8_t d = 0;
+        while (value >= powers[i]) {
+            value -= powers[i];
+            d++;
+        }
+        if (d || digits) {
+            serial_put(link, (uint8_t)('0' + d));
+            digits = true;
+        }
+    }
+    serial_put(link, (uint8_t)('0' + value));
+}
+
+// " <value>"
+static inline void serial_put_field(SerialLink* link, int32_t value) {
+    serial_put(link, ' ');
+    if (value < 0) {
+        serial_put(link, '-');
+        serial_put_uint(link, (uint32_t)-value);
+    } else {
+        serial_put_uint(link, (uint32_t)value);
+    }
+}
+
+// " <value>" of a 32-bit counter
+static inline void serial_put_count(SerialLink* link, uint32_t value) {
+    serial_put(link, ' ');
+    serial_put_uint(link, value);
+}
+
+static inline void serial_put_stamp(SerialLink* link, uint32_t beat, uint32_t ticks) {
+    serial_put(link, 'T');
+    serial_put_count(link, beat);
+    serial_put_count(link, ticks);
+    serial_put(link, '\n');
+}
+
+static inline void serial_put_status(SerialLink* link, const SerialStatus* status) {
+    serial_put(link, 'S');
+    serial_put_field(link, status->bpm);
+    serial_put_field(link, status->pattern);
+    serial_put_field(link, status->level);
+    serial_put_field(link, status->mv);
+    serial_put_field(link, status->ppb);
+    serial_put_count(link, status->wakes);
+    serial_put_count(link, status->beats);
+    serial_put(link, '\n');
+}
+
+static inline void serial_put_wake(SerialLink* link, const WakeRecord* record) {
+    serial_put(link, 'L');
+    serial_put_field(link, record->cause);
+    serial_put_count(link, record->awake_cycles);
+    serial_put_field(link, record->beat_error);
+    serial_put(link, '\n');
+}
+
+// Format reply lines and beat stamps while the ring has room for the next one
+// (main loop, before sleeping). The firmware supplies the values through a policy
+// class:
+//
+//     struct Source {
+//         static void status(SerialStatus* status);  // Values of the S reply
+//         static const WakeLog* wake_log();          // nullptr without instrumentation
+//         static uint8_t irq_save();                 // As the HAL of the core
+//         static void irq_restore(uint8_t state);
+//     };
+//
+// The requests and the stamp are taken with interrupts masked, a few loads. A beat
+// stamp goes first, so the stream keeps up with the beats while a log is sent; a
+// stamp without room is dropped, the next beat brings a new one.
+template <class Source>
+static inline void serial_fill(SerialLink* link) {
+    uint8_t state = Source::irq_save();
+    uint8_t requests = link->requests;
+    link->requests = 0;
+    bool stamp = link->stamp_pending;
+    link->stamp_pending = false;
+    uint32_t stamp_beat = link->stamp_beat;
+    uint32_t stamp_ticks = link->stamp_ticks;
+    Source::irq_restore(state);
+    
+    if (requests & SERIAL_REPLY_TEMPO) {
+        link->reply_bpm = link->request_bpm;
+    }
+    link->replies |= requests;
+    
+    while (1) {
+        uint8_t room = serial_tx_room(link);
+        if (room < SERIAL_TX_LINE_SHORT) {
+            return;
+        }
+        
+        uint8_t replies = link->replies;
+        if (stamp) {
+            stamp = false;
+            serial_put_stamp(link, stamp_beat, stamp_ticks);
+        } else if (replies & SERIAL_REPLY_ERROR) {
+            link->replies = replies & ~SERIAL_REPLY_ERROR;
+            serial_put(link, 'E');
+            serial_put(link, '\n');
+        } else if (replies & SERIAL_REPLY_TEMPO) {
+            link->replies = replies & ~SERIAL_REPLY_TEMPO;
+            serial_put(link, 'B');
+            serial_put_field(link, link->reply_bpm);
+            serial_put(link, '\n');
+        } else if (replies & SERIAL_REPLY_STATUS) {
+            if (room < SERIAL_TX_LINE_MAX) {
+                return;
+            }
+            link->replies = replies & ~SERIAL_REPLY_STATUS;
+            SerialStatus status = {};
+            Source::status(&status);
+            serial_put_status(link, &status);
+        } else if (replies & SERIAL_REPLY_LOG) {
+            // Oldest record first: the one the next wake overwrites
+            link->replies = replies & ~SERIAL_REPLY_LOG;
+            const WakeLog* log = Source::wake_log();
+            if (log) {
+                link->log_next = log->head;
+                link->log_left = WAKE_LOG_SIZE;
+            }
+        } else if (link->log_left) {
+            const WakeRecord* record = &Source::wake_log()->entry[link->log_next];
+            link->log_next = (link->log_next + 1) & (WAKE_LOG_SIZE - 1);
+            link->log_left--;
+            if (record->cause) {  // Records not written yet are skipped
+                serial_put_wake(link, record);
+            }
+        } else {
+            return;
+        }
+    }
+}
+
+#endif // SERIAL_LINK_H
@@ -0,0 +1,85 @@
+/**
+ * Tap tempo estimation shared by both firmwares
+ *
+ * The firmware timestamps each confirmed tap with its RTC at the press edge and
+ * passes the interval since the previous tap to tap_next(), in RTC ticks. The
+ * intervals are averaged by an exponential filter in fixed point (TAP_FRAC_BITS
+ * fractional bits, weight 1 / 2^TAP_FILTER_SHIFT for a new interval); an interval
+ * more than 1/4 away from the average restarts the filter, so a new tempo is
+ * picked up from its first interval. An interval longer than a beat at BPM_MIN
+ * (plus 1/4) starts a new run of taps.
+ *
+ * The tempo is the nearest BPM step, found by comparing the filtered interval
+ * against the midpoints of the beat period table of the same clock: shifts, adds
+ * and compares only, no division, so it runs in interrupt context. Taps faster
+ * than BPM_MAX or slower than BPM_MIN clamp to the range.
+ *
+ * Pure logic, no hardware access: also built by the host simulator (sim/).
+ */
+
+#ifndef TAP_TEMPO_H
+#define TAP_TEMPO_H
+
+#include <stdint.h>
+#include "bpm_table.h"
+
+#define TAP_FRAC_BITS 3     // Fractional bits of the filtered interval
+#define TAP_FILTER_SHIFT 2  // New interval weight 1/4
+
+static_assert((TICKS_PER_MINUTE_4096HZ / BPM_MIN) * 5 / 4 <= (0xFFFFU >> TAP_FRAC_BITS),
+              "The longest tap interval must fit 16 bits in fixed point");
+
+struct TapTempo {
+    uint16_t filtered;  // Filtered tap interval in ticks << TAP_FRAC_BITS, 0: none yet
+    bool active;        // A run of taps is in progress (at least one tap)
+};
+
+// Longest interval between two taps of a run: a beat at BPM_MIN plus 1/4
+static inline uint16_t tap_max_interval(const BpmPeriodTable* table) {
+    uint16_t ticks = table->entry[0].ticks;
+    return ticks + (ticks >> 2);
+}
+
+// Nearest BPM step for a filtered interval (periods fall with the table index)
+static inline uint16_t tap_nearest_bpm(const BpmPeriodTable* table, uint16_t filtered) {
+    for (uint8_t i = 1; i < BPM_TABLE_SIZE; i++) {
+        // Midpoint of the periods of steps i - 1 and i, in fixed point
+        uint16_t mid = (uint16_t)((table->entry[i - 1].ticks + table->entry[i].ticks) << (TAP_FRAC_BITS - 1));
+        if (filtered >= mid) {
+            return BPM_MIN + (i - 1) * BPM_STEP;
+        }
+    }
+    return BPM_MAX;
+}
+
+// A tap confirmed, interval in ticks since the previous one (ignored for the first
+// tap of a run); returns the tapped tempo, or 0 while there is no interval yet
+static inline uint16_t tap_next(TapTempo* tap, const BpmPeriodTable* table, uint16_t interval) {
+    if (!tap->active || interval > tap_max_interval(table)) {
+        tap->active = true;  // First tap of a new run
+        tap->filtered = 0;
+        return 0;
+    }
+    
+    uint16_t sample = interval << TAP_FRAC_BITS;
+    uint16_t filtered = tap->filtered;
+    uint16_t deviation = sample > filtered ? sample - filtered : filtered - sample;
+    
+    if (filtered == 0 || deviation > (filtered >> 2)) {
+        filtered = sample;  // First interval or a new tempo: restart the filter
+    } else if (sample > filtered) {
+        filtered += (sample - filtered) >> TAP_FILTER_SHIFT;
+    } else {
+        filtered -= (filtered - sample) >> TAP_FILTER_SHIFT;
+    }
+    tap->filtered = filtered;
+    
+    return tap_nearest_bpm(table, filtered);
+}
+
+// End the run of taps (the firmware's tap clock stopped)
+static inline void tap_reset(TapTempo* tap) {
+    tap->active = false;
+}
+
+#endif // TAP_TEMPO_H
@@ -0,0 +1,24 @@
+/**
+ * BPM step logic shared by both firmwares
+ * 
+ * BPM_MIN, BPM_MAX and BPM_STEP must be defined before including this header.
+ * 
+ * Pure logic, no hardware access: also built by the host simulator (sim/).
+ */
+
+#ifndef TEMPO_H
+#define TEMPO_H
+
+#include <stdint.h>
+
+// One step faster, clamped to BPM_MAX
+static inline uint16_t tempo_step_up(uint16_t bpm) {
+    return (bpm <= BPM_MAX - BPM_STEP) ? bpm + BPM_STEP : BPM_MAX;
+}
+
+// One step slower, clamped to BPM_MIN
+static inline uint16_t tempo_step_down(uint16_t bpm) {
+    return (bpm >= BPM_MIN + BPM_STEP) ? bpm - BPM_STEP : BPM_MIN;
+}
+
+#endif // TEMPO_H
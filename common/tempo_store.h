@@ -0,0 +1,107 @@
+/**
+ * Wear-leveled tempo storage shared by both firmwares
+ *
+ * The tempo is kept in a ring of TEMPO_STORE_SLOTS records in non-volatile memory
+ * (ATtiny EEPROM, STM32L0 data EEPROM). Every save writes the next slot with a
+ * sequence number one higher than the last one, so each slot is written once every
+ * TEMPO_STORE_SLOTS saves. At boot the latest record is the valid one whose next
+ * slot does not continue the sequence.
+ *
+ * A record is 4 bytes (one STM32 data EEPROM word, inside one ATtiny EEPROM page)
+ * with a check byte: an erased slot (0xFF on AVR, 0x00 on STM32) or a write cut
+ * short by a reset or brown-out is ignored, and the previous record is used.
+ *
+ * Both memories are mapped into the address space: the firmware passes the ring
+ * as a pointer to tempo_store_restore() and writes the record prepared by
+ * tempo_store_next() with its own NVM controller sequence.
+ *
+ * BPM_MIN, BPM_MAX, BPM_STEP and BPM_DEFAULT must be defined before including
+ * this header.
+ *
+ * Pure logic, no hardware access: also built by the host simulator (sim/).
+ */
+
+#ifndef TEMPO_STORE_H
+#define TEMPO_STORE_H
+
+#include <stdint.h>
+
+#define TEMPO_STORE_SLOTS 16    // Records in the ring, must be a power of 2
+#define TEMPO_RECORD_KEY  0x5A  // Mixed into the check byte, so all-equal bytes never pass
+
+static_assert((TEMPO_STORE_SLOTS & (TEMPO_STORE_SLOTS - 1)) == 0, "TEMPO_STORE_SLOTS must be a power of 2");
+static_assert(TEMPO_STORE_SLOTS < 256, "The sequence number must not wrap within the ring");
+
+struct TempoRecord {
+    uint8_t seq;       // Sequence number, one higher than the previous record
+    uint8_t bpm;
+    uint8_t check;     // seq ^ bpm ^ TEMPO_RECORD_KEY
+    uint8_t reserved;  // Written as 0
+};
+
+static_assert(sizeof(TempoRecord) == 4, "A record must be one 32-bit word");
+
+struct TempoStore {
+    uint8_t next_slot;  // Slot the next save writes
+    uint8_t next_seq;   // Sequence number of the next save
+    uint8_t saved_bpm;  // Tempo of the latest record, 0 if there is none
+};
+
+static inline uint8_t tempo_record_check(uint8_t seq, uint8_t bpm) {
+    return (uint8_t)(seq ^ bpm ^ TEMPO_RECORD_KEY);
+}
+
+// Check byte matches and the tempo is a BPM step within range
+static inline bool tempo_record_valid(const TempoRecord* rec) {
+    return rec->check == tempo_record_check(rec->seq, rec->bpm) && rec->bpm >= BPM_MIN &&
+           rec->bpm <= BPM_MAX && (rec->bpm - BPM_MIN) % BPM_STEP == 0;
+}
+
+// Find the latest record in the ring (boot only): returns its tempo, or BPM_DEFAULT
+// if the ring holds none, and sets up the store to continue after it
+static inline uint16_t tempo_store_restore(TempoStore* store, const TempoRecord* ring) {
+    store->next_slot = 0;
+    store->next_seq = 0;
+    store->saved_bpm = 0;
+    
+    for (uint8_t i = 0; i < TEMPO_STORE_SLOTS; i++) {
+        const TempoRecord* rec = &ring[i];
+        if (!tempo_record_valid(rec)) {
+            continue;
+        }
+        
+        uint8_t next = (i + 1) & (TEMPO_STORE_SLOTS - 1);
+        const TempoRecord* following = &ring[next];
+        if (tempo_record_valid(following) && following->seq == (uint8_t)(rec->seq + 1)) {
+            continue;  // Not the latest, the sequence goes on
+        }
+        
+        store->next_slot = next;
+        store->next_seq = rec->seq + 1;
+        store->saved_bpm = rec->bpm;
+        break;
+    }
+    
+    return store->saved_bpm ? store->saved_bpm : BPM_DEFAULT;
+}
+
+// Prepare the record that saves a tempo and the slot to write it to; returns false
+// if the latest record already holds that tempo (nothing to write)
+static inline bool tempo_store_next(TempoStore* store, uint16_t bpm, TempoRecord* rec, uint8_t* slot) {
+    if (bpm == store->saved_bpm) {
+        return false;
+    }
+    
+    rec->seq = store->next_seq;
+    rec->bpm = (uint8_t)bpm;
+    rec->check = tempo_record_check(rec->seq, rec->bpm);
+    rec->reserved = 0;
+    *slot = store->next_slot;
+    
+    store->next_slot = (store->next_slot + 1) & (TEMPO_STORE_SLOTS - 1);
+    store->next_seq++;
+    store->saved_bpm = (uint8_t)bpm;
+    return true;
+}
+
+#endif // TEMPO_STORE_H
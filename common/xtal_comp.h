@@ -0,0 +1,108 @@
+/**
+ * Crystal temperature compensation shared by both firmwares
+ *
+ * A 32.768kHz tuning-fork crystal runs slow away from its turnover temperature,
+ * by XTAL_PARABOLIC_PPB ppb per °C squared (-0.034 ppm/°C² typical): 5 ppm at
+ * 13°C off the turnover, 40 ppm at -10°C, 60 ppm at 67°C. Every XTAL_TEMP_SAMPLES
+ * supply samples (common/battery.h) the core also takes the die temperature, in
+ * the same beat wake, and the firmware corrects the RTC by the offset of that
+ * temperature plus the measured offset of the unit (XTAL_OFFSET_PPB):
+ *
+ * - STM32: RTC smooth calibration (RTC->CALR) in hardware, 0.954 ppm steps
+ * - ATtiny: the 1-series RTC has no calibration register, so the beat scheduler
+ *   takes one tick off (or adds one to) a beat every 10^9 / ppb ticks
+ *   (drift_next()): ±1 tick on a beat now and then, the long-run rate is exact
+ *
+ * Temperature changes slowly compared to the sample interval (a few minutes), so
+ * the correction follows it with at most a few ppm of error from the sensor
+ * resolution and accuracy.
+ *
+ * XTAL_* (config.h) must be defined before including this header.
+ *
+ * Pure logic, no hardware access: also built by the host simulator (sim/).
+ */
+
+#ifndef XTAL_COMP_H
+#define XTAL_COMP_H
+
+#include <stdint.h>
+#include "config.h"
+
+#define XTAL_TEMP_MIN -40  // Sensor readings are clamped to the operating range
+#define XTAL_TEMP_MAX 125
+
+struct XtalComp {
+    int32_t ppb;      // Correction in use, positive: the crystal runs slow
+    int16_t celsius;  // Last die temperature
+    uint8_t samples;  // Supply samples until the next temperature sample, 0: at the next one
+};
+
+// Beat timing correction in ppb at a temperature, positive when the crystal is slow
+static inline int32_t xtal_correction_ppb(int16_t celsius) {
+    if (celsius < XTAL_TEMP_MIN) {
+        celsius = XTAL_TEMP_MIN;
+    } else if (celsius > XTAL_TEMP_MAX) {
+        celsius = XTAL_TEMP_MAX;
+    }
+    int32_t d = celsius - XTAL_TURNOVER_C;
+    return d * d * XTAL_PARABOLIC_PPB - XTAL_OFFSET_PPB;
+}
+
+// Called at every supply sample: returns true when the temperature is due too
+static inline bool xtal_due(XtalComp* comp) {
+    if (comp->samples) {
+        comp->samples--;
+        return false;
+    }
+    comp->samples = XTAL_TEMP_SAMPLES - 1;
+    return true;
+}
+
+// New temperature: returns true if the correction changed
+static inline bool xtal_update(XtalComp* comp, int16_t celsius) {
+    comp->celsius = celsius;
+    int32_t ppb = xtal_correction_ppb(celsius);
+    bool changed = ppb != comp->ppb;
+    comp->ppb = ppb;
+    return changed;
+}
+
+// Tick-skip correction for an RTC without a calibration register
+struct DriftState {
+    uint32_t interval;  // Ticks per corrected tick, 0: no correction
+    uint32_t acc;       // Ticks counted towards the next corrected tick
+    int8_t step;        // Ticks added to the corrected beat: -1 (slow crystal) or +1
+};
+
+// Set the correction (one division, at each change): a tick every 10^9 / ppb ticks
+// On 8-bit targets the caller must make the update atomic
+static inline void drift_set(DriftState* drift, int32_t ppb) {
+    if (ppb == 0) {
+        drift->interval = 0;
+        drift->step = 0;
+        return;
+    }
+    
+    uint32_t magnitude = (uint32_t)(ppb < 0 ? -ppb : ppb);
+    drift->interval = 1000000000UL / magnitude;
+    drift->step = ppb > 0 ? -1 : 1;
+    if (drift->acc >= drift->interval) {
+        drift->acc = 0;
+    }
+}
+
+// Called at a beat boundary with the length of the beat that starts now: ticks to
+// add to it (32-bit add and compare, no multiply)
+static inline int8_t drift_next(DriftState* drift, uint16_t ticks) {
+    if (!drift->step) {
+        return 0;
+    }
+    drift->acc += ticks;
+    if (drift->acc >= drift->interval) {
+        drift->acc -= drift->interval;
+        return drift->step;
+    }
+    return 0;
+}
+
+#endif // XTAL_COMP_H
@@ -0,0 +1,1306 @@
+/**
+ * Host Simulator - Beat Scheduling and Debounce Benchmark
+ *
+ * Runs the shared scheduling logic from common/ (the same code the firmwares run
+ * in their interrupt handlers) against a discrete-event model of each target's
+ * RTC, without hardware. Hours of simulated time take milliseconds.
+ *
+ * Beat sweep, for every BPM setting and both targets:
+ * - Beat period error: worst single-beat deviation from 60/BPM seconds (tick
+ *   quantization) and worst accumulated phase error versus an ideal clock
+ * - Long-run rate error in ppm at the end of the run (0 with error diffusion)
+ * - Wakes per beat
+ * - Estimated charge per hour in µA·s, from the current model below
+ *
+ * Debounce scenarios: recorded bounce patterns are fed through the debounce state
+ * machine with the 50ms settle timer and the auto-repeat schedule; confirmed
+ * presses, repeat steps and wakes are reported.
+ *
+ * Tempo buttons: the metronome core (common/metronome.h) runs on a simulated HAL
+ * to check the button actions and the tempo changes it hands to the HAL, including
+ * a held button that auto-repeats across the whole range.
+ *
+ * Tap tempo: jittered taps at every BPM step are fed through the tap filter
+ * (common/tap_tempo.h) on both RTC clocks, and the core must hand the tapped tempo
+ * to the HAL and realign the beat.
+ *
+ * Sequencer: every pattern of common/sequencer.h is played through its bars with
+ * pattern changes and missed sub-steps, the sub-step and pulse width tables are
+ * checked on every clock, and the core must pulse each step and pick the next
+ * pattern with both tempo buttons.
+ *
+ * Lean board: the core on a HAL without tempo storage and patterns must not
+ * save and must ignore the pattern selection.
+ *
+ * Supply monitor: the core is run through a discharge and recovery of the supply
+ * (common/battery.h) to check the sample schedule, the levels and their hysteresis.
+ *
+ * Crystal compensation: the core must take the temperature on its schedule and
+ * hand the correction of common/xtal_comp.h to the HAL, and the ATtiny tick-skip
+ * must cancel a crystal offset over a day of beats.
+ *
+ * Event pulse: the ATtiny quiet runs of -DUSE_EVENT_PULSE, whose beats skip the
+ * main loop, must keep the supply and temperature samples on their schedule,
+ * also when two beats coalesce into one event.
+ *
+ * Event word: events raised after the last poll must keep the simulated HAL from
+ * sleeping and be handled by the next poll, and the event word must only be
+ * touched with interrupts masked.
+ *
+ * Serial link: command lines are fed through the line assembler of
+ * common/serial_link.h, the replies, beat stamps and a wake log dump are formatted
+ * and drained from the transmit ring, and a B command must set the core's tempo.
+ *
+ * Beat sync: a follower on a drifting crystal locks onto a leader's edges through
+ * the loop of common/beat_sync.h on both RTC clocks, ignores the leader's
+ * sub-steps and realigns once the leader moves its phase.
+ *
+ * Stack paint: the high-water count and the scan schedule of the instrumentation
+ * layer (common/instrumentation.h) are checked on a painted buffer.
+ *
+ * Tempo storage: the wear-leveled record ring (common/tempo_store.h) is run on an
+ * in-memory EEPROM to check restore after erase, wrap-around and a cut-off write.
+ *
+ * Exit status is non-zero if a beat drifts by a whole tick or more, or if a
+ * debounce scenario does not produce the expected number of presses and repeats, so the
+ * benchmark can gate timing changes.
+ *
+ * The crystal is modeled as ideal: reported errors are those of the scheduling
+ * only, crystal tolerance (±20 ppm) adds to them.
+ *
+ * Usage: sim [hours]   (default 1 hour of simulated time per BPM setting)
+ */
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+// Same configuration and portable core as both firmwares
+#include "../common/config.h"
+#include "../common/metronome.h"
+#include "../common/bpm_table.h"
+#include "../common/beat_scheduler.h"
+#include "../common/debounce.h"
+#include "../common/tempo_store.h"
+#include "../common/tap_tempo.h"
+#include "../common/sequencer.h"
+#include "../common/battery.h"
+#include "../common/xtal_comp.h"
+#include "../common/serial_link.h"
+#include "../common/beat_sync.h"
+
+#define SIM_HOURS_DEFAULT 1
+#define SIM_SUPPLY_SCALE (1100UL * 1023)  // Reading scale of the ATtiny supply conversion
+#define DEBOUNCE_DELAY_US (DEBOUNCE_DELAY_MS * 1000UL)
+
+static constexpr RepeatTable repeat_table_ms = make_repeat_table<1000>();
+
+// Current model (estimates at 3.3V, tune from measurements, e.g. the awake times
+// logged by -DENABLE_INSTRUMENTATION and a current probe on the supply)
+#define ATTINY_SLEEP_UA 1.0          // Standby with only the RTC on the 32.768kHz crystal
+#define ATTINY_RUN_UA 1100.0         // Active at 3.33MHz
+#define ATTINY_PULSE_UA 1.0          // Standby, the pulse is timed by the RTC compare
+#define ATTINY_BEAT_AWAKE_US 120.0   // RTC overflow ISR + main loop + RTC compare ISR
+#define ATTINY_WAKES_PER_BEAT 2      // RTC overflow, RTC compare end of pulse
+
+#define STM32_SLEEP_UA 0.8           // Stop mode with RTC on LSE
+#define STM32_RUN_UA 290.0           // Run at MSI 2.097MHz, Range 1
+#define STM32_PULSE_UA 1.3           // Stop mode with LPTIM1 on LSE
+#define STM32_BEAT_AWAKE_US 120.0    // Alarm A ISR (incl. ALRAWF wait) + LPTIM1 ISR
+#define STM32_WAKES_PER_BEAT 2       // Alarm A, LPTIM1 end of pulse
+#define STM32_WUT_BEAT_AWAKE_US 120.0 // Wake-up timer ISR (incl. WUTWF wait) + LPTIM1 ISR (-DUSE_RTC_WAKEUP_TIMER)
+#define STM32_WUT_RESTART_TICKS 1    // Sub-second ticks from the wake-up to the timer restart
+
+struct TargetModel {
+    const char* name;
+    uint32_t ticks_per_minute;       // RTC ticks per minute
+    const BpmPeriodTable* table;
+    double sleep_ua;
+    double run_ua;
+    double pulse_ua;                 // Sleep current while the pulse timer runs
+    double beat_awake_us;
+    uint8_t wakes_per_beat;
+    uint8_t timer_ticks;             // RTC ticks per beat timer tick: above 1, the timer is restarted
+                                     // after each beat for the whole timer ticks left to the timestamp
+};
+
+static const TargetModel targets[] = {
+    { "ATtiny1616 (RTC 1024Hz)", TICKS_PER_MINUTE_1024HZ, &bpm_table_1024hz,
+      ATTINY_SLEEP_UA, ATTINY_RUN_UA, ATTINY_PULSE_UA, ATTINY_BEAT_AWAKE_US, ATTINY_WAKES_PER_BEAT, 1 },
+    { "STM32L053 (RTC 4096Hz)", TICKS_PER_MINUTE_4096HZ, &bpm_table_4096hz,
+      STM32_SLEEP_UA, STM32_RUN_UA, STM32_PULSE_UA, STM32_BEAT_AWAKE_US, STM32_WAKES_PER_BEAT, 1 },
+    { "STM32L053 (wake-up timer 2048Hz to RTC timestamps, -DUSE_RTC_WAKEUP_TIMER)", TICKS_PER_MINUTE_4096HZ,
+      &bpm_table_4096hz, STM32_SLEEP_UA, STM32_RUN_UA, STM32_PULSE_UA, STM32_WUT_BEAT_AWAKE_US, STM32_WAKES_PER_BEAT, 2 },
+};
+
+struct BeatResult {
+    uint32_t beats;
+    double max_beat_error_us;   // Worst single beat length versus 60/BPM s
+    double max_phase_error_us;  // Worst accumulated beat timestamp error
+    double rate_error_ppm;      // Beat rate error over the whole run
+    double wakes_per_beat;
+    double charge_uas;          // µA·s per hour
+};
+
+// Simulate one BPM setting for the given number of hours
+// Beat k is scheduled at t_k = sum of beat_next() lengths; the ideal timestamp is
+// k * ticks_per_minute / bpm, compared exactly in units of 1/bpm ticks. A beat timer
+// with coarser ticks than the RTC (timer_ticks) is restarted right after each beat
+// and fires on the last of its ticks before t_k.
+static BeatResult simulate_beats(const TargetModel* target, uint16_t bpm, uint32_t hours) {
+    BeatResult result = {};
+    BeatState state;
+    beat_init(&state, &target->table->entry[bpm_index(bpm)]);
+    
+    double tick_us = 60e6 / target->ticks_per_minute;
+    uint64_t beats = (uint64_t)bpm * 60 * hours;
+    int64_t ideal_len = target->ticks_per_minute;  // Ideal beat length in 1/bpm ticks
+    int64_t t = 0;                                 // Beat timestamp in ticks
+    int64_t edge = 0;                              // Beat timer edge of the last beat
+    uint64_t wakes = 0;
+    
+    for (uint64_t k = 1; k <= beats; k++) {
+        t += beat_next(&state);
+        int64_t last = edge;
+        if (target->timer_ticks > 1) {
+            int64_t restart = last + STM32_WUT_RESTART_TICKS;
+            edge = t - (t - restart) % target->timer_ticks;
+        } else {
+            edge = t;
+        }
+        wakes += target->wakes_per_beat;
+        
+        double beat_error = (double)((edge - last) * bpm - ideal_len) / bpm * tick_us;
+        double phase_error = (double)(edge * bpm - (int64_t)k * ideal_len) / bpm * tick_us;
+        if (beat_error < 0) beat_error = -beat_error;
+        if (phase_error < 0) phase_error = -phase_error;
+        if (beat_error > result.max_beat_error_us) result.max_beat_error_us = beat_error;
+        if (phase_error > result.max_phase_error_us) result.max_phase_error_us = phase_error;
+    }
+    
+    double ideal_total = (double)beats * target->ticks_per_minute / bpm;
+    result.beats = (uint32_t)beats;
+    result.rate_error_ppm = ((double)edge - ideal_total) / ideal_total * 1e6;
+    result.wakes_per_beat = (double)wakes / beats;
+    
+    double awake_s = beats * target->beat_awake_us * 1e-6 / hours;
+    double pulse_s = beats * ACTIVATION_DURATION_MS * 1e-3 / hours;
+    result.charge_uas = target->sleep_ua * 3600.0 + (target->run_ua - target->sleep_ua) * awake_s
+                      + (target->pulse_ua - target->sleep_ua) * pulse_s;
+    return result;
+}
+
+// Run the BPM sweep for one target, returns false if a beat drifted a whole tick
+// of its beat timer
+static bool run_beat_sweep(const TargetModel* target, uint32_t hours) {
+    double tick_us = 60e6 / target->ticks_per_minute * target->timer_ticks;
+    bool ok = true;
+    
+    printf("\n%s, %u h per BPM, tick = %.1f us\n", target->name, (unsigned)hours, tick_us);
+    printf("  BPM   beats   max beat err (us)   max phase err (us)   rate err (ppm)   wakes/beat   uA*s per hour\n");
+    
+    for (uint16_t bpm = BPM_MIN; bpm <= BPM_MAX; bpm += BPM_STEP) {
+        BeatResult r = simulate_beats(target, bpm, hours);
+        bool beat_ok = r.max_phase_error_us < tick_us;
+        ok = ok && beat_ok;
+        printf("  %3u %8lu %19.1f %20.1f %16.3f %12.2f %15.1f%s\n",
+               bpm, (unsigned long)r.beats, r.max_beat_error_us, r.max_phase_error_us,
+               r.rate_error_ppm, r.wakes_per_beat, r.charge_uas, beat_ok ? "" : "  DRIFT");
+    }
+    return ok;
+}
+
+// Debounce scenario: alternating pin edges starting with a press (pin low),
+// times in µs; the pin is released (high) before the first edge
+struct DebounceScenario {
+    const char* name;
+    uint8_t expected_presses;
+    uint8_t expected_repeats;
+    uint8_t edge_count;
+    uint32_t edges_us[16];
+};
+
+static const DebounceScenario scenarios[] = {
+    { "clean press 200ms",        1, 0, 2, { 0, 200000 } },
+    { "bouncy press and release", 1, 0, 10, { 0, 300, 700, 1500, 1900,
+                                              300000, 300400, 301000, 301800, 302500 } },
+    { "2ms glitch",               0, 0, 2, { 0, 2000 } },
+    { "release bouncing 20ms",    1, 0, 8, { 0, 150000, 152000, 156000, 158000, 163000, 165000, 170000 } },
+    { "two presses 150ms apart",  2, 0, 4, { 0, 100000, 250000, 350000 } },
+    { "held 1s",                  1, 4, 2, { 0, 1000000 } },
+    { "held 2s, bounce at 1.2s",  1, 18, 4, { 0, 1200000, 1201000, 2000000 } },
+};
+
+// Feed a scenario through the state machine: every edge is a wake that restarts
+// the settle timer, the timer expiry is a wake that samples the pin and, while the
+// button is held, re-arms the timer for the next repeat step
+static bool run_debounce_scenario(const DebounceScenario* scenario) {
+    volatile ButtonState state = BUTTON_IDLE;
+    volatile RepeatState repeat = {};
+    bool pin_down = false;
+    bool timer_armed = false;
+    uint32_t timer_expiry = 0;
+    uint8_t presses = 0;
+    uint8_t repeats = 0;
+    uint32_t wakes = 0;
+    uint8_t next_edge = 0;
+    
+    while (next_edge < scenario->edge_count || timer_armed) {
+        bool edge_first = next_edge < scenario->edge_count &&
+                          (!timer_armed || scenario->edges_us[next_edge] < timer_expiry);
+        wakes++;
+        if (edge_first) {
+            pin_down = !pin_down;
+            debounce_on_edge(&state);
+            repeat_on_edge(&repeat);
+            timer_expiry = scenario->edges_us[next_edge] + DEBOUNCE_DELAY_US;
+            timer_armed = true;
+            next_edge++;
+        } else {
+            timer_armed = false;
+            DebounceEvent event = debounce_on_settle(&state, pin_down, repeat.armed);
+            presses += event == DEBOUNCE_PRESS;
+            repeats += event == DEBOUNCE_REPEAT;
+            
+            uint8_t stage = repeat_on_settle(&repeat, state == BUTTON_HELD);
+            if (stage != REPEAT_STOP) {
+                timer_expiry += repeat_table_ms.ticks[stage] * 1000UL;
+                timer_armed = true;
+            }
+        }
+    }
+    
+    bool ok = presses == scenario->expected_presses && repeats == scenario->expected_repeats &&
+              state == BUTTON_IDLE;
+    printf("  %-26s presses %u (expected %u), repeats %2u (expected %2u), wakes %2lu%s\n", scenario->name,
+           presses, scenario->expected_presses, repeats, scenario->expected_repeats,
+           (unsigned long)wakes, ok ? "" : "  FAIL");
+    return ok;
+}
+
+// HAL policy for the metronome core: records what the core asks the hardware to do
+struct SimHal {
+    static constexpr bool persistent = true;
+    static constexpr bool patterns = true;
+    
+    static uint16_t tempo;       // Last tempo handed to set_tempo()
+    static uint32_t tempo_changes;
+    static uint32_t pulses;
+    static uint32_t kind_pulses[STEP_KIND_COUNT];  // Pulses per step kind
+    static uint32_t kicks;       // Watchdog reloads, once per beat only
+    static uint32_t saves;
+    static uint16_t saved_bpm;   // Last tempo handed to save_tempo()
+    static uint32_t aligns;      // Beat realignments to a tap
+    static uint8_t pattern;      // Last pattern handed to set_pattern()
+    static uint16_t supply_mv;   // Simulated supply
+    static uint32_t samples;     // Supply conversions
+    static uint8_t level;        // Last battery level handed to set_power_level()
+    static uint32_t level_changes;
+    static int16_t celsius;      // Simulated die temperature
+    static uint32_t temperature_samples;
+    static int32_t trim_ppb;     // Last correction handed to set_xtal_trim()
+    static uint32_t trims;
+    static uint8_t masked;       // Interrupt mask state of irq_save() / irq_restore()
+    static uint32_t masked_sections;
+    static uint32_t sleeps;      // Sleeps entered
+    static uint32_t sleeps_skipped; // Sleeps skipped for a pending event
+    
+    static void set_tempo(uint16_t bpm) {
+        tempo = bpm;
+        tempo_changes++;
+    }
+    static void pulse(uint8_t kind) {
+        pulses++;
+        kind_pulses[kind]++;
+    }
+    static void sleep();
+    static void watchdog_kick() {
+        kicks++;
+    }
+    static void save_tempo(uint16_t bpm) {
+        saved_bpm = bpm;
+        saves++;
+    }
+    static void align_beat(uint16_t) {
+        aligns++;
+    }
+    static void set_pattern(uint8_t index) {
+        pattern = index;
+    }
+    static uint16_t measure_supply() {
+        samples++;
+        return battery_reading(SIM_SUPPLY_SCALE, supply_mv);
+    }
+    static void set_power_level(uint8_t new_level) {
+        level = new_level;
+        level_changes++;
+    }
+    static int16_t measure_temperature() {
+        temperature_samples++;
+        return celsius;
+    }
+    static void set_xtal_trim(int32_t ppb) {
+        trim_ppb = ppb;
+        trims++;
+    }
+    static uint8_t irq_save() {
+        uint8_t state = masked;
+        masked = 1;
+        masked_sections++;
+        return state;
+    }
+    static void irq_restore(uint8_t state) {
+        masked = state;
+    }
+};
+
+uint16_t SimHal::tempo = BPM_DEFAULT;
+uint32_t SimHal::tempo_changes = 0;
+uint32_t SimHal::pulses = 0;
+uint32_t SimHal::kicks = 0;
+uint32_t SimHal::saves = 0;
+uint16_t SimHal::saved_bpm = 0;
+uint32_t SimHal::aligns = 0;
+uint32_t SimHal::kind_pulses[STEP_KIND_COUNT] = {};
+uint8_t SimHal::pattern = SEQ_DEFAULT_PATTERN;
+uint16_t SimHal::supply_mv = 3000;
+uint32_t SimHal::samples = 0;
+uint8_t SimHal::level = BATTERY_OK;
+uint32_t SimHal::level_changes = 0;
+int16_t SimHal::celsius = XTAL_TURNOVER_C;
+uint32_t SimHal::temperature_samples = 0;
+int32_t SimHal::trim_ppb = 0;
+uint32_t SimHal::trims = 0;
+uint8_t SimHal::masked = 0;
+uint32_t SimHal::masked_sections = 0;
+uint32_t SimHal::sleeps = 0;
+uint32_t SimHal::sleeps_skipped = 0;
+
+typedef Metronome<SimHal> SimMetronome;
+
+// HAL of a lean board: the tempo in RAM only, the plain beat only
+struct LeanSimHal : SimHal {
+    static constexpr bool persistent = false;
+    static constexpr bool patterns = false;
+};
+typedef Metronome<LeanSimHal> LeanSimMetronome;
+
+// The firmwares' sleep rule: with interrupts masked, sleep only if no event is pending
+void SimHal::sleep() {
+    uint8_t state = irq_save();
+    if (SimMetronome::events_pending()) {
+        sleeps_skipped++;
+    } else {
+        sleeps++;
+    }
+    irq_restore(state);
+}
+
+// Press a button once and run one main loop iteration
+static void press(uint8_t button) {
+    SimMetronome::on_button(button);
+    SimMetronome::poll();
+}
+
+// The increase button must walk the whole table and clamp at BPM_MAX, the
+// decrease button must clamp at BPM_MIN, presses at a limit must not reprogram
+// the timer, and every beat must produce exactly one pulse and one watchdog reload
+// (button wakes must not reload the window watchdog); the whole run of presses must
+// be saved once, TEMPO_SAVE_BEATS beats after the last one
+static bool run_tempo_check() {
+    uint32_t steps_up = 0;
+    while (SimMetronome::bpm() < BPM_MAX) {
+        press(BUTTON_INC);
+        steps_up++;
+    }
+    uint32_t changes = SimHal::tempo_changes;
+    press(BUTTON_INC);
+    bool clamp_max = SimMetronome::bpm() == BPM_MAX && SimHal::tempo_changes == changes;
+    
+    while (SimMetronome::bpm() > BPM_MIN) {
+        press(BUTTON_DEC);
+    }
+    changes = SimHal::tempo_changes;
+    press(BUTTON_DEC);
+    bool clamp_min = SimMetronome::bpm() == BPM_MIN && SimHal::tempo_changes == changes;
+    
+    uint32_t saves_before_beats = SimHal::saves;
+    for (uint8_t i = 0; i < 10; i++) {
+        SimMetronome::on_beat(STEP_BEAT);
+        SimMetronome::poll();
+    }
+    SimMetronome::poll();  // No beat: no pulse
+    
+    bool ok = steps_up == (uint32_t)(BPM_MAX - BPM_DEFAULT) / BPM_STEP && clamp_max && clamp_min &&
+              SimHal::tempo == BPM_MIN && SimHal::pulses == 10 && SimHal::kicks == 10 &&
+              saves_before_beats == 0 && SimHal::saves == 1 && SimHal::saved_bpm == BPM_MIN &&
+              !SimMetronome::save_pending();
+    printf("\nTempo buttons: %u..%u, %lu tempo changes, %lu pulses and %lu watchdog reloads for 10 beats, %lu save%s\n",
+           BPM_MIN, BPM_MAX, (unsigned long)SimHal::tempo_changes, (unsigned long)SimHal::pulses,
+           (unsigned long)SimHal::kicks, (unsigned long)SimHal::saves, ok ? "" : "  FAIL");
+    return ok;
+}
+
+// Hold the increase button over the whole range: every repeat step must move the
+// tempo setting, but the HAL must only get the new tempo once, when the repeat ends,
+// and the save must follow TEMPO_SAVE_BEATS beats after that
+static bool run_repeat_check() {
+    uint16_t start = SimMetronome::bpm();
+    uint32_t changes = SimHal::tempo_changes;
+    uint32_t saves = SimHal::saves;
+    
+    press(BUTTON_INC);  // The press itself is a single step, applied at once
+    bool press_ok = SimHal::tempo_changes == changes + 1 && SimHal::tempo == tempo_step_up(start);
+    
+    uint32_t steps = 0;
+    while (SimMetronome::bpm() < BPM_MAX) {
+        SimMetronome::on_repeat(BUTTON_INC);
+        SimMetronome::poll();
+        SimMetronome::on_beat(STEP_BEAT);  // Beats go on at the old tempo while the button is held
+        SimMetronome::poll();
+        steps++;
+    }
+    bool held_ok = SimHal::tempo_changes == changes + 1 && SimHal::saves == saves;
+    
+    SimMetronome::on_repeat_end();
+    SimMetronome::poll();
+    bool release_ok = SimHal::tempo_changes == changes + 2 && SimHal::tempo == BPM_MAX;
+    
+    for (uint8_t i = 0; i < TEMPO_SAVE_BEATS; i++) {
+        SimMetronome::on_beat(STEP_BEAT);
+        SimMetronome::poll();
+    }
+    
+    bool ok = press_ok && held_ok && release_ok && SimHal::saves == saves + 1 &&
+              SimHal::saved_bpm == BPM_MAX;
+    printf("\nAuto-repeat: %u -> %u in %lu repeat steps, %lu tempo changes, %lu save%s\n",
+           start, SimMetronome::bpm(), (unsigned long)steps, (unsigned long)(SimHal::tempo_changes - changes),
+           (unsigned long)(SimHal::saves - saves), ok ? "" : "  FAIL");
+    return ok;
+}
+
+// Tap a tempo on one clock: TAP_COUNT taps with a repeating jitter pattern of up to
+// ±TAP_JITTER_PCT of the beat, returns the tempo after the last tap
+#define TAP_COUNT 8
+#define TAP_JITTER_PCT 6
+
+static uint16_t tap_run(const BpmPeriodTable* table, uint32_t ticks_per_minute, uint16_t bpm) {
+    static const int8_t jitter[] = { 0, 1, -1, 1, 0, -1, 1, -1 };  // In units of TAP_JITTER_PCT
+    TapTempo tap = {};
+    uint16_t tempo = 0;
+    
+    tap_next(&tap, table, 0);  // First tap: no interval
+    for (uint8_t i = 1; i < TAP_COUNT; i++) {
+        int32_t beat = (int32_t)(ticks_per_minute / bpm);
+        int32_t interval = beat + beat * jitter[i] * TAP_JITTER_PCT / 100;
+        tempo = tap_next(&tap, table, (uint16_t)interval);
+    }
+    return tempo;
+}
+
+// Every BPM step tapped with jitter must come out at that step on both clocks,
+// taps beyond the range must clamp, a pause longer than a beat at BPM_MIN must
+// start a new run, and the core must apply the tempo and realign the beat once
+// per estimate
+static bool run_tap_check() {
+    bool steps_ok = true;
+    for (uint16_t bpm = BPM_MIN; bpm <= BPM_MAX; bpm += BPM_STEP) {
+        steps_ok = steps_ok && tap_run(&bpm_table_1024hz, TICKS_PER_MINUTE_1024HZ, bpm) == bpm &&
+                   tap_run(&bpm_table_4096hz, TICKS_PER_MINUTE_4096HZ, bpm) == bpm;
+    }
+    
+    bool clamp_ok = tap_run(&bpm_table_4096hz, TICKS_PER_MINUTE_4096HZ, 240) == BPM_MAX &&
+                    tap_run(&bpm_table_4096hz, TICKS_PER_MINUTE_4096HZ, 33) == BPM_MIN;
+    
+    TapTempo tap = {};
+    tap_next(&tap, &bpm_table_4096hz, 0);
+    uint16_t first = tap_next(&tap, &bpm_table_4096hz, (uint16_t)(TICKS_PER_MINUTE_4096HZ / 100));
+    uint16_t pause = tap_next(&tap, &bpm_table_4096hz, tap_max_interval(&bpm_table_4096hz) + 1);
+    bool pause_ok = first == 100 && pause == 0 && tap.filtered == 0;
+    
+    uint32_t changes = SimHal::tempo_changes;
+    uint32_t aligns = SimHal::aligns;
+    SimMetronome::on_tap(120);
+    SimMetronome::poll();
+    bool core_ok = SimMetronome::bpm() == 120 && SimHal::tempo == 120 && SimHal::tempo_changes == changes + 1 &&
+                   SimHal::aligns == aligns + 1;
+    SimMetronome::on_tap(120);  // Same tempo: realign only
+    SimMetronome::poll();
+    core_ok = core_ok && SimHal::tempo_changes == changes + 1 && SimHal::aligns == aligns + 2;
+    
+    bool ok = steps_ok && clamp_ok && pause_ok && core_ok;
+    printf("\nTap tempo: %u taps with %u%% jitter, every step %s on both clocks, clamp %s, pause %s, core %s%s\n",
+           TAP_COUNT, TAP_JITTER_PCT, steps_ok ? "ok" : "wrong", clamp_ok ? "ok" : "wrong",
+           pause_ok ? "ok" : "wrong", core_ok ? "ok" : "wrong", ok ? "" : "  FAIL");
+    return ok;
+}
+
+// Play two bars of a pattern through the sequencer, as the firmware does: one
+// seq_beat() per beat and one seq_step() per sub-step; false if a step differs
+static bool seq_play_bars(Sequencer* seq, const SeqPattern* pattern) {
+    for (uint8_t bar = 0; bar < 2; bar++) {
+        for (uint8_t i = 0; i < pattern->length; i += pattern->subdiv) {
+            if (seq_beat(seq) != pattern->step[i]) {
+                return false;
+            }
+            for (uint8_t s = 1; s < pattern->subdiv; s++) {
+                if (!seq_steps_left(seq) || seq_step(seq) != pattern->step[i + s]) {
+                    return false;
+                }
+            }
+            if (seq_steps_left(seq) || seq_step(seq) != STEP_REST) {
+                return false;  // No sub-step past the last one of the beat
+            }
+        }
+    }
+    return true;
+}
+
+// Sub-steps must fit the beat and every pulse must end before the next step, at
+// every BPM step of one clock
+template <uint32_t TICKS_PER_MINUTE>
+static bool seq_tables_ok(const BpmPeriodTable* beats) {
+    static constexpr SubStepTable substeps = make_substep_table<TICKS_PER_MINUTE>();
+    static constexpr PulseWidthTable widths = make_pulse_width_table<TICKS_PER_MINUTE / 60>();
+    for (uint8_t s = 2; s <= SEQ_MAX_SUBDIV; s++) {
+        for (uint8_t i = 0; i < BPM_TABLE_SIZE; i++) {
+            uint16_t step = substeps.ticks[s - 2][i];
+            uint16_t last = beats->entry[i].ticks - (s - 1) * step;  // Last sub-step to the beat
+            if (last < step || last >= step + s || widths.ticks[STEP_ACCENT] >= step) {
+                return false;
+            }
+        }
+    }
+    return true;
+}
+
+// Every pattern must play its steps in order, bar after bar; a pattern change must
+// start the new pattern at the next beat; sub-steps missed before a beat must not
+// shift the bar; and the core must pulse each step with its kind (a rest with no
+// pulse, sub-steps without a watchdog reload) and step through the patterns when
+// both tempo buttons are pressed together, without changing the tempo
+static bool run_sequencer_check() {
+    bool play_ok = true;
+    for (uint8_t p = 0; p < SEQ_PATTERN_COUNT; p++) {
+        Sequencer seq = { &seq_patterns[p], nullptr, 0, 0 };
+        play_ok = play_ok && seq_play_bars(&seq, &seq_patterns[p]);
+    }
+    
+    // Change mid-bar, then miss the sub-steps of a beat
+    Sequencer seq = { &seq_patterns[1], nullptr, 0, 0 };
+    seq_beat(&seq);
+    seq_request(&seq, &seq_patterns[3]);
+    bool change_ok = seq_beat(&seq) == seq_patterns[3].step[0] && seq_steps_left(&seq);
+    seq_beat(&seq);  // Sub-step of the first beat missed
+    change_ok = change_ok && seq.step == 3 && seq_step(&seq) == seq_patterns[3].step[3];
+    
+    bool tables_ok = seq_tables_ok<TICKS_PER_MINUTE_1024HZ>(&bpm_table_1024hz) &&
+                     seq_tables_ok<TICKS_PER_MINUTE_4096HZ>(&bpm_table_4096hz);
+    
+    uint32_t pulses = SimHal::pulses;
+    uint32_t kicks = SimHal::kicks;
+    uint32_t accents = SimHal::kind_pulses[STEP_ACCENT];
+    uint32_t subs = SimHal::kind_pulses[STEP_SUB];
+    SimMetronome::on_beat(STEP_ACCENT);
+    SimMetronome::on_step(STEP_SUB);
+    SimMetronome::poll();
+    SimMetronome::on_beat(STEP_REST);
+    SimMetronome::poll();
+    SimMetronome::on_step(STEP_REST);
+    SimMetronome::poll();
+    bool core_ok = SimHal::pulses == pulses + 2 && SimHal::kicks == kicks + 2 &&
+                   SimHal::kind_pulses[STEP_ACCENT] == accents + 1 && SimHal::kind_pulses[STEP_SUB] == subs + 1;
+    
+    uint16_t bpm = SimMetronome::bpm();
+    uint32_t changes = SimHal::tempo_changes;
+    bool select_ok = true;
+    for (uint8_t i = 1; i <= SEQ_PATTERN_COUNT; i++) {
+        SimMetronome::on_button(BUTTON_INC);
+        SimMetronome::on_button(BUTTON_DEC);
+        SimMetronome::poll();
+        select_ok = select_ok && SimHal::pattern == (SEQ_DEFAULT_PATTERN + i) % SEQ_PATTERN_COUNT &&
+                    SimMetronome::pattern() == SimHal::pattern;
+    }
+    select_ok = select_ok && SimMetronome::bpm() == bpm && SimHal::tempo_changes == changes;
+    
+    bool ok = play_ok && change_ok && tables_ok && core_ok && select_ok;
+    printf("\nSequencer: %u patterns, play %s, change %s, tables %s, core %s, selection %s%s\n",
+           SEQ_PATTERN_COUNT, play_ok ? "ok" : "wrong", change_ok ? "ok" : "wrong", tables_ok ? "ok" : "wrong",
+           core_ok ? "ok" : "wrong", select_ok ? "ok" : "wrong", ok ? "" : "  FAIL");
+    return ok;
+}
+
+// On a lean board the core must still hand tempo steps to the HAL, but never
+// count towards a save or save, and both tempo buttons together must leave the
+// pattern and the tempo alone
+static bool run_lean_check() {
+    uint32_t saves = SimHal::saves;
+    uint32_t changes = SimHal::tempo_changes;
+    uint8_t pattern = SimHal::pattern;
+    
+    LeanSimMetronome::on_button(BUTTON_INC);
+    LeanSimMetronome::poll();
+    bool tempo_ok = LeanSimMetronome::bpm() == BPM_DEFAULT + BPM_STEP && SimHal::tempo_changes == changes + 1;
+    
+    for (uint8_t i = 0; i < 2 * TEMPO_SAVE_BEATS; i++) {
+        LeanSimMetronome::on_beat(STEP_BEAT);
+        LeanSimMetronome::poll();
+        tempo_ok = tempo_ok && !LeanSimMetronome::save_pending();
+    }
+    bool save_ok = SimHal::saves == saves;
+    
+    LeanSimMetronome::on_button(BUTTON_INC);
+    LeanSimMetronome::on_button(BUTTON_DEC);
+    LeanSimMetronome::poll();
+    bool pattern_ok = LeanSimMetronome::pattern() == SEQ_DEFAULT_PATTERN && SimHal::pattern == pattern &&
+                      LeanSimMetronome::bpm() == BPM_DEFAULT + BPM_STEP && SimHal::tempo_changes == changes + 1;
+    
+    bool ok = tempo_ok && save_ok && pattern_ok;
+    printf("\nLean board: tempo %s, no saves %s, no pattern selection %s%s\n", tempo_ok ? "ok" : "wrong",
+           save_ok ? "ok" : "wrong", pattern_ok ? "ok" : "wrong", ok ? "" : "  FAIL");
+    return ok;
+}
+
+// Run beats through the core at a supply voltage, returns the samples taken
+static uint32_t supply_beats(uint16_t mv, uint32_t beats) {
+    uint32_t samples = SimHal::samples;
+    SimHal::supply_mv = mv;
+    for (uint32_t i = 0; i < beats; i++) {
+        SimMetronome::on_beat(STEP_BEAT);
+        SimMetronome::poll();
+    }
+    return SimHal::samples - samples;
+}
+
+// The core must sample the supply once every BATTERY_SAMPLE_BEATS beats and never
+// on other wakes, the level must follow a discharge down to critical and only
+// recover with the hysteresis margin, and the readings of both ADCs must fit 16
+// bits down to the lowest STM32 supply
+static bool run_battery_check() {
+    // Line up with the sample schedule: the next beat samples
+    while (!SimMetronome::supply_due()) {
+        supply_beats(3000, 1);
+    }
+    bool schedule_ok = supply_beats(3000, 10 * BATTERY_SAMPLE_BEATS) == 10;
+    
+    uint32_t samples = SimHal::samples;
+    SimMetronome::on_step(STEP_SUB);
+    SimMetronome::poll();
+    press(BUTTON_TAP);
+    schedule_ok = schedule_ok && SimHal::samples == samples && SimMetronome::power_level() == BATTERY_OK;
+    
+    // Discharge: every level is entered at its threshold
+    uint32_t changes = SimHal::level_changes;
+    supply_beats(BATTERY_LOW_MV + 10, BATTERY_SAMPLE_BEATS);
+    bool level_ok = SimMetronome::power_level() == BATTERY_OK;
+    supply_beats(BATTERY_LOW_MV - 10, BATTERY_SAMPLE_BEATS);
+    level_ok = level_ok && SimHal::level == BATTERY_LOW;
+    supply_beats(BATTERY_CRITICAL_MV - 10, BATTERY_SAMPLE_BEATS);
+    level_ok = level_ok && SimHal::level == BATTERY_CRITICAL;
+    
+    // Recovery (e.g. the cell relaxes): only past the hysteresis margin
+    supply_beats(BATTERY_CRITICAL_MV + BATTERY_HYST_MV / 2, BATTERY_SAMPLE_BEATS);
+    bool hyst_ok = SimHal::level == BATTERY_CRITICAL;
+    supply_beats(BATTERY_CRITICAL_MV + BATTERY_HYST_MV + 10, BATTERY_SAMPLE_BEATS);
+    hyst_ok = hyst_ok && SimHal::level == BATTERY_LOW;
+    supply_beats(3000, BATTERY_SAMPLE_BEATS);
+    hyst_ok = hyst_ok && SimHal::level == BATTERY_OK && SimHal::level_changes == changes + 4;
+    
+    // A fresh cell straight to critical in one sample, then back
+    supply_beats(2000, BATTERY_SAMPLE_BEATS);
+    level_ok = level_ok && SimHal::level == BATTERY_CRITICAL && SimHal::level_changes == changes + 5;
+    supply_beats(3000, BATTERY_SAMPLE_BEATS);
+    
+    const uint32_t stm32_scale = 3000UL * 1700;  // Typical VREFINT_CAL ~1650-1700
+    bool scale_ok = battery_reading(stm32_scale, 1650) < 0xFFFF && battery_reading(SIM_SUPPLY_SCALE, 1800) < 0xFFFF &&
+                    battery_mv(SIM_SUPPLY_SCALE, battery_reading(SIM_SUPPLY_SCALE, 2500)) / 10 == 250;
+    
+    bool ok = schedule_ok && level_ok && hyst_ok && scale_ok && SimHal::level == BATTERY_OK;
+    printf("\nSupply monitor: 1 sample per %u beats %s, levels %s, hysteresis %s, scales %s%s\n", BATTERY_SAMPLE_BEATS,
+           schedule_ok ? "ok" : "wrong", level_ok ? "ok" : "wrong", hyst_ok ? "ok" : "wrong", scale_ok ? "ok" : "wrong",
+           ok ? "" : "  FAIL");
+    return ok;
+}
+
+// Beat timing error in ppm over a day of beats on the 1024Hz RTC with a crystal
+// that is ppb slow (positive) or fast, with the tick-skip correction for it
+static double drift_residual_ppm(uint16_t bpm, int32_t ppb) {
+    DriftState drift = {};
+    drift_set(&drift, ppb);
+    BeatState beats;
+    beat_init(&beats, &bpm_table_1024hz.entry[bpm_index(bpm)]);
+    
+    const uint32_t count = (uint32_t)bpm * 60 * 24;
+    double ticks = 0;
+    for (uint32_t i = 0; i < count; i++) {
+        uint16_t length = beat_next(&beats);
+        ticks += length + drift_next(&drift, length);
+    }
+    
+    // Real time of the ticks counted by the crystal, versus the ideal beats
+    double seconds = ticks / 1024.0 / (1.0 - ppb * 1e-9);
+    double ideal = count * 60.0 / bpm;
+    return (seconds - ideal) / ideal * 1e6;
+}
+
+// The core must take the temperature every XTAL_TEMP_SAMPLES supply samples and
+// hand a changed correction to the HAL, the correction must follow the crystal
+// parabola, and the ATtiny tick-skip must cancel the crystal offset over a day at
+// every tempo, within 0.5 ppm
+static bool run_xtal_check() {
+    uint32_t samples = SimHal::temperature_samples;
+    uint32_t trims = SimHal::trims;
+    SimHal::celsius = -10;
+    while (!SimMetronome::supply_due()) {
+        supply_beats(3000, 1);
+    }
+    supply_beats(3000, XTAL_TEMP_SAMPLES * BATTERY_SAMPLE_BEATS * 4);
+    bool schedule_ok = SimHal::temperature_samples - samples >= 4 && SimHal::temperature_samples - samples <= 5 &&
+                       SimHal::trims == trims + 1 && SimHal::trim_ppb == xtal_correction_ppb(-10);
+    SimHal::celsius = XTAL_TURNOVER_C;
+    supply_beats(3000, XTAL_TEMP_SAMPLES * BATTERY_SAMPLE_BEATS);
+    schedule_ok = schedule_ok && SimMetronome::xtal_trim() == xtal_correction_ppb(XTAL_TURNOVER_C);
+    
+    bool curve_ok = xtal_correction_ppb(XTAL_TURNOVER_C) == -XTAL_OFFSET_PPB &&
+                    xtal_correction_ppb(XTAL_TURNOVER_C - 10) == xtal_correction_ppb(XTAL_TURNOVER_C + 10) &&
+                    xtal_correction_ppb(-10) + XTAL_OFFSET_PPB == 35 * 35 * XTAL_PARABOLIC_PPB &&
+                    xtal_correction_ppb(-100) == xtal_correction_ppb(XTAL_TEMP_MIN);
+    
+    double worst = 0;
+    static const int32_t offsets_ppb[] = { 5000, 41650, 140000, -20000 };
+    for (uint16_t bpm = BPM_MIN; bpm <= BPM_MAX; bpm += BPM_STEP) {
+        for (int32_t ppb : offsets_ppb) {
+            double residual = drift_residual_ppm(bpm, ppb);
+            if (residual < 0) {
+                residual = -residual;
+            }
+            if (residual > worst) {
+                worst = residual;
+            }
+        }
+    }
+    bool skip_ok = worst < 0.5;
+    
+    bool ok = schedule_ok && curve_ok && skip_ok;
+    printf("\nCrystal compensation: temperature every %u beats %s, curve %s, tick-skip residual %.3f ppm%s\n",
+           XTAL_TEMP_SAMPLES * BATTERY_SAMPLE_BEATS, schedule_ok ? "ok" : "wrong", curve_ok ? "ok" : "wrong", worst,
+           ok ? "" : "  FAIL");
+    return ok;
+}
+
+// ATtiny beat interrupt with -DUSE_EVENT_PULSE (attiny/main.cpp): the beats of a
+// quiet run are only counted, the beat after the run hands the count to the core.
+// A tap (or any other change that needs the CPU) every resume_every beats ends
+// the run early. Returns the beats that reached the main loop.
+static uint32_t event_pulse_beats(uint32_t beats, uint32_t resume_every) {
+    static uint8_t quiet_left = 0;
+    static uint8_t quiet_beats = 0;
+    uint32_t wakes = 0;
+    for (uint32_t i = 0; i < beats; i++) {
+        if (resume_every && i % resume_every == 0) {
+            quiet_left = 0;
+        }
+        if (quiet_left) {
+            quiet_left--;
+            quiet_beats++;
+            continue;
+        }
+        uint8_t skipped = quiet_beats;
+        quiet_beats = 0;
+        if (!skipped && !SimMetronome::supply_due()) {
+            quiet_left = SimMetronome::supply_quiet_beats();
+        }
+        SimMetronome::on_beat(STEP_BEAT, skipped);
+        SimMetronome::poll();
+        wakes++;
+    }
+    return wakes;
+}
+
+// With the pulse in hardware the beats between two supply samples skip the main
+// loop, and the core must still sample the supply every BATTERY_SAMPLE_BEATS beats
+// and take the temperature every XTAL_TEMP_SAMPLES samples, with a run ended early
+// as well as with whole runs
+static bool run_event_pulse_check() {
+    SimHal::supply_mv = 3000;
+    while (!SimMetronome::supply_due()) {
+        supply_beats(3000, 1);
+    }
+    uint32_t samples = SimHal::samples;
+    uint32_t temperatures = SimHal::temperature_samples;
+    uint32_t wakes = event_pulse_beats(XTAL_TEMP_SAMPLES * BATTERY_SAMPLE_BEATS * 4, 0);
+    bool supply_ok = SimHal::samples - samples == XTAL_TEMP_SAMPLES * 4;
+    bool xtal_ok = SimHal::temperature_samples - temperatures == 4;
+    bool wakes_ok = wakes == XTAL_TEMP_SAMPLES * 4 * 2;  // The sample and the beat that starts the run
+    
+    // Runs cut short: the sample schedule must not move
+    samples = SimHal::samples;
+    temperatures = SimHal::temperature_samples;
+    event_pulse_beats(XTAL_TEMP_SAMPLES * BATTERY_SAMPLE_BEATS * 4, 37);
+    supply_ok = supply_ok && SimHal::samples - samples == XTAL_TEMP_SAMPLES * 4;
+    event_pulse_beats(1, 0);  // Sample beat of the schedule lined up above
+    supply_ok = supply_ok && SimHal::samples - samples == XTAL_TEMP_SAMPLES * 4 + 1;
+    xtal_ok = xtal_ok && SimHal::temperature_samples - temperatures == 4;
+    
+    // Two beats that coalesce into one event: their skipped counts add up, so
+    // the next sample still comes BATTERY_SAMPLE_BEATS beats after the last one
+    samples = SimHal::samples;
+    SimMetronome::on_beat(STEP_BEAT, BATTERY_SAMPLE_BEATS / 2);
+    SimMetronome::on_beat(STEP_BEAT, BATTERY_SAMPLE_BEATS / 2 - 1);
+    SimMetronome::poll();
+    bool coalesce_ok = SimHal::samples - samples == 1;
+    
+    bool ok = supply_ok && xtal_ok && wakes_ok && coalesce_ok;
+    printf("\nEvent pulse: 2 of %u beats wake the main loop %s, supply %s, temperature %s, coalesced beats %s%s\n",
+           BATTERY_SAMPLE_BEATS, wakes_ok ? "ok" : "wrong", supply_ok ? "ok" : "wrong", xtal_ok ? "ok" : "wrong",
+           coalesce_ok ? "ok" : "wrong", ok ? "" : "  FAIL");
+    return ok;
+}
+
+// Every event raised after the last poll must keep the next sleep from being
+// entered and be handled by the next poll, each raise and each poll must touch the
+// event word in one masked section, and a poll must leave nothing pending
+static bool run_event_check() {
+    uint16_t start = SimMetronome::bpm();
+    uint32_t sleeps = SimHal::sleeps;
+    uint32_t skipped = SimHal::sleeps_skipped;
+    SimMetronome::poll();
+    SimHal::sleep();
+    bool idle_ok = SimHal::sleeps == sleeps + 1 && SimHal::sleeps_skipped == skipped;
+    
+    // A press right after the poll, before the sleep: the sleep is skipped and the
+    // next poll takes it (no beat later)
+    uint32_t sections = SimHal::masked_sections;
+    SimMetronome::on_button(start < BPM_MAX ? BUTTON_INC : BUTTON_DEC);
+    SimHal::sleep();
+    SimMetronome::poll();
+    bool race_ok = SimHal::sleeps_skipped == skipped + 1 && SimMetronome::bpm() != start &&
+                   !SimMetronome::events_pending();
+    
+    // Every interrupt handler event must wake the core this way
+    uint32_t skipped_before = SimHal::sleeps_skipped;
+    SimMetronome::on_beat(STEP_BEAT);
+    SimHal::sleep();
+    SimMetronome::on_step(STEP_SUB);
+    SimHal::sleep();
+    SimMetronome::on_tap(SimMetronome::bpm());
+    SimHal::sleep();
+    SimMetronome::on_repeat_end();
+    SimHal::sleep();
+    SimMetronome::poll();
+    bool all_ok = SimHal::sleeps_skipped == skipped_before + 4 && !SimMetronome::events_pending();
+    
+    // One masked section per raise, sleep and take: the press, its sleep and poll,
+    // then 4 raises, 4 sleeps and 1 poll
+    bool atomic_ok = SimHal::masked_sections - sections == 3 + 9 && SimHal::masked == 0;
+    SimHal::sleep();
+    all_ok = all_ok && SimHal::sleeps == sleeps + 2;
+    
+    // Back to the tempo the check started from
+    press(start < BPM_MAX ? BUTTON_DEC : BUTTON_INC);
+    for (uint32_t i = 0; i < TEMPO_SAVE_BEATS; i++) {
+        SimMetronome::on_beat(STEP_BEAT);
+        SimMetronome::poll();
+    }
+    
+    bool ok = idle_ok && race_ok && all_ok && atomic_ok && SimMetronome::bpm() == start;
+    printf("\nEvent word: sleep %s, event before sleep handled %s, all handler events %s, masked sections %s%s\n",
+           idle_ok ? "ok" : "wrong", race_ok ? "ok" : "wrong", all_ok ? "ok" : "wrong", atomic_ok ? "ok" : "wrong",
+           ok ? "" : "  FAIL");
+    return ok;
+}
+
+// Values of the simulated serial replies
+struct SimSerialSource {
+    static WakeLog log;
+    
+    static void status(SerialStatus* status) {
+        status->bpm = SimMetronome::bpm();
+        status->pattern = 2;
+        status->level = BATTERY_LOW;
+        status->mv = 3000;
+        status->ppb = -1500;
+        status->wakes = 4294967295UL;
+        status->beats = 0;
+    }
+    static const WakeLog* wake_log() {
+        return &log;
+    }
+    static uint8_t irq_save() {
+        return SimHal::irq_save();
+    }
+    static void irq_restore(uint8_t state) {
+        SimHal::irq_restore(state);
+    }
+};
+
+WakeLog SimSerialSource::log = {};
+
+// Feed a command line, returns the SerialCommand of its last byte
+static uint8_t serial_feed(SerialLink* link, const char* text) {
+    uint8_t command = SERIAL_CMD_NONE;
+    while (*text) {
+        command = serial_rx_byte(link, (uint8_t)*text++);
+    }
+    return command;
+}
+
+// Format and drain everything the link has to send into out (the firmwares fill
+// before each sleep, the transmit interrupt drains)
+static void serial_drain(SerialLink* link, char* out, size_t size) {
+    size_t length = 0;
+    do {
+        serial_fill<SimSerialSource>(link);
+        uint8_t c;
+        while (serial_tx_byte(link, &c)) {
+            if (length + 1 < size) {
+                out[length++] = (char)c;
+            }
+        }
+    } while (serial_fill_pending(link));
+    out[length] = '\0';
+}
+
+// Commands must be parsed and clamped, unknown and long lines answered with E, the
+// replies formatted in order with the beat stamp first, a wake log dumped oldest
+// first, and a tempo command must reach the core like a button step
+static bool run_serial_check() {
+    SerialLink link;
+    serial_init(&link);
+    char out[2048];
+    
+    bool parse_ok = serial_feed(&link, "B120\n") == SERIAL_CMD_TEMPO && serial_tempo(&link) == 120;
+    parse_ok = parse_ok && serial_feed(&link, "B123\r\n") == SERIAL_CMD_TEMPO && serial_tempo(&link) == 125;
+    parse_ok = parse_ok && serial_feed(&link, "B12\n") == SERIAL_CMD_TEMPO && serial_tempo(&link) == BPM_MIN;
+    parse_ok = parse_ok && serial_feed(&link, "B99999\n") == SERIAL_CMD_TEMPO && serial_tempo(&link) == BPM_MAX;
+    parse_ok = parse_ok && serial_feed(&link, "B120\n") == SERIAL_CMD_TEMPO;
+    parse_ok = parse_ok && serial_feed(&link, "\n") == SERIAL_CMD_NONE;
+    parse_ok = parse_ok && serial_feed(&link, "B\n") == SERIAL_CMD_ERROR;
+    parse_ok = parse_ok && serial_feed(&link, "B1x\n") == SERIAL_CMD_ERROR;
+    parse_ok = parse_ok && serial_feed(&link, "S\n") == SERIAL_CMD_STATUS;
+    parse_ok = parse_ok && serial_feed(&link, "BBBBBBBBBBBBBBBB\n") == SERIAL_CMD_ERROR;
+    parse_ok = parse_ok && serial_feed(&link, "T1\n") == SERIAL_CMD_STREAM && link.streaming;
+    
+    // Replies: the stamp first, then one of each requested reply
+    serial_beat(&link, 1000);
+    serial_drain(&link, out, sizeof(out));
+    char expected[64];
+    snprintf(expected, sizeof(expected), "T 0 0\nE\nB 120\nS %u 2 1 3000 -1500 4294967295 0\n", SimMetronome::bpm());
+    bool reply_ok = strcmp(out, expected) == 0;
+    
+    // Stream: stamps count from the first beat, a stamp that was not formatted yet
+    // is replaced by the next one
+    serial_beat(&link, 614);
+    serial_drain(&link, out, sizeof(out));
+    bool stream_ok = strcmp(out, "T 1 614\n") == 0;
+    serial_beat(&link, 615);
+    serial_beat(&link, 614);
+    serial_drain(&link, out, sizeof(out));
+    stream_ok = stream_ok && strcmp(out, "T 3 1843\n") == 0;
+    serial_feed(&link, "T0\n");
+    serial_beat(&link, 614);
+    serial_drain(&link, out, sizeof(out));
+    stream_ok = stream_ok && out[0] == '\0' && !serial_work_pending(&link);
+    
+    // Wake log dump (the L command itself needs -DENABLE_INSTRUMENTATION): the
+    // records written, oldest first, through several drains of the ring
+    const uint8_t records = WAKE_LOG_SIZE + 5;
+    for (uint8_t i = 0; i < records; i++) {
+        wake_log_push(&SimSerialSource::log, WAKE_BEAT, 1000 + i, -(int16_t)i);
+    }
+    link.requests |= SERIAL_REPLY_LOG;
+    serial_drain(&link, out, sizeof(out));
+    uint32_t lines = 0;
+    for (const char* c = out; *c; c++) {
+        lines += *c == '\n';
+    }
+    bool log_ok = lines == WAKE_LOG_SIZE && strncmp(out, "L 1 1005 -5\n", 12) == 0;
+    
+    // A tempo command sets the core's tempo and keeps it from sleeping until then
+    uint16_t start = SimMetronome::bpm();
+    uint8_t target = start == 120 ? 125 : 120;
+    char command[8];
+    snprintf(command, sizeof(command), "B%u\n", target);
+    bool core_ok = serial_feed(&link, command) == SERIAL_CMD_TEMPO;
+    SimMetronome::on_remote_tempo(serial_tempo(&link));
+    uint32_t skipped = SimHal::sleeps_skipped;
+    SimHal::sleep();
+    SimMetronome::poll();
+    core_ok = core_ok && SimHal::sleeps_skipped == skipped + 1 && SimMetronome::bpm() == target &&
+              SimHal::tempo == target;
+    
+    // Back to the tempo the check started from
+    SimMetronome::on_remote_tempo((uint8_t)start);
+    SimMetronome::poll();
+    for (uint32_t i = 0; i < TEMPO_SAVE_BEATS; i++) {
+        SimMetronome::on_beat(STEP_BEAT);
+        SimMetronome::poll();
+    }
+    
+    bool ok = parse_ok && reply_ok && stream_ok && log_ok && core_ok && SimMetronome::bpm() == start &&
+              SimHal::masked == 0;
+    printf("\nSerial link: commands %s, replies %s, beat stream %s, wake log %s, tempo to the core %s%s\n",
+           parse_ok ? "ok" : "wrong", reply_ok ? "ok" : "wrong", stream_ok ? "ok" : "wrong",
+           log_ok ? "ok" : "wrong", core_ok ? "ok" : "wrong", ok ? "" : "  FAIL");
+    return ok;
+}
+
+// Beat sync run: the leader plays SYNC_RUN_BEATS beats, with sub-steps from
+// SYNC_SUBSTEP_BEAT on, and moves its phase by a third of a beat at SYNC_MOVE_BEAT
+#define SYNC_RUN_BEATS 320
+#define SYNC_MOVE_BEAT 64
+#define SYNC_SUBSTEP_BEAT 128
+#define SYNC_SUBDIV 4
+
+struct SyncClock {
+    uint32_t ticks_per_minute;
+    const BpmPeriodTable* table;
+    const SubStepTable* substeps;
+    uint16_t window;  // sync_window_ticks() at the clock rate
+    uint16_t guard;   // Ticks the firmware needs to move the end of a beat
+};
+
+static constexpr SubStepTable sync_substeps_1024hz = make_substep_table<TICKS_PER_MINUTE_1024HZ>();
+static constexpr SubStepTable sync_substeps_4096hz = make_substep_table<TICKS_PER_MINUTE_4096HZ>();
+
+static const SyncClock sync_clocks[] = {
+    { TICKS_PER_MINUTE_1024HZ, &bpm_table_1024hz, &sync_substeps_1024hz, sync_window_ticks<1024>(), 2 },
+    { TICKS_PER_MINUTE_4096HZ, &bpm_table_4096hz, &sync_substeps_4096hz, sync_window_ticks<4096>(), 8 },
+};
+
+// Follower with a crystal follower_ppm fast behind a leader leader_ppm fast, same
+// tempo, starting half a beat apart. Every edge of the leader's output is fed to
+// sync_edge() at the follower's tick it falls in. Returns the worst distance in µs
+// from a follower beat edge to the nearest leader beat, once locked: from beat 32
+// on, except for the beats after the phase move until SYNC_LOST_EDGES + 8 beats
+static double sync_run(const SyncClock* clock, uint16_t bpm, double leader_ppm, double follower_ppm) {
+    static double beats[SYNC_RUN_BEATS + 1];
+    static double edges[SYNC_RUN_BEATS * SYNC_SUBDIV];
+    uint8_t index = bpm_index(bpm);
+    double hz = clock->ticks_per_minute / 60.0;
+    double beat_s = 60.0 / bpm;
+    
+    // Leader edges on its own crystal
+    BeatState lead;
+    beat_init(&lead, &clock->table->entry[index]);
+    double lead_hz = hz * (1 + leader_ppm * 1e-6);
+    uint16_t sub = clock->substeps->ticks[SYNC_SUBDIV - 2][index];
+    uint64_t tick = 0;
+    uint32_t count = 0;
+    for (uint32_t b = 0; b <= SYNC_RUN_BEATS; b++) {
+        double shift = b >= SYNC_MOVE_BEAT ? beat_s / 3 : 0;
+        beats[b] = tick / lead_hz + shift;
+        uint8_t steps = b >= SYNC_SUBSTEP_BEAT ? SYNC_SUBDIV : 1;
+        for (uint8_t j = 0; j < steps && b < SYNC_RUN_BEATS; j++) {
+            edges[count++] = (tick + j * sub) / lead_hz + shift;
+        }
+        tick += beat_next(&lead);
+    }
+    
+    // Follower: beat edges on its own crystal, starting half a beat late
+    BeatState own;
+    beat_init(&own, &clock->table->entry[index]);
+    BeatSync sync;
+    sync_init(&sync);
+    double own_hz = hz * (1 + follower_ppm * 1e-6);
+    double origin = beat_s / 2 + 0.3 / hz;
+    uint64_t start = 0;
+    uint64_t end = beat_next(&own);
+    uint32_t e = 0;
+    uint32_t p = 0;
+    double worst = 0;
+    while (e < count) {
+        double edge = origin + end / own_hz;
+        if (edge <= edges[e]) {
+            // Follower beat edge, against the nearest leader beat
+            while (p + 1 < SYNC_RUN_BEATS && beats[p + 1] <= edge) {
+                p++;
+            }
+            double error = edge - beats[p];
+            if (p + 1 <= SYNC_RUN_BEATS && beats[p + 1] - edge < error) {
+                error = beats[p + 1] - edge;
+            }
+            bool settled = p >= 32 && (p + 1 < SYNC_MOVE_BEAT || p >= SYNC_MOVE_BEAT + SYNC_LOST_EDGES + 8);
+            if (settled && error * 1e6 > worst) {
+                worst = error * 1e6;
+            }
+            start = end;
+            end = start + beat_next(&own) + sync_next(&sync);
+            continue;
+        }
+        
+        // Leader edge: position in the follower's beat in progress
+        double since = (edges[e] - origin) * own_hz;
+        uint64_t now = since > 0 ? (uint64_t)since : 0;
+        int16_t ticks;
+        if (since >= start && sync_edge(&sync, (uint16_t)(now - start), (uint16_t)(end - start), clock->window,
+                                        clock->guard, &ticks)) {
+            end += ticks;
+        }
+        e++;
+    }
+    return worst;
+}
+
+// A follower must stay within 1ms of the leader's beats at every tempo on both RTC
+// clocks, with the crystals up to 100 ppm apart either way, while the leader plays
+// sub-steps, and after the leader moved its phase
+static bool run_sync_check() {
+    static const double offsets_ppm[][2] = { { 20, -20 }, { -20, 20 }, { 0, 0 }, { 60, -40 }, { -50, 50 } };
+    bool ok = true;
+    for (const SyncClock& clock : sync_clocks) {
+        double worst = 0;
+        for (uint16_t bpm = BPM_MIN; bpm <= BPM_MAX; bpm += BPM_STEP) {
+            for (const auto& offset : offsets_ppm) {
+                double error = sync_run(&clock, bpm, offset[0], offset[1]);
+                if (error > worst) {
+                    worst = error;
+                }
+            }
+        }
+        // Within 1ms, or two ticks of a clock too coarse for that
+        double tick_us = 60e6 / clock.ticks_per_minute;
+        double limit = 2.1 * tick_us > 1000 ? 2.1 * tick_us : 1000;
+        bool clock_ok = worst < limit;
+        printf("\nBeat sync (%lu Hz): worst follower beat %.0f us from the leader's (limit %.0f us)%s",
+               (unsigned long)(clock.ticks_per_minute / 60), worst, limit, clock_ok ? "" : "  FAIL");
+        ok = ok && clock_ok;
+    }
+    printf("\n");
+    return ok;
+}
+
+// Stack paint (common/instrumentation.h): the painted bytes must be counted from
+// the bottom of the stack area up to the deepest byte written, and a scan must be
+// due once every STACK_CHECK_BEATS beats whatever the other wakes
+static bool run_stack_check() {
+    uint8_t area[256];
+    memset(area, STACK_PAINT, sizeof(area));
+    bool count_ok = stack_unused(area, sizeof(area)) == sizeof(area);
+    memset(area + 200, 0, sizeof(area) - 200);  // Frames in use
+    area[150] = 0;                              // Deepest byte written, the ones above it were skipped
+    count_ok = count_ok && stack_unused(area, sizeof(area)) == 150;
+    
+    WakeLog log = {};
+    uint32_t checked = 0;
+    uint32_t scans = 0;
+    for (uint32_t beat = 0; beat < STACK_CHECK_BEATS * 10; beat++) {
+        wake_log_push(&log, WAKE_BEAT | WAKE_STEP, 0, 0);
+        for (uint32_t i = 0; i < beat % 3; i++) {
+            wake_log_push(&log, WAKE_BUTTON, 0, 0);
+        }
+        if (stack_check_due(&log, checked)) {
+            checked = log.beats;
+            scans++;
+        }
+    }
+    bool due_ok = scans == 10;
+    
+    bool ok = count_ok && due_ok;
+    printf("\nStack paint: high-water count %s, %lu scans in %u beats%s\n", count_ok ? "ok" : "wrong",
+           (unsigned long)scans, STACK_CHECK_BEATS * 10, ok ? "" : "  FAIL");
+    return ok;
+}
+
+// Save through the store into an in-memory ring, counting the writes per slot
+static void store_save(TempoStore* store, TempoRecord* ring, uint16_t bpm, uint32_t* writes) {
+    TempoRecord rec;
+    uint8_t slot;
+    if (tempo_store_next(store, bpm, &rec, &slot)) {
+        ring[slot] = rec;
+        writes[slot]++;
+    }
+}
+
+// An erased ring (either erase value) must restore BPM_DEFAULT, every save must be
+// restored across many wraps of the ring with the writes spread evenly over the
+// slots, a repeated tempo must not be written, and a write cut short must fall
+// back to the previous record
+static bool run_tempo_store_check() {
+    TempoRecord ring[TEMPO_STORE_SLOTS];
+    uint32_t writes[TEMPO_STORE_SLOTS] = {};
+    TempoStore store;
+    
+    memset(ring, 0xFF, sizeof(ring));  // ATtiny EEPROM
+    bool erased_ok = tempo_store_restore(&store, ring) == BPM_DEFAULT;
+    memset(ring, 0x00, sizeof(ring));  // STM32 data EEPROM
+    erased_ok = erased_ok && tempo_store_restore(&store, ring) == BPM_DEFAULT;
+    
+    const uint32_t saves = 1000;
+    bool restore_ok = true;
+    for (uint32_t i = 0; i < saves; i++) {
+        uint16_t bpm = BPM_MIN + (uint16_t)((i * 7) % BPM_TABLE_SIZE) * BPM_STEP;
+        store_save(&store, ring, bpm, writes);
+        
+        // Reboot after every save: the new store must continue the same ring
+        restore_ok = restore_ok && tempo_store_restore(&store, ring) == bpm;
+    }
+    
+    uint32_t min_writes = writes[0];
+    uint32_t max_writes = writes[0];
+    uint32_t total = 0;
+    for (uint8_t i = 0; i < TEMPO_STORE_SLOTS; i++) {
+        min_writes = writes[i] < min_writes ? writes[i] : min_writes;
+        max_writes = writes[i] > max_writes ? writes[i] : max_writes;
+        total += writes[i];
+    }
+    
+    // Saving the stored tempo again must not write
+    uint16_t last = tempo_store_restore(&store, ring);
+    uint8_t next_slot = store.next_slot;
+    store_save(&store, ring, last, writes);
+    bool coalesce_ok = total == saves && store.next_slot == next_slot;
+    
+    // Cut the next write short: only the seq byte reaches the slot
+    uint8_t slot = store.next_slot;
+    store_save(&store, ring, last == BPM_MIN ? BPM_MAX : BPM_MIN, writes);
+    ring[slot].bpm = 0xFF;
+    ring[slot].check = 0xFF;
+    bool torn_ok = tempo_store_restore(&store, ring) == last && store.next_slot == slot;
+    
+    bool ok = erased_ok && restore_ok && coalesce_ok && torn_ok && max_writes - min_writes <= 1;
+    printf("\nTempo store: %lu saves over %u slots, %lu-%lu writes per slot, erased %s, torn write %s%s\n",
+           (unsigned long)saves, TEMPO_STORE_SLOTS, (unsigned long)min_writes, (unsigned long)max_writes,
+           erased_ok ? "ok" : "wrong", torn_ok ? "ok" : "wrong", ok ? "" : "  FAIL");
+    return ok;
+}
+
+int main(int argc, char** argv) {
+    uint32_t hours = SIM_HOURS_DEFAULT;
+    if (argc > 1) {
+        hours = (uint32_t)strtoul(argv[1], nullptr, 10);
+        if (hours == 0) {
+            hours = SIM_HOURS_DEFAULT;
+        }
+    }
+    
+    SimMetronome::supply_init(SIM_SUPPLY_SCALE);
+    
+    bool ok = true;
+    for (const TargetModel& target : targets) {
+        ok = run_beat_sweep(&target, hours) && ok;
+    }
+    
+    printf("\nDebounce (%lu ms settle time)\n", (unsigned long)(DEBOUNCE_DELAY_US / 1000));
+    for (const DebounceScenario& scenario : scenarios) {
+        ok = run_debounce_scenario(&scenario) && ok;
+    }
+    
+    ok = run_tempo_check() && ok;
+    ok = run_repeat_check() && ok;
+    ok = run_tap_check() && ok;
+    ok = run_sequencer_check() && ok;
+    ok = run_lean_check() && ok;
+    ok = run_battery_check() && ok;
+    ok = run_xtal_check() && ok;
+    ok = run_event_pulse_check() && ok;
+    ok = run_event_check() && ok;
+    ok = run_serial_check() && ok;
+    ok = run_sync_check() && ok;
+    ok = run_stack_check() && ok;
+    ok = run_tempo_store_check() && ok;
+    
+    printf("\n%s\n", ok ? "PASS" : "FAIL");
+    return ok ? 0 : 1;
+}
@@ -3,23 +3,102 @@
  * 
  * Features:
  * - Activates a pin at adjustable BPM rate (40-155 BPM) for 50ms
- * - Button controls: PC13=Increase BPM, PB0=Decrease BPM (±5 BPM steps)
+ * - Button controls: PC13=Increase BPM, PB0=Decrease BPM (±5 BPM steps, auto-repeat when held),
+ *   PB1=Tap tempo
  * - Low power stop mode between activations
  * - RTC for wake-up timing (dynamically reconfigured) with external 32.768kHz crystal
- * - 3 button inputs with EXTI interrupt and proper 50ms blocking debounce
- * - Independent Watchdog (IWDG) for system reliability, runs in Stop mode without extra power
+ * - 3 button inputs with EXTI interrupt and timer-based 50ms debounce
+ * - Independent Watchdog (IWDG) in window mode, sized to the tempo and reloaded once per beat
+ * - Beat pattern sequencer: accents, rests and up to 4 sub-steps per beat, each
+ *   step with its own pulse width (PC13+PB0 pressed together selects the pattern)
+ * - Supply monitor: VDDA sampled every 64 beats, pulse widths shortened on a low battery
+ * - Crystal temperature compensation with RTC smooth calibration, every 256 beats
+ * - Serial link on LPUART1 (-DENABLE_SERIAL): set the tempo, read the status and
+ *   wake log, stream the beat edges
+ * - Beat sync (-DENABLE_SYNC): follow the beat of a leader wired to PB4
+ * 
+ * Beat Scheduling: Each beat is an absolute RTC timestamp (seconds + sub-seconds at
+ * 4096Hz). RTC Alarm A is programmed to fire exactly on it, so the MCU wakes once
+ * per beat, and the fractional part of the period is carried from beat to beat so
+ * the long-run rate is exact to crystal accuracy. Build with -DUSE_RTC_WAKEUP_TIMER
+ * to use the wake-up timer instead: clocked from RTCCLK / 16 (2048Hz), it is
+ * restarted at every wake for the time left to the next timestamp, so it also
+ * wakes once per beat, within 0.5ms of the same timestamps.
  * 
  * Hardware Requirements:
  * - External 32.768kHz crystal connected to OSC32_IN/OSC32_OUT (PC14/PC15) for precise timing
  * - Crystal provides ±20 ppm typical accuracy vs ±5% for internal LSI oscillator
  * 
- * Debouncing: Uses blocking delay approach - stays awake for 50ms after button press
- * to properly debounce. Since button presses are infrequent (1-10 every few minutes),
- * this has minimal impact on average power consumption.
+ * Debouncing: Event-driven state machine per button. A pin edge arms RTC Alarm B
+ * 50ms ahead and the MCU goes back to Stop mode; the button state is only sampled
+ * when the alarm fires. Beats keep firing on time while a button is held. A held
+ * PC13/PB0 auto-repeats at an accelerating rate, timed by Alarm B as well: the MCU
+ * only wakes for the steps, and the new tempo is applied once, on release.
+ * 
+ * 50ms Output Pulse: The high time is timed by LPTIM1 clocked from LSE. The pin is
+ * raised, LPTIM1 is started in single-shot mode and the core goes straight back to
+ * Stop mode; the LPTIM1 autoreload match interrupt drives the pin low again.
+ * Build with -DUSE_BLOCKING_PULSE to use the original blocking delay instead.
+ * 
+ * Sequencer: The pattern (common/sequencer.h) is played on the beat timer. Alarm A
+ * is programmed for every step in turn (the sub-steps at whole multiples of the
+ * sub-step length from the beat timestamp, then the beat), so every step costs one
+ * wake and a table lookup. With -DUSE_RTC_WAKEUP_TIMER the wake-up timer is
+ * restarted for the same step timestamps.
+ * The boot timebase (-DUSE_FAST_BOOT) plays the beats of the pattern only.
+ * 
+ * Supply Monitor: Every BATTERY_SAMPLE_BEATS beats VREFINT is converted with the
+ * ADC in auto-off mode, against its factory calibration. The beat wake only keeps
+ * VREFINT on through Stop mode, the conversion runs at the end of the beat's pulse,
+ * so no wake waits for VREFINT to start. A low or critical battery
+ * (common/battery.h) halves or quarters the pulse widths.
+ * 
+ * Temperature Compensation: Every XTAL_TEMP_SAMPLES supply samples, the same wake
+ * converts the temperature sensor, and RTC->CALR (smooth calibration) is set to the
+ * crystal's parabolic offset at that temperature (common/xtal_comp.h).
+ * 
+ * Tempo Storage: The tempo survives resets and power loss in a wear-leveled ring
+ * of records in the data EEPROM (common/tempo_store.h). Button steps are coalesced:
+ * the tempo is written once, TEMPO_SAVE_BEATS beats after the last change, right
+ * after a beat. The ring is scanned at boot, before the RTC starts the first beat.
+ * A board without tempo_store keeps the tempo in RAM only (no storage code).
+ * 
+ * Board Variant: Pins, EXTI lines, the LSE clock source and the features of the
+ * product (tempo storage, sequencer) are one constexpr BoardConfig (Nucleo-L053R8,
+ * -DBOARD_NUCLEO_L053R8_LEAN for the lean product). The GPIO and EXTI setup, the
+ * EXTI handlers and the unused-pin masks are derived from it at compile time, with
+ * static_asserts for pin and EXTI line conflicts; a feature that is off folds away.
+ * 
+ * Fast Boot: Build with -DUSE_FAST_BOOT to start beating at power-up instead of
+ * waiting for LSERDY: LPTIM1 on LSI times the beats while the LSE starts, and the
+ * RTC takes over at a beat boundary once the LSE is ready.
+ * 
+ * Serial Link: Build with -DENABLE_SERIAL for the command and telemetry link of
+ * common/serial_link.h on LPUART1 (PA2 TX, PA3 RX: the ST-LINK virtual COM port,
+ * 9600 baud). Clocked from the LSE, LPUART1 receives a whole byte in Stop mode and
+ * its RXNE interrupt wakes the core through EXTI line 28. Bytes are sent from the
+ * TXE interrupt, in Sleep mode instead of Stop until the last one is out, and the
+ * replies are formatted right before sleeping (in PendSV with -DUSE_SLEEP_ON_EXIT).
+ * Nothing runs while the link is idle. With -DUSE_FAST_BOOT the link starts at the
+ * handover, once the LSE is ready.
+ * 
+ * Beat Sync: Build with -DENABLE_SYNC to follow a leader: its output pin drives
+ * PB4, whose rising edge wakes the core from Stop mode on EXTI4. The handler
+ * timestamps the edge on the RTC sub-seconds (the position in the beat in progress
+ * from its Alarm A timestamp) and the PI loop of common/beat_sync.h moves the next
+ * beat timestamp by its correction, so the sync edge is the only wake added. Needs
+ * the Alarm A beat scheduling (not -DUSE_RTC_WAKEUP_TIMER).
+ * 
+ * Sleep Entry: enter_stop_mode() checks the core's event word with PRIMASK set
+ * and only then executes WFI, which still wakes on an interrupt pending under
+ * PRIMASK. An event raised after the last poll is handled right away instead of
+ * at the next wake; the handler runs once PRIMASK is cleared after the WFI.
  * 
- * 50ms Output Pulse: Uses blocking delay during activation. This approach is more
- * power efficient than running a timer during sleep. The IWDG continues running
- * in Stop mode without additional power consumption.
+ * Sleep-on-exit: Build with -DUSE_SLEEP_ON_EXIT to run all work in prioritized
+ * interrupt handlers with SCB_SCR_SLEEPONEXIT set. The handlers pend PendSV (lowest
+ * priority), which runs the metronome core; on return the core re-enters Stop mode
+ * directly, without unstacking into thread mode. A handler that raises an event
+ * while PendSV runs pends it again, so the event is taken before Stop mode.
  * 
  * 3.3V Operation: STM32L0 operates at 1.65-3.6V, fully compatible with 3.3V
  * Brownout Detection: PVD (Programmable Voltage Detector) available, BOR enabled by default
@@ -27,40 +106,476 @@
 
 #include "stm32l0xx.h"
 
-// Pin configuration (adjust based on your hardware)
-#define OUTPUT_PORT GPIOA
-#define OUTPUT_PIN GPIO_PIN_5  // PA5 - Output pin
+// BPM, pulse and debounce configuration, portable metronome core
+#include "../common/config.h"
+#include "../common/metronome.h"
+
+// Compile-time BPM to tick tables (uses the BPM configuration above)
+#include "../common/bpm_table.h"
+#include "../common/beat_scheduler.h"
+#include "../common/debounce.h"
+#include "../common/instrumentation.h"
+#include "../common/tempo_store.h"
+#include "../common/tap_tempo.h"
+#include "../common/sequencer.h"
+#include "../common/battery.h"
+#include "../common/xtal_comp.h"
+#include "../common/serial_link.h"
+#include "../common/beat_sync.h"
+
+// Board variant (adjust based on your hardware): the pins, their EXTI lines, the
+// LSE clock source and the features of the product in one constexpr description.
+// GPIO_Init(), EXTI_Init(), the EXTI handlers and the unused-pin masks are derived
+// from it at compile time, so moving a pin changes this table only and costs no
+// code over literal masks. A feature that is off is tested in plain ifs on the
+// constant, so its code and state are dropped. Another board or product gets its
+// own BoardConfig in place of this one, under an #if on its -DBOARD_<name> flag.
+// The serial link, beat sync and instrumentation stay on their -DENABLE_* build
+// flags (platformio.ini); a disabled one leaves only empty inline stubs behind.
+
+// Port codes as in SYSCFG_EXTICR
+enum BoardPort : uint8_t {
+    PORT_A = 0,
+    PORT_B = 1,
+    PORT_C = 2,
+};
+
+struct BoardPin {
+    uint8_t port;  // BoardPort
+    uint8_t pin;   // 0-15, also the EXTI line of the pin
+    
+    constexpr uint16_t mask() const { return (uint16_t)(1U << pin); }
+};
+
+struct BoardConfig {
+    BoardPin output;                // Pulse output, push-pull, active high
+    BoardPin button[BUTTON_COUNT];  // Buttons to ground with pull-ups, by ButtonId
+    BoardPin sync;                  // Sync input (-DENABLE_SYNC)
+    BoardPin awake;                 // Awake marker (-DENABLE_INSTRUMENTATION)
+    bool lse_bypass;                // LSE from a 32.768kHz oscillator on OSC32_IN instead of a crystal
+    uint8_t lse_drive;              // LSE crystal drive level, 0 (least current) to 3
+    bool tempo_store;               // Tempo restored from the data EEPROM ring, else RAM only (BPM_DEFAULT at reset)
+    bool sequencer;                 // Beat patterns, selected with both tempo buttons, else the plain beat only
+};
+
+// Nucleo-L053R8 with the features of a product
+static constexpr BoardConfig nucleo_l053r8(bool tempo_store, bool sequencer) {
+    return {
+        { PORT_A, 5 },     // PA5 - Output pin (LD2)
+        {
+            { PORT_C, 13 },  // PC13 - Button to increase BPM (B1, blue button)
+            { PORT_B, 0 },   // PB0 - Button to decrease BPM
+            { PORT_B, 1 },   // PB1 - Tap tempo button
+        },
+        { PORT_B, 4 },     // PB4 - Sync input, wired to the leader's output pin
+        { PORT_A, 6 },     // PA6 - Debug marker, high while the core is awake
+        false,             // X2 crystal
+        0,                 // Lowest drive, enough for the X2 crystal
+        tempo_store,
+        sequencer,
+    };
+}
+
+#if defined(BOARD_NUCLEO_L053R8_LEAN)
+static constexpr BoardConfig board = nucleo_l053r8(false, false);  // Lean product: tempo in RAM, plain beat
+#else
+static constexpr BoardConfig board = nucleo_l053r8(true, true);    // Every feature
+#endif
+
+// Pins in use on each port, every other pin is put into analog mode by GPIO_Init()
+// PA13/PA14 (SWD) stay on unless the low-leakage audit profile is selected
+// PC14/PC15 (LSE) are taken over by the oscillator regardless of their mode
+// The awake marker is set up by instr_init(), after GPIO_Init()
+#ifdef ENABLE_SERIAL
+#define SERIAL_USED_PINS ((1U << 2) | (1U << 3))  // PA2 LPUART1_TX, PA3 LPUART1_RX (AF6)
+#else
+#define SERIAL_USED_PINS 0
+#endif
+#ifdef USE_LOW_LEAKAGE_PROFILE
+#define SWD_USED_PINS 0
+#else
+#define SWD_USED_PINS ((1U << 13) | (1U << 14))  // PA13 SWDIO, PA14 SWCLK
+#endif
+#ifdef ENABLE_SYNC
+#define SYNC_ENABLED true
+#else
+#define SYNC_ENABLED false
+#endif
+
+// Pins of the board in order: output, buttons by ButtonId, sync input, awake marker
+#define BOARD_PIN_COUNT (BUTTON_COUNT + 3)
+
+static constexpr BoardPin board_pin(uint8_t i) {
+    return i == 0 ? board.output
+         : i <= BUTTON_COUNT ? board.button[i - 1]
+         : i == BUTTON_COUNT + 1 ? board.sync
+         : board.awake;
+}
+
+// Output, buttons and the sync input (-DENABLE_SYNC) on a port
+static constexpr uint16_t board_used_pins(uint8_t port) {
+    uint16_t pins = 0;
+    for (uint8_t i = 0; i <= BUTTON_COUNT + (SYNC_ENABLED ? 1 : 0); i++) {
+        if (board_pin(i).port == port) {
+            pins |= board_pin(i).mask();
+        }
+    }
+    return pins;
+}
+
+#define GPIOA_USED_PINS (board_used_pins(PORT_A) | SWD_USED_PINS | SERIAL_USED_PINS)
+#define GPIOB_USED_PINS board_used_pins(PORT_B)
+#define GPIOC_USED_PINS board_used_pins(PORT_C)
+
+// EXTI lines of the buttons and the sync input (-DENABLE_SYNC)
+static constexpr uint16_t board_exti_lines() {
+    uint16_t lines = 0;
+    for (uint8_t i = 1; i <= BUTTON_COUNT + (SYNC_ENABLED ? 1 : 0); i++) {
+        lines |= board_pin(i).mask();
+    }
+    return lines;
+}
+
+#define EXTI_USED_LINES board_exti_lines()
+#define EXTI_LINES_0_1 0x0003U   // EXTI0_1_IRQHandler()
+#define EXTI_LINES_2_3 0x000CU   // EXTI2_3_IRQHandler()
+#define EXTI_LINES_4_15 0xFFF0U  // EXTI4_15_IRQHandler()
+
+// Every pin on ports A-C and used once: apart from each other, from the SWD and
+// serial pins and from PC14/PC15 (LSE)
+static constexpr bool board_pins_distinct() {
+    for (uint8_t i = 0; i < BOARD_PIN_COUNT; i++) {
+        BoardPin pin = board_pin(i);
+        if (pin.port > PORT_C || pin.pin > 15) {
+            return false;
+        }
+        if (pin.port == PORT_A && (pin.mask() & (SWD_USED_PINS | SERIAL_USED_PINS))) {
+            return false;
+        }
+        if (pin.port == PORT_C && pin.pin >= 14) {
+            return false;
+        }
+        for (uint8_t j = i + 1; j < BOARD_PIN_COUNT; j++) {
+            if (board_pin(j).port == pin.port && board_pin(j).pin == pin.pin) {
+                return false;
+            }
+        }
+    }
+    return true;
+}
+
+// An EXTI line takes one port: the buttons and the sync input need distinct pin numbers
+static constexpr bool board_exti_distinct() {
+    for (uint8_t i = 1; i <= BUTTON_COUNT + 1; i++) {
+        for (uint8_t j = i + 1; j <= BUTTON_COUNT + 1; j++) {
+            if (board_pin(i).pin == board_pin(j).pin) {
+                return false;
+            }
+        }
+    }
+    return true;
+}
+
+static_assert(board_pins_distinct(), "Board pins must be on ports A-C, each used once, clear of the SWD, serial and LSE pins");
+static_assert(board_exti_distinct(), "Buttons and the sync input need distinct EXTI lines");
+static_assert(board.lse_drive <= 3, "LSE drive level must be 0-3");
+static_assert(board.sequencer || SEQ_DEFAULT_PATTERN == 0, "A board without the sequencer plays the plain beat (pattern 0)");
+
+// GPIO port of a board pin (a constant address for a pin of the board)
+static inline GPIO_TypeDef* gpio_port(BoardPin pin) {
+    return pin.port == PORT_A ? GPIOA : pin.port == PORT_B ? GPIOB : GPIOC;
+}
+
+// HAL policy for the metronome core, defined below
+struct Stm32Hal {
+    static constexpr bool persistent = board.tempo_store;
+    static constexpr bool patterns = board.sequencer;
+    
+    static void set_tempo(uint16_t bpm);
+    static void pulse(uint8_t kind);
+    static void sleep();
+    static void watchdog_kick();
+    static void save_tempo(uint16_t bpm);
+    static void align_beat(uint16_t bpm);
+    static void set_pattern(uint8_t pattern);
+    static uint16_t measure_supply();
+    static void set_power_level(uint8_t level);
+    static int16_t measure_temperature();
+    static void set_xtal_trim(int32_t ppb);
+    static uint8_t irq_save();
+    static void irq_restore(uint8_t state);
+};
+typedef Metronome<Stm32Hal> App;
+
+// RTC prescalers: sub-second counter runs at ck_apre = 32768 / 8 = 4096Hz (244µs)
+#define RTC_PREDIV_A 7
+#define RTC_PREDIV_S 4095
+#define RTC_SUBSECOND_HZ (RTC_PREDIV_S + 1)
+#define RTC_SUBSECOND_BITS 12  // SS[11:0] used for alarm matching
+#define RTC_MINUTE_TICKS TICKS_PER_MINUTE_4096HZ  // Sub-second ticks per minute
+static_assert(RTC_MINUTE_TICKS == 60UL * RTC_SUBSECOND_HZ, "Beat table must match the RTC prescalers");
+#define DEBOUNCE_SS_TICKS (((DEBOUNCE_DELAY_MS * RTC_SUBSECOND_HZ) + 999) / 1000)  // Rounded up
+
+// Pulse width of each step kind in LPTIM1 ticks (LPTIM1 runs from the 32.768kHz LSE)
+// and in ms for the blocking delay
+static constexpr PulseWidthTable pulse_width_lptim = make_pulse_width_table<32768>();
+static constexpr PulseWidthTable pulse_width_ms = make_pulse_width_table<1000>();
+
+// Boot timebase (-DUSE_FAST_BOOT): LPTIM1 from LSI / 2 until the LSE is ready
+#define BOOT_LSI_HZ 37000  // Typical, 26-56kHz over the operating range
+#define BOOT_LPTIM_HZ (BOOT_LSI_HZ / 2)
+#define DEBOUNCE_BOOT_TICKS (((DEBOUNCE_DELAY_MS * BOOT_LPTIM_HZ) + 999) / 1000)  // Rounded up
+
+// Tempo storage: ring of records (common/tempo_store.h) at the start of the data
+// EEPROM, read through its memory mapping
+#define TEMPO_RING ((TempoRecord*)DATA_EEPROM_BASE)
+
+// Supply monitor: the ADC converts VREFINT (channel 17, 12 bits) against VDDA, and
+// the factory reading of VREFINT at VDDA = 3.0V gives reading = 3000 * cal / VDDA in mV
+// (common/battery.h)
+#define SUPPLY_VREFINT_CAL (*(const uint16_t*)0x1FF80078)  // VREFINT_CAL, factory reading at 3.0V
+#define SUPPLY_CAL_MV 3000
+#define ADC_VREG_STARTUP_US 20  // t_ADCVREG_STUP, datasheet maximum
+
+// System clock for the busy waits: MSI range 5 (the reset default), and the cycles
+// of one delay loop pass at the least (NOP, add, compare, taken branch)
+#define MSI_HZ 2097152UL
+#define DELAY_LOOP_CYCLES 4
+
+// Temperature sensor (channel 18): factory readings at 30°C and 130°C, VDDA = 3.0V
+#define TS_CAL1 (*(const uint16_t*)0x1FF8007A)
+#define TS_CAL2 (*(const uint16_t*)0x1FF8007E)
+#define TS_CAL1_C 30
+#define TS_CAL2_C 130
+
+// RTC smooth calibration: CALM masks 0-511 RTCCLK pulses every 2^20 (0.954 ppm
+// each), CALP inserts 512 (+488.5 ppm)
+#define RTC_CALM_MAX 511
+#define RTC_CALP_PPB 488281  // 512 pulses per 2^20
+
+// Serial link (-DENABLE_SERIAL): LPUART1 BRR = 256 * LSE / baud, rounded (874)
+#define SERIAL_BRR ((256UL * 32768 + SERIAL_BAUD / 2) / SERIAL_BAUD)
+
+static_assert(SERIAL_BRR >= 0x300, "LPUART1 BRR must be 0x300 or more");
+
+// Interrupt priorities for -DUSE_SLEEP_ON_EXIT (0 = highest, the M0+ has 4 levels)
+#define IRQ_PRIORITY_RTC 0     // Beat and debounce alarms, reprogram the next alarm
+#define IRQ_PRIORITY_LPTIM 1   // End of the output pulse (boot beats with -DUSE_FAST_BOOT)
+#define IRQ_PRIORITY_EXTI 2    // Button edges, serial link bytes
+#define IRQ_PRIORITY_PENDSV 3  // Metronome core work
+
+#if defined(USE_SLEEP_ON_EXIT) && defined(USE_FULL_CLOCK_RESTORE)
+#error "USE_SLEEP_ON_EXIT needs the fast wake path (the clock cannot be restored in thread mode)"
+#endif
 
-#define BUTTON_INC_PORT GPIOC
-#define BUTTON_INC_PIN GPIO_PIN_13  // PC13 - Button to increase BPM
+// The RTC ISR consumes a per-tempo context from a compile-time table. The main loop
+// only selects the table entry when the tempo changes; the ISR latches it at the
+// next beat boundary, so no tempo math (and no division) runs in interrupt context.
 
-#define BUTTON_DEC_PORT GPIOB
-#define BUTTON_DEC_PIN GPIO_PIN_0   // PB0 - Button to decrease BPM
+// Beat scheduler - timestamps are sub-second ticks within the current RTC minute
+volatile uint32_t next_beat_ticks = 0;  // Timestamp of the next beat
+static uint32_t next_alarm_ticks;       // Timestamp of the beat timer: the next beat or sub-step
+static uint32_t step_ticks;             // Sub-step length in the beat in progress
+static BeatState beat_state;            // Entries of bpm_table_4096hz, owned by the RTC ISR
 
-#define BUTTON3_PORT GPIOB
-#define BUTTON3_PIN GPIO_PIN_1   // PB1 - Button 3 (reserved)
+// Sub-step lengths in sub-second ticks
+static constexpr SubStepTable substep_table_4096hz = make_substep_table<TICKS_PER_MINUTE_4096HZ>();
 
-// BPM configuration
-#define BPM_MIN 40
-#define BPM_MAX 155
-#define BPM_DEFAULT 100
-#define BPM_STEP 5
+// Beat timer flags: the wake-up timer on EXTI line 20, or Alarm A on EXTI line 17
+#ifdef USE_RTC_WAKEUP_TIMER
+#define BEAT_RTC_FLAG RTC_ISR_WUTF
+#define BEAT_EXTI_FLAG EXTI_PR_PIF20
+#else
+#define BEAT_RTC_FLAG RTC_ISR_ALRAF
+#define BEAT_EXTI_FLAG EXTI_PR_PIF17
 
-// Timing configuration
-volatile uint16_t current_bpm = BPM_DEFAULT;
-volatile uint16_t activation_period_ms = 60000 / BPM_DEFAULT;  // Calculate period from BPM
-#define ACTIVATION_DURATION_MS 50 // Active for 50ms
-#define DEBOUNCE_DELAY_MS 50  // 50ms debounce delay for snappy response
+// BCD encoding of 0-59 for the Alarm A seconds field (avoids /10 and %10 in the ISR)
+struct BcdTable {
+    uint8_t value[60];
+};
 
-volatile bool activation_flag = false;
-volatile uint32_t millis_counter = 0;  // Approximate millisecond counter
-volatile uint32_t last_activation_time = 0;  // Track last activation
-volatile bool reconfigure_rtc = false;
+constexpr BcdTable make_bcd_table() {
+    BcdTable table{};
+    for (uint8_t i = 0; i < 60; i++) {
+        table.value[i] = (uint8_t)(((i / 10) << 4) | (i % 10));
+    }
+    return table;
+}
+
+static constexpr BcdTable bcd_seconds = make_bcd_table();
+#endif
+
+#ifdef USE_FAST_BOOT
+// LPTIM1 autoreload value (one beat) for every BPM step, boot timebase only
+struct BootPeriodTable {
+    uint16_t arr[BPM_TABLE_SIZE];
+};
+
+constexpr BootPeriodTable make_boot_period_table() {
+    BootPeriodTable table{};
+    for (uint8_t i = 0; i < BPM_TABLE_SIZE; i++) {
+        table.arr[i] = (uint16_t)(bpm_table_ms.entry[i].ticks * BOOT_LPTIM_HZ / 1000 - 1);
+    }
+    return table;
+}
+
+static_assert(60000UL / BPM_MIN * BOOT_LPTIM_HZ / 1000 <= 0xFFFF, "Boot beat period must fit LPTIM1 ARR");
+
+static constexpr BootPeriodTable boot_period_table = make_boot_period_table();
+#endif
+
+// Debounce state machine (common/debounce.h), one per button (indexed by ButtonId)
+volatile ButtonState button_state[BUTTON_COUNT] = { BUTTON_IDLE, BUTTON_IDLE, BUTTON_IDLE };
+static volatile RepeatState button_repeat;  // Auto-repeat on the debounce timer, owned by the handlers
+
+// Auto-repeat steps in sub-second ticks (Alarm B matches within one second) and, for
+// the boot timebase, in LPTIM1 ticks (the compare wraps around the beat once)
+static constexpr RepeatTable repeat_table_4096hz = make_repeat_table<RTC_SUBSECOND_HZ>();
+#ifdef USE_FAST_BOOT
+static constexpr RepeatTable repeat_table_boot = make_repeat_table<BOOT_LPTIM_HZ>();
+static_assert(REPEAT_DELAY_MS < 60000UL / BPM_MAX && REPEAT_START_MS < 60000UL / BPM_MAX,
+              "Repeat steps must fit in one boot beat");
+#endif
+static_assert(REPEAT_DELAY_MS < 1000 && REPEAT_START_MS < 1000, "Repeat steps must fit in one second");
 
-// Button press flags set by ISR, processed in main loop
-volatile bool button_inc_pressed = false;
-volatile bool button_dec_pressed = false;
-volatile bool button3_pressed = false;
+// Tempo storage state (main loop only, board.tempo_store)
+static TempoStore tempo_store;
+
+// Pattern sequencer (common/sequencer.h) - owned by the RTC handler
+static Sequencer sequencer = { &seq_patterns[SEQ_DEFAULT_PATTERN], nullptr, 0, 0 };
+
+// Sequencer steps for the RTC handler: on a board without the sequencer every step
+// is a plain beat, these fold to constants and the sequencer is dropped
+static inline uint8_t pattern_beat(void) {
+    return board.sequencer ? seq_beat(&sequencer) : (uint8_t)STEP_BEAT;
+}
+
+static inline bool pattern_steps_left(void) {
+    return board.sequencer && seq_steps_left(&sequencer);
+}
+
+static inline uint8_t pattern_subdiv(void) {
+    return board.sequencer ? seq_subdiv(&sequencer) : 1;
+}
+
+static inline void pattern_skip(void) {
+    if (board.sequencer) {
+        seq_skip(&sequencer);
+    }
+}
+
+static uint8_t pulse_shift;  // Pulse widths are shifted right by this (battery level), main loop only
+
+// Crystal temperature correction (common/xtal_comp.h), main loop only
+static uint32_t rtc_calr;        // RTC->CALR value, written by RTC_Start() and rtc_calibrate()
+static uint16_t supply_vrefint;  // VREFINT reading of the last supply sample
+static uint16_t supply_ts;       // Temperature sensor reading of the same sample
+static volatile bool supply_pending;  // The supply sample is taken at the end of the pulse in progress
+
+// Tap tempo: taps are timestamped with the RTC calendar (rtc_read_ticks()), which
+// runs anyway, so timing the taps costs no wake. Taps are ignored while the boot
+// timebase runs (-DUSE_FAST_BOOT), the calendar only starts at the handover.
+static TapTempo tap_tempo;             // Owned by the RTC handler
+static volatile uint32_t tap_edge;     // Timestamp of the press edge being debounced
+static volatile bool tap_edge_valid;   // tap_edge was taken on the RTC calendar
+static volatile uint32_t tap_last;     // Timestamp of the press edge of the last tap
+
+#ifdef ENABLE_INSTRUMENTATION
+WakeLog wake_log;
+static volatile WakeState wake_state;
+
+// Stack area: the RAM from the end of .bss (nothing is allocated on the heap) up
+// to the initial stack pointer, which the stack grows down from (linker script)
+extern uint8_t _ebss;
+extern uint8_t _estack;
+#define STACK_AREA_SIZE ((uint16_t)(&_estack - &_ebss))
+
+// Paint the stack area below the stack pointer with STACK_PAINT. Called first in
+// main(), before any interrupt is enabled; not inlined, so its own frame lies above
+// the stack pointer it reads.
+__attribute__((noinline)) void stack_paint(void) {
+    uint8_t* sp = (uint8_t*)__get_MSP();
+    for (uint8_t* p = &_ebss; p < sp; p++) {
+        *p = STACK_PAINT;
+    }
+}
+
+// Cycle timing uses SysTick as a free-running 24-bit down counter at HCLK, the
+// Cortex-M0+ has no DWT cycle counter. SysTick stops in Stop mode, which is fine
+// because only awake time is measured (up to 2^24 cycles, ~8s at 2.097MHz).
+// Must run after GPIO_Init(), which puts the awake marker into analog mode.
+void instr_init(void) {
+    SysTick->LOAD = SysTick_LOAD_RELOAD_Msk;
+    SysTick->VAL = 0;
+    SysTick->CTRL = SysTick_CTRL_CLKSOURCE_Msk | SysTick_CTRL_ENABLE_Msk;  // No interrupt
+    
+    // Awake marker: push-pull output, high (we are awake until the first sleep)
+    GPIO_TypeDef* marker = gpio_port(board.awake);
+    marker->MODER = (marker->MODER & ~(3U << (board.awake.pin * 2))) | (1U << (board.awake.pin * 2));
+    marker->BSRR = board.awake.mask();
+    
+    // Log a watchdog reset, then clear the reset flags
+    if (RCC->CSR & RCC_CSR_IWDGRSTF) {
+        wake_log_push(&wake_log, WAKE_WDT_RESET, 0, 0);
+    }
+    RCC->CSR |= RCC_CSR_RMVF;
+}
+
+// Called at the start of every interrupt handler that can wake the core
+static inline void instr_wake(uint8_t cause) {
+    if (wake_state_begin(&wake_state, cause)) {
+        SysTick->VAL = 0;  // Restart the count from LOAD
+        gpio_port(board.awake)->BSRR = board.awake.mask();
+    }
+}
+
+static inline void instr_beat_error(int16_t error) {
+    wake_state.beat_error = error;
+}
+
+// Called right before entering Stop mode (keeps the PRIMASK state of the caller)
+static inline void instr_sleep(void) {
+    uint32_t primask = __get_PRIMASK();
+    __disable_irq();
+    uint32_t cycles = SysTick_LOAD_RELOAD_Msk - SysTick->VAL;
+    wake_state_end(&wake_state, &wake_log, cycles);
+    gpio_port(board.awake)->BRR = board.awake.mask();
+    __set_PRIMASK(primask);
+}
+
+// Stack high-water scan every STACK_CHECK_BEATS beats (core context, before the
+// sleep entry, interrupts enabled)
+static inline void instr_stack_check(void) {
+    static uint32_t checked;  // wake_log.beats at the last scan
+    if (stack_check_due(&wake_log, checked)) {
+        checked = wake_log.beats;
+        wake_log.stack_free = stack_unused(&_ebss, STACK_AREA_SIZE);
+    }
+}
+#else
+static inline void stack_paint(void) {}
+static inline void instr_init(void) {}
+static inline void instr_wake(uint8_t) {}
+static inline void instr_beat_error(int16_t) {}
+static inline void instr_sleep(void) {}
+static inline void instr_stack_check(void) {}
+#endif
+
+#ifdef USE_SLEEP_ON_EXIT
+// Hand the rest of a wake to PendSV, which runs once all higher priority handlers
+// are done (tail-chained, no return to thread mode). Events that leave no work for
+// the core skip it, unless the wake has to be closed for the instrumentation log.
+static inline void wake_work_pend(bool has_work) {
+#ifdef ENABLE_INSTRUMENTATION
+    has_work = true;
+#endif
+    if (has_work) {
+        SCB->ICSR = SCB_ICSR_PENDSVSET_Msk;
+    }
+}
+#else
+static inline void wake_work_pend(bool) {}
+#endif
 
 // System Clock Configuration
 void SystemClock_Config(void) {
@@ -80,49 +595,279 @@ void SystemClock_Config(void) {
 }
 
 // GPIO Initialization
+// Put every pin not in used_pins into analog mode (no pull, Schmitt trigger off)
+// Analog mode is the lowest leakage state for a pin that is not used
+static void gpio_set_unused_analog(GPIO_TypeDef* port, uint16_t used_pins) {
+    uint32_t analog = 0;
+    for (uint8_t pin = 0; pin < 16; pin++) {
+        if (!(used_pins & (1U << pin))) {
+            analog |= 3U << (pin * 2);
+        }
+    }
+    port->PUPDR &= ~analog;
+    port->MODER |= analog;
+}
+
 void GPIO_Init(void) {
     // Enable GPIO clocks
     RCC->IOPENR |= RCC_IOPENR_GPIOAEN | RCC_IOPENR_GPIOBEN | RCC_IOPENR_GPIOCEN;
     
-    // Configure output pin (PA5)
-    GPIOA->MODER = (GPIOA->MODER & ~(3U << (5 * 2))) | (1U << (5 * 2)); // Output mode
-    GPIOA->OTYPER &= ~(1U << 5);  // Push-pull
-    GPIOA->OSPEEDR &= ~(3U << (5 * 2));  // Low speed for power saving
-    GPIOA->PUPDR &= ~(3U << (5 * 2));  // No pull-up/pull-down
-    GPIOA->ODR &= ~(1U << 5);  // Start low
+    // Unused pins to analog mode
+    gpio_set_unused_analog(GPIOA, GPIOA_USED_PINS);
+    gpio_set_unused_analog(GPIOB, GPIOB_USED_PINS);
+    gpio_set_unused_analog(GPIOC, GPIOC_USED_PINS);
+    
+    // Ports D and H have no used pins: set them to analog, then gate their clocks
+    RCC->IOPENR |= RCC_IOPENR_GPIODEN | RCC_IOPENR_GPIOHEN;
+    gpio_set_unused_analog(GPIOD, 0);
+    gpio_set_unused_analog(GPIOH, 0);
+    RCC->IOPENR &= ~(RCC_IOPENR_GPIODEN | RCC_IOPENR_GPIOHEN);
+    
+    // Configure output pin
+    GPIO_TypeDef* output = gpio_port(board.output);
+    uint8_t pin = board.output.pin;
+    output->MODER = (output->MODER & ~(3U << (pin * 2))) | (1U << (pin * 2)); // Output mode
+    output->OTYPER &= ~board.output.mask();  // Push-pull
+    output->OSPEEDR &= ~(3U << (pin * 2));  // Low speed for power saving
+    output->PUPDR &= ~(3U << (pin * 2));  // No pull-up/pull-down
+    output->ODR &= ~board.output.mask();  // Start low
     
     // Configure button pins as input with pull-up
-    // PC13 - Button 1
-    GPIOC->MODER &= ~(3U << (13 * 2));  // Input mode
-    GPIOC->PUPDR = (GPIOC->PUPDR & ~(3U << (13 * 2))) | (1U << (13 * 2));  // Pull-up
-    
-    // PB0 - Button 2
-    GPIOB->MODER &= ~(3U << (0 * 2));  // Input mode
-    GPIOB->PUPDR = (GPIOB->PUPDR & ~(3U << (0 * 2))) | (1U << (0 * 2));  // Pull-up
-    
-    // PB1 - Button 3
-    GPIOB->MODER &= ~(3U << (1 * 2));  // Input mode
-    GPIOB->PUPDR = (GPIOB->PUPDR & ~(3U << (1 * 2))) | (1U << (1 * 2));  // Pull-up
-}
-
-// Calculate wake-up interval based on BPM
-// Since LSI is ~37kHz with prescaler giving 1Hz, we use software timing
-// Wake up at a rate faster than needed, check in ISR
-uint16_t calculate_wakeup_interval_ms(uint16_t bpm) {
-    // Period in ms = 60000 / BPM
-    uint32_t period_ms = 60000UL / bpm;
-    
-    // For very fast BPM, wake more frequently
-    // For slower BPM, can wake less frequently
-    if (period_ms < 1000) {
-        return period_ms;  // Wake at activation rate
+    for (uint8_t button = 0; button < BUTTON_COUNT; button++) {
+        GPIO_TypeDef* port = gpio_port(board.button[button]);
+        pin = board.button[button].pin;
+        port->MODER &= ~(3U << (pin * 2));  // Input mode
+        port->PUPDR = (port->PUPDR & ~(3U << (pin * 2))) | (1U << (pin * 2));  // Pull-up
+    }
+}
+
+// Read the RTC sub-second counter (counts down from RTC_PREDIV_S once per second)
+// With BYPSHAD set, read until two consecutive values match
+static uint32_t rtc_read_ssr(void) {
+    uint32_t ssr;
+    do {
+        ssr = RTC->SSR;
+    } while (ssr != RTC->SSR);
+    return ssr;
+}
+
+// Read the current RTC timestamp in sub-second ticks within the minute
+// (0 .. RTC_MINUTE_TICKS-1). With BYPSHAD set, read until SSR and TR are consistent.
+static uint32_t rtc_read_ticks(void) {
+    uint32_t ssr, tr;
+    do {
+        ssr = RTC->SSR;
+        tr = RTC->TR;
+    } while (ssr != RTC->SSR || tr != RTC->TR);
+    
+    uint32_t seconds = ((tr & RTC_TR_ST) >> RTC_TR_ST_Pos) * 10 + ((tr & RTC_TR_SU) >> RTC_TR_SU_Pos);
+    return seconds * RTC_SUBSECOND_HZ + (RTC_PREDIV_S - ssr);
+}
+
+// Sub-second ticks from the timestamp start to now, both within the minute
+static uint32_t rtc_ticks_since(uint32_t start, uint32_t now) {
+    return now >= start ? now - start : now + RTC_MINUTE_TICKS - start;
+}
+
+#ifdef ENABLE_SERIAL
+// Serial link state (common/serial_link.h)
+static SerialLink serial_link;
+static uint32_t serial_edge;  // Timestamp of the last beat edge, owned by the RTC handler
+
+// Beat edge at a timestamp (RTC handler): stamp it for the beat stream
+static void serial_beat_at(uint32_t ticks) {
+    serial_beat(&serial_link, rtc_ticks_since(serial_edge, ticks));
+    serial_edge = ticks;
+}
+
+// Set up LPUART1, 8N1 at SERIAL_BAUD on PA2 / PA3 (called once the LSE is ready)
+// The kernel clock is the LSE, which keeps running in Stop mode: with UESM set the
+// receiver takes a whole byte in Stop mode, and RXNE wakes the core.
+void LPUART_Init(void) {
+    serial_init(&serial_link);
+    
+    // PA2 / PA3 to AF6, RX pulled up while the ST-LINK is not connected
+    GPIOA->AFR[0] = (GPIOA->AFR[0] & ~((0xFU << (2 * 4)) | (0xFU << (3 * 4)))) | (6U << (2 * 4)) | (6U << (3 * 4));
+    GPIOA->PUPDR = (GPIOA->PUPDR & ~(3U << (3 * 2))) | (1U << (3 * 2));
+    GPIOA->MODER = (GPIOA->MODER & ~((3U << (2 * 2)) | (3U << (3 * 2)))) | (2U << (2 * 2)) | (2U << (3 * 2));
+    
+    RCC->CCIPR |= RCC_CCIPR_LPUART1SEL;  // 11: LSE
+    RCC->APB1ENR |= RCC_APB1ENR_LPUART1EN;
+    
+    LPUART1->BRR = SERIAL_BRR;
+    LPUART1->CR1 = USART_CR1_UESM | USART_CR1_RXNEIE | USART_CR1_TE | USART_CR1_RE;
+    LPUART1->CR1 |= USART_CR1_UE;
+    
+    // LPUART1 wakes the core from Stop mode on EXTI line 28
+    EXTI->IMR |= EXTI_IMR_IM28;
+    NVIC_EnableIRQ(RNG_LPUART1_IRQn);
+}
+#else
+static inline void serial_beat_at(uint32_t) {}
+#endif
+
+#ifdef ENABLE_SYNC
+#ifdef USE_RTC_WAKEUP_TIMER
+#error "-DENABLE_SYNC moves the beat on Alarm A, it cannot be combined with -DUSE_RTC_WAKEUP_TIMER"
+#endif
+// Beat sync with a leader (common/beat_sync.h), owned by the RTC and EXTI handlers
+static BeatSync beat_sync;
+static uint32_t sync_beat_start;  // Timestamp of the beat in progress
+static constexpr uint16_t sync_window_4096hz = sync_window_ticks<RTC_SUBSECOND_HZ>();
+#define SYNC_GUARD_TICKS 8  // Ticks needed to move Alarm A (about 2ms)
+
+// Beat edge at a timestamp (RTC handler): the start of the beat in progress
+static inline void sync_beat_at(uint32_t ticks) {
+    sync_beat_start = ticks;
+}
+
+// Sync correction carried to the beat that starts now
+static inline int8_t sync_beat_ticks(void) {
+    return sync_next(&beat_sync);
+}
+#else
+static inline void sync_beat_at(uint32_t) {}
+
+static inline int8_t sync_beat_ticks(void) {
+    return 0;
+}
+#endif
+
+#ifdef USE_RTC_WAKEUP_TIMER
+// Restart the wake-up timer to fire at a timestamp within the minute
+// WUTR can only be written with the timer stopped, so every step restarts it with
+// the time left from now (RTCCLK / 16 = half the sub-second rate). The interrupt
+// latency and the WUTWF wait before the restart do not add up from step to step:
+// each one lands within one wake-up tick of its timestamp, and the long-run rate
+// is that of the calendar, like Alarm A. A timestamp already passed fires 1ms later.
+static void rtc_set_wakeup(uint32_t ticks) {
+    // Disable RTC write protection
+    RTC->WPR = 0xCA;
+    RTC->WPR = 0x53;
+    
+    // Disable wake-up timer (it restarts from the new value when re-enabled)
+    RTC->CR &= ~RTC_CR_WUTE;
+    while (!(RTC->ISR & RTC_ISR_WUTWF));
+    
+    uint32_t left = rtc_ticks_since(rtc_read_ticks(), ticks);
+    if (left < 4 || left > RTC_MINUTE_TICKS / 2) {
+        left = 4;  // Shortest reload, WUTR = 0 is not used
+    }
+    RTC->WUTR = (left >> 1) - 1;  // WUTF is set every WUTR + 1 cycles
+    
+    // Re-enable wake-up timer
+    RTC->CR |= RTC_CR_WUTE;
+    
+    // Enable RTC write protection
+    RTC->WPR = 0xFF;
+}
+
+// Program the wake-up timer for the next step, a beat or a sub-step
+static void beat_alarm_at(uint32_t ticks) {
+    next_alarm_ticks = ticks;
+    rtc_set_wakeup(ticks);
+}
+#else
+// Program Alarm A to fire at a timestamp within the minute
+// Date, hours and minutes are masked: the beat period is always shorter than a minute
+static void rtc_set_alarm_a(uint32_t ticks) {
+    uint32_t seconds = ticks >> RTC_SUBSECOND_BITS;
+    uint32_t ss = RTC_PREDIV_S - (ticks & RTC_PREDIV_S);  // SSR counts down
+    
+    // Disable RTC write protection
+    RTC->WPR = 0xCA;
+    RTC->WPR = 0x53;
+    
+    // Alarm A must be disabled while it is reprogrammed
+    RTC->CR &= ~RTC_CR_ALRAE;
+    while (!(RTC->ISR & RTC_ISR_ALRAWF));
+    
+    RTC->ALRMAR = RTC_ALRMAR_MSK4 | RTC_ALRMAR_MSK3 | RTC_ALRMAR_MSK2
+                | ((uint32_t)bcd_seconds.value[seconds] << RTC_ALRMAR_SU_Pos);  // ST:SU in BCD
+    RTC->ALRMASSR = ((uint32_t)RTC_SUBSECOND_BITS << RTC_ALRMASSR_MASKSS_Pos) | ss;
+    
+    // Drop any stale match and enable Alarm A with interrupt
+    RTC->ISR = ~(RTC_ISR_ALRAF | RTC_ISR_INIT) | (RTC->ISR & RTC_ISR_INIT);
+    RTC->CR |= RTC_CR_ALRAIE | RTC_CR_ALRAE;
+    
+    // Enable RTC write protection
+    RTC->WPR = 0xFF;
+}
+
+// Program Alarm A for the next step, a beat or a sub-step
+static void beat_alarm_at(uint32_t ticks) {
+    next_alarm_ticks = ticks;
+    rtc_set_alarm_a(ticks);
+}
+#endif
+
+// Advance the beat timestamp by one period
+// The period is RTC_MINUTE_TICKS / bpm = ticks + rem / bpm; the fractional tick
+// error is carried so that the long-run rate is exact. A follower (-DENABLE_SYNC)
+// adds a sync correction that came too late for the beat that ended.
+static void beat_advance(void) {
+    uint32_t next = next_beat_ticks + beat_next(&beat_state) + sync_beat_ticks();
+    
+    if (next >= RTC_MINUTE_TICKS) {
+        next -= RTC_MINUTE_TICKS;  // Wrap at the minute
+    }
+    
+    next_beat_ticks = next;
+}
+
+// Advance the beat timestamp by one period and program the beat timer for it
+void beat_schedule_next(void) {
+    beat_advance();
+    beat_alarm_at(next_beat_ticks);
+}
+
+// Program the beat timer for the step after the one at timestamp edge: one sub-step
+// later while the beat has sub-steps left that fall before the next beat, else the
+// beat. Sub-steps are whole multiples of step_ticks from the beat timestamp, so
+// they do not drift with the interrupt latency.
+static void step_schedule(uint32_t edge) {
+    if (pattern_steps_left() && step_ticks < rtc_ticks_since(edge, next_beat_ticks)) {
+        uint32_t next = edge + step_ticks;
+        if (next >= RTC_MINUTE_TICKS) {
+            next -= RTC_MINUTE_TICKS;  // Wrap at the minute
+        }
+        beat_alarm_at(next);
     } else {
-        return 1000;  // Wake every second for slow rates
+        beat_alarm_at(next_beat_ticks);
+    }
+}
+
+// Move the next beat edge to a timestamp (RTC interrupt masked, target ahead of
+// now). A sub-step still due before the new beat edge keeps the beat timer, the ones
+// after it are dropped when it is scheduled (see step_schedule()).
+static void beat_move_edge(uint32_t now, uint32_t target) {
+    bool at_beat = next_alarm_ticks == next_beat_ticks;
+    next_beat_ticks = target;
+    if (at_beat || rtc_ticks_since(now, target) <= rtc_ticks_since(now, next_alarm_ticks)) {
+        beat_alarm_at(target);
     }
 }
 
+// Select the beat period for a new tempo, applied by the RTC ISR at the next beat
+void beat_request_tempo(uint16_t bpm) {
+    beat_request(&beat_state, &bpm_table_4096hz.entry[bpm_index(bpm)]);
+}
+
+// Table index of the tempo of the beat in progress
+static uint8_t beat_active_index(void) {
+    return beat_state.period - bpm_table_4096hz.entry;
+}
+
+#ifdef USE_FAST_BOOT
+// Boot timebase beat: latch a pending tempo change (the RTC is not running yet)
+static void beat_boot_latch(void) {
+    beat_next(&beat_state);
+}
+#endif
+
 // RTC Configuration for periodic wake-up
-void RTC_Init(void) {
+// Start the LSE oscillator, without waiting for it
+void LSE_Start(void) {
     // Enable PWR clock
     RCC->APB1ENR |= RCC_APB1ENR_PWREN;
     
@@ -132,152 +877,678 @@ void RTC_Init(void) {
     // Enable LSE (Low Speed External) 32.768kHz crystal oscillator for precise timing
     // LSE provides ±20 ppm typical accuracy vs ±5% for LSI
     // External crystal connected to OSC32_IN/OSC32_OUT pins (PC14/PC15)
+    // Drive capability of the board (the lowest is enough for the Nucleo crystal,
+    // least current), or bypass for an oscillator driving OSC32_IN
+    RCC->CSR = (RCC->CSR & ~RCC_CSR_LSEDRV) | ((uint32_t)board.lse_drive << RCC_CSR_LSEDRV_Pos);
+    if (board.lse_bypass) {
+        RCC->CSR |= RCC_CSR_LSEBYP;
+    }
     RCC->CSR |= RCC_CSR_LSEON;
-    while (!(RCC->CSR & RCC_CSR_LSERDY));  // Wait for LSE to be ready
-    
+}
+
+// Start the RTC on the running LSE, first beat one period from now at the tempo
+// of table entry index
+void RTC_Start(uint8_t index) {
     // Select LSE as RTC clock source
     // Note: For internal LSI (~37kHz, ±5%), use: RCC_CSR_RTCSEL_LSI
     RCC->CSR = (RCC->CSR & ~RCC_CSR_RTCSEL) | RCC_CSR_RTCSEL_LSE;
     
-    // Enable RTC clock
-    RCC->CSR |= RCC_CSR_RTCEN;
+    // Enable RTC clock
+    RCC->CSR |= RCC_CSR_RTCEN;
+    
+    // Disable RTC write protection
+    RTC->WPR = 0xCA;
+    RTC->WPR = 0x53;
+    
+    // Enter initialization mode
+    RTC->ISR |= RTC_ISR_INIT;
+    while (!(RTC->ISR & RTC_ISR_INITF));
+    
+    // Configure RTC prescaler for 32.768kHz crystal
+    // LSE = 32768 Hz, Async prescaler = 8, Sync prescaler = 4096
+    // This gives exactly 1Hz RTC clock: 32768 / (8 * 4096) = 1 Hz
+    // The sub-second counter (SSR) runs at ck_apre = 4096Hz
+    RTC->PRER = (RTC_PREDIV_A << RTC_PRER_PREDIV_A_Pos) | RTC_PREDIV_S;  // Async = 7 (8-1), Sync = 4095 (4096-1)
+    
+    // Crystal temperature correction taken before the RTC started (-DUSE_FAST_BOOT)
+    // CALP needs PREDIV_A >= 3
+    RTC->CALR = rtc_calr;
+    
+    // Exit initialization mode
+    RTC->ISR &= ~RTC_ISR_INIT;
+    
+    // Read SSR/TR directly from the counters: the shadow registers are not
+    // updated in Stop mode, and the timers read SSR right after wake-up
+    RTC->CR |= RTC_CR_BYPSHAD;
+    
+#ifdef USE_RTC_WAKEUP_TIMER
+    // Wake-up clock RTCCLK / 16 (WUCKSEL = 000), restarted for every step by
+    // rtc_set_wakeup()
+    RTC->CR &= ~RTC_CR_WUTE;
+    while (!(RTC->ISR & RTC_ISR_WUTWF));
+    RTC->CR &= ~RTC_CR_WUCKSEL;
+    RTC->CR |= RTC_CR_WUTIE;
+    
+    // Enable RTC wake-up interrupt in EXTI
+    EXTI->IMR |= EXTI_IMR_IM20;  // RTC Wakeup is on EXTI line 20
+    EXTI->RTSR |= EXTI_RTSR_RT20;
+#endif
+    
+    // Enable RTC write protection
+    RTC->WPR = 0xFF;
+    
+    // Schedule the first beat one period from now on the beat timer
+    beat_init(&beat_state, &bpm_table_4096hz.entry[index]);
+    next_beat_ticks = rtc_read_ticks();
+    sync_beat_at(next_beat_ticks);
+    beat_schedule_next();
+    
+    // Enable RTC alarm interrupt in EXTI (Alarm A is the beat, Alarm B the debounce timer)
+    EXTI->IMR |= EXTI_IMR_IM17;  // RTC Alarm is on EXTI line 17
+    EXTI->RTSR |= EXTI_RTSR_RT17;
+    
+    // Enable RTC wake-up interrupt in NVIC
+    NVIC_EnableIRQ(RTC_IRQn);
+}
+
+// Initialize the RTC: waits for the LSE to start (up to a few hundred ms)
+void RTC_Init(void) {
+    LSE_Start();
+    while (!(RCC->CSR & RCC_CSR_LSERDY));  // Wait for LSE to be ready
+    RTC_Start(bpm_index(App::bpm()));
+#ifdef ENABLE_SERIAL
+    LPUART_Init();
+#endif
+}
+
+#ifdef USE_FAST_BOOT
+// Boot timebase (-DUSE_FAST_BOOT): until the LSE is ready, LPTIM1 runs continuously
+// from LSI / 2 with ARR = one beat, so the autoreload match is the beat. Its
+// compare times the debounce window; when no window is open it sits at ARR and
+// matches together with the beat, so it costs no extra wake. The LSI is only
+// specified to 26-56kHz, the boot beats are approximate until the handover.
+static volatile bool boot_timebase;          // LPTIM1 times the beats, the RTC is not running yet
+static volatile bool boot_debounce_active;   // The LPTIM1 compare times a debounce window
+static uint16_t boot_arr;                    // Active LPTIM1 autoreload value
+
+// LPTIM1 kernel clock reads are asynchronous: read until two values match
+static uint32_t lptim_read_cnt(void) {
+    uint32_t cnt;
+    do {
+        cnt = LPTIM1->CNT;
+    } while (cnt != LPTIM1->CNT);
+    return cnt;
+}
+
+// LPTIM1 compare and autoreload writes complete in the LPTIM clock domain,
+// a new write must wait for the last one
+static void boot_set_compare(uint16_t cmp) {
+    LPTIM1->CMP = cmp;
+    while (!(LPTIM1->ISR & LPTIM_ISR_CMPOK));
+    LPTIM1->ICR = LPTIM_ICR_CMPOKCF;
+}
+
+// Called at a boot beat: the counter has just wrapped, so a new ARR (PRELOAD = 0,
+// applied at once) sets the length of the beat that starts now
+static void boot_set_period(uint8_t index) {
+    uint16_t arr = boot_period_table.arr[index];
+    if (arr == boot_arr) {
+        return;
+    }
+    boot_arr = arr;
+    
+    LPTIM1->ARR = arr;
+    while (!(LPTIM1->ISR & LPTIM_ISR_ARROK));
+    LPTIM1->ICR = LPTIM_ICR_ARROKCF;
+    
+    if (!boot_debounce_active) {
+        boot_set_compare(arr);
+    }
+}
+
+// Boot variant of debounce_timer_start(): LPTIM1 compare ticks from now
+// The beat handler may preempt button handlers (-DUSE_SLEEP_ON_EXIT), so the
+// window is opened with interrupts masked
+static void boot_debounce_arm(uint16_t ticks) {
+    uint32_t primask = __get_PRIMASK();
+    __disable_irq();
+    
+    uint32_t target = lptim_read_cnt() + ticks;
+    if (target > boot_arr) {
+        target -= boot_arr + 1;  // Wrap around the beat period
+    }
+    boot_debounce_active = true;
+    boot_set_compare(target);
+    
+    __set_PRIMASK(primask);
+}
+#endif
+
+// Start the debounce timer: RTC Alarm B ss_ticks sub-second ticks from now
+static void debounce_timer_start(uint32_t ss_ticks) {
+    uint32_t target = (rtc_read_ssr() + RTC_SUBSECOND_HZ - ss_ticks) % RTC_SUBSECOND_HZ;
+    
+    // Disable RTC write protection
+    RTC->WPR = 0xCA;
+    RTC->WPR = 0x53;
+    
+    // Alarm B must be disabled while it is reprogrammed
+    RTC->CR &= ~RTC_CR_ALRBE;
+    while (!(RTC->ISR & RTC_ISR_ALRBWF));
+    
+    // Ignore date and time fields, match on the sub-second counter only
+    RTC->ALRMBR = RTC_ALRMBR_MSK4 | RTC_ALRMBR_MSK3 | RTC_ALRMBR_MSK2 | RTC_ALRMBR_MSK1;
+    RTC->ALRMBSSR = ((uint32_t)RTC_SUBSECOND_BITS << RTC_ALRMBSSR_MASKSS_Pos) | target;  // Compare SS[11:0]
+    
+    // Drop any stale match and enable Alarm B with interrupt
+    RTC->ISR = ~(RTC_ISR_ALRBF | RTC_ISR_INIT) | (RTC->ISR & RTC_ISR_INIT);
+    RTC->CR |= RTC_CR_ALRBIE | RTC_CR_ALRBE;
+    
+    // Enable RTC write protection
+    RTC->WPR = 0xFF;
+}
+
+// Arm the debounce timer: DEBOUNCE_DELAY_MS from now
+// Re-arming on every edge restarts the window, so contacts must be quiet for 50ms
+void debounce_timer_arm(void) {
+#ifdef USE_FAST_BOOT
+    if (boot_timebase) {
+        boot_debounce_arm(DEBOUNCE_BOOT_TICKS);
+        return;
+    }
+#endif
+    debounce_timer_start(DEBOUNCE_SS_TICKS);
+}
+
+// Arm the debounce timer for the next auto-repeat step of a held button
+void repeat_timer_arm(uint8_t stage) {
+#ifdef USE_FAST_BOOT
+    if (boot_timebase) {
+        boot_debounce_arm(repeat_table_boot.ticks[stage]);
+        return;
+    }
+#endif
+    debounce_timer_start(repeat_table_4096hz.ticks[stage]);
+}
+
+// Press edge on the tap button (called from the EXTI handler): timestamp it
+static void tap_press_edge(void) {
+#ifdef USE_FAST_BOOT
+    if (boot_timebase) {
+        tap_edge_valid = false;
+        return;
+    }
+#endif
+    tap_edge = rtc_read_ticks();
+    tap_edge_valid = true;
+}
+
+// Tap press confirmed (called from the RTC handler): hand the tempo of the run to the core
+static void tap_confirmed(void) {
+    if (!tap_edge_valid) {
+        tap_reset(&tap_tempo);
+        return;
+    }
+    
+    uint32_t interval = rtc_ticks_since(tap_last, tap_edge);
+    tap_last = tap_edge;
+    uint16_t bpm = tap_next(&tap_tempo, &bpm_table_4096hz, interval > 0xFFFF ? 0xFFFF : (uint16_t)interval);
+    if (bpm) {
+        App::on_tap(bpm);
+    }
+}
+
+// Sample a button (active low with pull-up)
+static bool button_is_down(uint8_t button) {
+    return !(gpio_port(board.button[button])->IDR & board.button[button].mask());
+}
+
+// Advance a state machine on a pin edge (called from the EXTI handlers)
+void debounce_edge(uint8_t button) {
+    if (button == BUTTON_TAP && button_state[button] == BUTTON_IDLE) {
+        tap_press_edge();  // First edge of a press: the tap time
+    }
+    debounce_on_edge(&button_state[button]);
+    repeat_on_edge(&button_repeat);
+    debounce_timer_arm();
+}
+
+// Advance the state machines once contacts have settled or a repeat step is due
+// (called from the RTC handler)
+void debounce_timer_expired(void) {
+    // One-shot: disable Alarm B until the next edge
+    RTC->WPR = 0xCA;
+    RTC->WPR = 0x53;
+    RTC->CR &= ~(RTC_CR_ALRBIE | RTC_CR_ALRBE);
+    RTC->WPR = 0xFF;
+    
+    bool repeat_tick = button_repeat.armed;
+    bool held = false;
+    for (uint8_t i = 0; i < BUTTON_COUNT; i++) {
+        bool repeats = BUTTON_REPEAT_MASK & (1 << i);
+        
+        DebounceEvent event = debounce_on_settle(&button_state[i], button_is_down(i), repeat_tick);
+        if (event == DEBOUNCE_PRESS) {
+            App::on_button(i);  // Confirmed press, action runs in main loop
+            if (i == BUTTON_TAP) {
+                tap_confirmed();
+            }
+        } else if (event == DEBOUNCE_REPEAT && repeats) {
+            App::on_repeat(i);
+        }
+        held |= repeats && button_state[i] == BUTTON_HELD;
+    }
+    
+    // Held: the same timer times the next repeat step
+    uint8_t stage = repeat_on_settle(&button_repeat, held);
+    if (stage == REPEAT_STOP) {
+        App::on_repeat_end();
+    } else {
+        repeat_timer_arm(stage);
+    }
+}
+
+// Route a board pin to its EXTI line (SYSCFG_EXTICR: four lines per register)
+// and unmask it for the edges given
+static void exti_route(BoardPin pin, bool falling, bool rising) {
+    uint32_t shift = (pin.pin & 3U) * 4;
+    SYSCFG->EXTICR[pin.pin >> 2] = (SYSCFG->EXTICR[pin.pin >> 2] & ~(0xFU << shift)) | ((uint32_t)pin.port << shift);
+    EXTI->IMR |= pin.mask();
+    if (falling) {
+        EXTI->FTSR |= pin.mask();
+    }
+    if (rising) {
+        EXTI->RTSR |= pin.mask();
+    }
+}
+
+// EXTI Configuration for button interrupts
+void EXTI_Init(void) {
+    // Enable SYSCFG clock
+    RCC->APB2ENR |= RCC_APB2ENR_SYSCFGEN;
+    
+    // Buttons: falling edge trigger (press) and rising edge trigger (release)
+    for (uint8_t button = 0; button < BUTTON_COUNT; button++) {
+        exti_route(board.button[button], true, true);
+    }
+    
+    // Enable the EXTI interrupts of the lines in use in NVIC (sync input included)
+    if (EXTI_USED_LINES & EXTI_LINES_0_1) {
+        NVIC_EnableIRQ(EXTI0_1_IRQn);
+    }
+    if (EXTI_USED_LINES & EXTI_LINES_2_3) {
+        NVIC_EnableIRQ(EXTI2_3_IRQn);
+    }
+    if (EXTI_USED_LINES & EXTI_LINES_4_15) {
+        NVIC_EnableIRQ(EXTI4_15_IRQn);
+    }
+}
+
+// Simple delay function (approximate, based on instruction cycles)
+// Note: This blocking delay keeps the MCU awake in Run mode for its whole duration.
+void delay_ms(uint32_t ms) {
+    // Approximate: at 2.097 MHz, ~2000 cycles per ms
+    for (uint32_t i = 0; i < ms * 500; i++) {
+        __NOP();
+    }
+}
+
+// Busy wait of at least us microseconds at the MSI system clock, for the start-up
+// times of the datasheet (us is a constant, the loop count folds at compile time)
+static inline void delay_us(uint32_t us) {
+    uint32_t loops = (us * (MSI_HZ / 1000) + DELAY_LOOP_CYCLES * 1000 - 1) / (DELAY_LOOP_CYCLES * 1000);
+    for (uint32_t i = 0; i < loops; i++) {
+        __NOP();
+    }
+}
+
+#ifndef USE_BLOCKING_PULSE
+static uint16_t pulse_arr;  // LPTIM1 autoreload value in use: the pulse width
+
+// Set the pulse width: ARR is written while LPTIM1 is enabled and stopped (every
+// pulse ends before the next step), the write completes in the LSE clock domain
+static void lptim_set_pulse_width(uint16_t arr) {
+    pulse_arr = arr;
+    LPTIM1->ARR = arr;
+    while (!(LPTIM1->ISR & LPTIM_ISR_ARROK));
+    LPTIM1->ICR = LPTIM_ICR_ARROKCF;
+}
+
+// LPTIM1 Configuration for the hardware-timed output pulse
+// LPTIM1 is clocked from LSE and keeps counting in Stop mode, so the core can
+// sleep during the pulse high time. Requires LSE to be running (call after RTC_Init).
+void LPTIM_Init(void) {
+    // Select LSE as LPTIM1 kernel clock
+    RCC->CCIPR |= RCC_CCIPR_LPTIM1SEL;  // 11 = LSE
+    RCC->APB1ENR |= RCC_APB1ENR_LPTIM1EN;
+    
+    // CFGR and IER can only be written while LPTIM1 is disabled
+    LPTIM1->CR = 0;
+    LPTIM1->CFGR = 0;  // Prescaler /1, internal clock, software start
+    LPTIM1->IER = LPTIM_IER_ARRMIE;  // Interrupt at end of pulse
+    
+    // ARR can only be written while LPTIM1 is enabled
+    LPTIM1->CR = LPTIM_CR_ENABLE;
+    lptim_set_pulse_width(pulse_width_lptim.ticks[STEP_BEAT]);
+    
+    // LPTIM1 wakes the core from Stop mode through EXTI line 29
+    EXTI->IMR |= EXTI_IMR_IM29;
+    NVIC_EnableIRQ(LPTIM1_IRQn);
+}
+#endif
+
+#ifdef USE_FAST_BOOT
+// Start beating from the boot timebase right away (the LSE keeps starting in the
+// background, the handover runs at the first beat after LSERDY)
+void BootTimebase_Init(void) {
+    // LSI is already on when the IWDG runs, start it otherwise
+    RCC->CSR |= RCC_CSR_LSION;
+    while (!(RCC->CSR & RCC_CSR_LSIRDY));
+    
+    // Select LSI as LPTIM1 kernel clock
+    RCC->CCIPR = (RCC->CCIPR & ~RCC_CCIPR_LPTIM1SEL) | RCC_CCIPR_LPTIM1SEL_0;  // 01 = LSI
+    RCC->APB1ENR |= RCC_APB1ENR_LPTIM1EN;
     
-    // Disable RTC write protection
-    RTC->WPR = 0xCA;
-    RTC->WPR = 0x53;
+    // CFGR and IER can only be written while LPTIM1 is disabled
+    LPTIM1->CR = 0;
+    LPTIM1->CFGR = LPTIM_CFGR_PRESC_0;  // Prescaler /2, internal clock, software start
+    LPTIM1->IER = LPTIM_IER_ARRMIE | LPTIM_IER_CMPMIE;  // Beat, end of a debounce window
     
-    // Enter initialization mode
-    RTC->ISR |= RTC_ISR_INIT;
-    while (!(RTC->ISR & RTC_ISR_INITF));
+    // Beat state for the restored tempo, the RTC takes it over at the handover
+    uint8_t index = bpm_index(App::bpm());
+    beat_init(&beat_state, &bpm_table_4096hz.entry[index]);
     
-    // Configure RTC prescaler for 32.768kHz crystal
-    // LSE = 32768 Hz, Async prescaler = 128, Sync prescaler = 256
-    // This gives exactly 1Hz RTC clock: 32768 / (128 * 256) = 1 Hz
-    RTC->PRER = 0x007F00FF;  // Async = 127 (128-1), Sync = 255 (256-1)
+    // ARR and CMP can only be written while LPTIM1 is enabled
+    LPTIM1->CR = LPTIM_CR_ENABLE;
+    boot_set_period(index);
+    boot_timebase = true;
     
-    // Exit initialization mode
-    RTC->ISR &= ~RTC_ISR_INIT;
+    // LPTIM1 wakes the core from Stop mode through EXTI line 29
+    EXTI->IMR |= EXTI_IMR_IM29;
+    NVIC_EnableIRQ(LPTIM1_IRQn);
     
-    // Configure wake-up timer based on BPM
-    // Disable wake-up timer
-    RTC->CR &= ~RTC_CR_WUTE;
-    while (!(RTC->ISR & RTC_ISR_WUTWF));
+    LPTIM1->CR |= LPTIM_CR_CNTSTRT;  // Continuous mode, first beat one period from now
+}
+
+// The LSE is ready: hand the beat over to the RTC at this boot beat boundary
+// The RTC starts counting when it leaves init mode, a few LSE cycles after the
+// beat edge, so the RTC beats continue the phase of the boot beats (the slip is
+// below one sub-second tick). LPTIM1 then goes back to timing the output pulse.
+static void boot_handover(void) {
+    bool debounce = boot_debounce_active;
+    boot_debounce_active = false;
+    boot_timebase = false;
     
-    // Calculate wake interval
-    uint16_t wake_interval_ms = calculate_wakeup_interval_ms(current_bpm);
-    activation_period_ms = 60000 / current_bpm;
+    LPTIM1->CR = 0;
+    LPTIM1->ICR = LPTIM_ICR_CMPMCF | LPTIM_ICR_ARRMCF;
+#ifdef USE_BLOCKING_PULSE
+    NVIC_DisableIRQ(LPTIM1_IRQn);
+    EXTI->IMR &= ~EXTI_IMR_IM29;
+    RCC->APB1ENR &= ~RCC_APB1ENR_LPTIM1EN;
+#else
+    LPTIM_Init();
+#endif
+#ifdef USE_LOW_LEAKAGE_PROFILE
+    RCC->CSR &= ~RCC_CSR_LSION;  // No IWDG: nothing else runs on LSI
+#endif
     
-    // Use ck_spre (1Hz) for slower rates, or faster clock for high BPM
-    RTC->CR &= ~RTC_CR_WUCKSEL;
+    RTC_Start(beat_active_index());
+#ifdef ENABLE_SERIAL
+    LPUART_Init();  // Needs the LSE too
+#endif
     
-    if (wake_interval_ms >= 1000) {
-        // Use ck_spre (1Hz) - wake every second
-        RTC->CR |= (4 << RTC_CR_WUCKSEL_Pos);
-        RTC->WUTR = 0;  // Wake every 1 second
-    } else {
-        // Use ck_spre/16 for faster wake-up (16Hz)
-        RTC->CR |= (5 << RTC_CR_WUCKSEL_Pos);
-        // Calculate ticks: wake_interval_ms / 62.5ms (16Hz = 62.5ms per tick)
-        uint16_t ticks = (wake_interval_ms * 16) / 1000;
-        if (ticks < 1) ticks = 1;
-        RTC->WUTR = ticks - 1;
+    // A debounce window or repeat step in progress restarts on Alarm B
+    if (debounce && button_repeat.armed) {
+        repeat_timer_arm(button_repeat.stage);
+    } else if (debounce) {
+        debounce_timer_arm();
     }
+}
+
+// LPTIM1 interrupt while it is the boot timebase (called from LPTIM1_IRQHandler())
+static void boot_timebase_irq(void) {
+    uint32_t isr = LPTIM1->ISR;
     
-    // Enable wake-up timer interrupt
-    RTC->CR |= RTC_CR_WUTIE;
-    RTC->CR |= RTC_CR_WUTE;
+    if (isr & LPTIM_ISR_CMPM) {
+        LPTIM1->ICR = LPTIM_ICR_CMPMCF;
+        if (boot_debounce_active) {
+            instr_wake(WAKE_DEBOUNCE);
+            boot_debounce_active = false;
+            boot_set_compare(boot_arr);  // Back to matching with the beat
+            debounce_timer_expired();
+            wake_work_pend(true);  // A press or repeat step may have been reported
+        }
+    }
     
-    // Enable RTC write protection
-    RTC->WPR = 0xFF;
+    if (isr & LPTIM_ISR_ARRM) {
+        instr_wake(WAKE_BEAT);
+        LPTIM1->ICR = LPTIM_ICR_ARRMCF;
+        
+        // Beat boundary: a pending tempo or pattern change applies from this beat
+        // on, the sub-steps only start at the handover
+        beat_boot_latch();
+        uint8_t kind = pattern_beat();
+        pattern_skip();
+        App::on_beat(kind);
+        wake_work_pend(true);
+        
+        if (RCC->CSR & RCC_CSR_LSERDY) {
+            boot_handover();
+        } else {
+            boot_set_period(beat_active_index());
+        }
+    }
+}
+#endif
+
+// Activate output pin for the pulse width of a step kind
+// Blocking variant: stays in Run mode for the whole pulse
+// (also used by -DUSE_FAST_BOOT while LPTIM1 is the boot timebase)
+void activate_output_blocking(uint8_t kind) {
+    gpio_port(board.output)->ODR |= board.output.mask();  // Set pin high
+    delay_ms(pulse_width_ms.ticks[kind] >> pulse_shift);  // Blocking delay
+    gpio_port(board.output)->ODR &= ~board.output.mask();  // Set pin low
+}
+
+#ifdef USE_BLOCKING_PULSE
+void activate_output(uint8_t kind) {
+    activate_output_blocking(kind);
+}
+#else
+// Hardware-timed variant: raises the pin and starts a single LPTIM1 count,
+// the pin is driven low from LPTIM1_IRQHandler() while the core is in Stop mode
+void activate_output(uint8_t kind) {
+#ifdef USE_FAST_BOOT
+    if (boot_timebase) {
+        activate_output_blocking(kind);
+        return;
+    }
+#endif
     
-    // Enable RTC wake-up interrupt in EXTI
-    EXTI->IMR |= EXTI_IMR_IM20;  // RTC Wakeup is on EXTI line 20
-    EXTI->RTSR |= EXTI_RTSR_RT20;
+    uint16_t arr = pulse_width_lptim.ticks[kind] >> pulse_shift;
+    if (arr != pulse_arr) {
+        lptim_set_pulse_width(arr);  // Only between steps of different widths
+    }
     
-    // Enable RTC wake-up interrupt in NVIC
-    NVIC_EnableIRQ(RTC_IRQn);
+    gpio_port(board.output)->BSRR = board.output.mask();  // Set pin high
+    LPTIM1->CR |= LPTIM_CR_SNGSTRT;  // Start single-shot count of the pulse width
 }
+#endif
 
-// Update RTC wake-up timer when BPM changes
-void RTC_UpdateWakeup(void) {
-    // Disable RTC write protection
-    RTC->WPR = 0xCA;
-    RTC->WPR = 0x53;
-    
-    // Disable wake-up timer
-    RTC->CR &= ~RTC_CR_WUTE;
-    while (!(RTC->ISR & RTC_ISR_WUTWF));
+// Restore the saved tempo (called before the beat is started at App::bpm())
+// Without board.tempo_store every reset starts at BPM_DEFAULT: the core never
+// saves, and no data EEPROM access is left in the build
+void tempo_restore(void) {
+    if (board.tempo_store) {
+        App::restore(tempo_store_restore(&tempo_store, TEMPO_RING));
+    }
+}
+
+// Save the tempo into the next slot of the ring: one data EEPROM word write
+// (erase + program, ~3.2ms). Code fetches from flash stall while it programs, so
+// interrupts wait as well; it is started right after a beat, far from the next one.
+void tempo_save(uint16_t bpm) {
+    TempoRecord rec;
+    uint8_t slot;
+    if (!tempo_store_next(&tempo_store, bpm, &rec, &slot)) {
+        return;
+    }
     
-    // Calculate new wake interval
-    uint16_t wake_interval_ms = calculate_wakeup_interval_ms(current_bpm);
-    activation_period_ms = 60000 / current_bpm;
+    // Unlock the data EEPROM (PECR), locked again when done
+    FLASH->PEKEYR = 0x89ABCDEF;
+    FLASH->PEKEYR = 0x02030405;
     
-    // Update clock selection and timer value
-    RTC->CR &= ~RTC_CR_WUCKSEL;
+    // Little endian: the word holds the record in memory order
+    volatile uint32_t* dst = (volatile uint32_t*)&TEMPO_RING[slot];
+    *dst = rec.seq | ((uint32_t)rec.bpm << 8) | ((uint32_t)rec.check << 16) | ((uint32_t)rec.reserved << 24);
+    while (FLASH->SR & FLASH_SR_BSY);
     
-    if (wake_interval_ms >= 1000) {
-        RTC->CR |= (4 << RTC_CR_WUCKSEL_Pos);
-        RTC->WUTR = 0;
-    } else {
-        RTC->CR |= (5 << RTC_CR_WUCKSEL_Pos);
-        uint16_t ticks = (wake_interval_ms * 16) / 1000;
-        if (ticks < 1) ticks = 1;
-        RTC->WUTR = ticks - 1;
-    }
+    FLASH->PECR |= FLASH_PECR_PELOCK;
+}
+
+// Convert VREFINT, then the temperature sensor, which is scaled with that VREFINT
+// reading. One-shot, polled: a single conversion needs no DMA, each takes ~85µs.
+// The sensor starts up (10µs) during the VREFINT conversion.
+static void supply_convert(void) {
+    RCC->APB2ENR |= RCC_APB2ENR_ADCEN;
+    ADC->CCR |= ADC_CCR_VREFEN | ADC_CCR_TSEN;
+    while (!(PWR->CSR & PWR_CSR_VREFINTRDYF));  // Ready by now but after a rest, see supply_measure()
     
-    // Re-enable wake-up timer
-    RTC->CR |= RTC_CR_WUTE;
+    ADC1->CHSELR = ADC_CHSELR_CHSEL17;
+    ADC1->CR |= ADC_CR_ADSTART;
+    while (!(ADC1->ISR & ADC_ISR_EOC));
+    supply_vrefint = ADC1->DR;  // Clears EOC
     
-    // Enable RTC write protection
-    RTC->WPR = 0xFF;
+    ADC1->CHSELR = ADC_CHSELR_CHSEL18;
+    ADC1->CR |= ADC_CR_ADSTART;
+    while (!(ADC1->ISR & ADC_ISR_EOC));
+    supply_ts = ADC1->DR;
     
-    // Reset timing
-    last_activation_time = millis_counter;
+    ADC->CCR &= ~(ADC_CCR_VREFEN | ADC_CCR_TSEN);
+    RCC->APB2ENR &= ~RCC_APB2ENR_ADCEN;
 }
 
-// EXTI Configuration for button interrupts
-void EXTI_Init(void) {
-    // Enable SYSCFG clock
-    RCC->APB2ENR |= RCC_APB2ENR_SYSCFGEN;
+// Calibrate and set up the ADC for the supply samples (boot only)
+// Clocked synchronously from PCLK (2.097MHz, low-frequency mode below 3.5MHz), so
+// no HSI16 is needed. Auto-off mode powers the ADC for each conversion only, and
+// its bus clock is gated between samples.
+void supply_init(void) {
+    RCC->APB2ENR |= RCC_APB2ENR_ADCEN;
+    ADC1->CFGR2 = ADC_CFGR2_CKMODE;  // PCLK / 1
+    ADC->CCR |= ADC_CCR_LFMEN;
+    
+    // Voltage regulator start-up, then calibration with the ADC disabled
+    ADC1->CR |= ADC_CR_ADVREGEN;
+    delay_us(2 * ADC_VREG_STARTUP_US);  // Twice the datasheet maximum
+    ADC1->CR |= ADC_CR_ADCAL;
+    while (ADC1->CR & ADC_CR_ADCAL);
     
-    // Configure EXTI for PC13 (Button Increase BPM)
-    SYSCFG->EXTICR[3] = (SYSCFG->EXTICR[3] & ~SYSCFG_EXTICR4_EXTI13) | SYSCFG_EXTICR4_EXTI13_PC;
-    EXTI->IMR |= EXTI_IMR_IM13;
-    EXTI->FTSR |= EXTI_FTSR_FT13;  // Falling edge trigger
+    // VREFINT needs a 10µs sampling time: 160.5 cycles (77µs)
+    ADC1->SMPR = ADC_SMPR_SMP;
+    ADC1->CHSELR = ADC_CHSELR_CHSEL17;
     
-    // Configure EXTI for PB0 (Button Decrease BPM)
-    SYSCFG->EXTICR[0] = (SYSCFG->EXTICR[0] & ~SYSCFG_EXTICR1_EXTI0) | SYSCFG_EXTICR1_EXTI0_PB;
-    EXTI->IMR |= EXTI_IMR_IM0;
-    EXTI->FTSR |= EXTI_FTSR_FT0;  // Falling edge trigger
+    ADC1->ISR = ADC_ISR_ADRDY;
+    ADC1->CR |= ADC_CR_ADEN;
+    while (!(ADC1->ISR & ADC_ISR_ADRDY));
+    ADC1->CFGR1 = ADC_CFGR1_AUTOFF;  // Single conversion, 12 bits
     
-    // Configure EXTI for PB1 (Button 3 - Reserved)
-    SYSCFG->EXTICR[0] = (SYSCFG->EXTICR[0] & ~SYSCFG_EXTICR1_EXTI1) | SYSCFG_EXTICR1_EXTI1_PB;
-    EXTI->IMR |= EXTI_IMR_IM1;
-    EXTI->FTSR |= EXTI_FTSR_FT1;  // Falling edge trigger
+    RCC->APB2ENR &= ~RCC_APB2ENR_ADCEN;
+    App::supply_init((uint32_t)SUPPLY_CAL_MV * SUPPLY_VREFINT_CAL);
     
-    // Enable EXTI interrupts in NVIC
-    NVIC_EnableIRQ(EXTI0_1_IRQn);  // Handles EXTI0 and EXTI1
-    NVIC_EnableIRQ(EXTI4_15_IRQn); // Handles EXTI13
+    // First sample at boot (VREFINT is on since the reset), so a sample taken at
+    // the end of a pulse always has one before it to report
+    supply_convert();
 }
 
-// Simple delay function (approximate, based on instruction cycles)
-// Note: This blocking delay keeps the MCU awake for 50ms during pin activation.
-// Using a hardware timer would require keeping the timer running during sleep,
-// which increases power consumption more than this brief wake period.
-void delay_ms(uint32_t ms) {
-    // Approximate: at 2.097 MHz, ~2000 cycles per ms
-    for (uint32_t i = 0; i < ms * 500; i++) {
-        __NOP();
+// Supply sample (called by the core in a beat wake, every BATTERY_SAMPLE_BEATS)
+// With the ULP and FWU bits of StopMode_Init() the wake does not wait for VREFINT,
+// which takes up to 3ms to start after it. Rather than waiting for it awake, the
+// ULP bit is cleared so VREFINT keeps starting through Stop mode, and the sample
+// is taken in the LPTIM1 wake at the end of the beat's pulse (12.5ms or more
+// later), still under its load. The reading returned is then the sample before,
+// one BATTERY_SAMPLE_BEATS late. Without a pulse in progress (a rest, a blocking
+// pulse that has just ended) the sample is taken right away.
+uint16_t supply_measure(void) {
+#ifndef USE_BLOCKING_PULSE
+    // LPTIM1 handler masked, the pulse must not end between the check and the flag
+    uint32_t primask = __get_PRIMASK();
+    __disable_irq();
+    if ((PWR->CR & PWR_CR_ULP) && (gpio_port(board.output)->ODR & board.output.mask())) {
+        PWR->CR &= ~PWR_CR_ULP;  // VREFINT stays on in Stop mode until the sample
+        supply_pending = true;
+        __set_PRIMASK(primask);
+        return supply_vrefint;
+    }
+    __set_PRIMASK(primask);
+#endif
+    supply_convert();
+    return supply_vrefint;
+}
+
+// End of a pulse (LPTIM1 handler, before the pin goes low): take a pending supply
+// sample, then let VREFINT go off in Stop mode again
+static inline void supply_pulse_end(void) {
+    if (supply_pending) {
+        supply_pending = false;
+        supply_convert();
+        PWR->CR |= PWR_CR_ULP;
+    }
+}
+
+// Die temperature in °C of the last supply sample (called by the core right after
+// supply_measure(), every XTAL_TEMP_SAMPLES supply samples). The sensor reading is
+// scaled to VDDA = 3.0V with the VREFINT reading of the same sample, then
+// interpolated between the two factory points.
+int16_t temperature_measure(void) {
+    // Two divisions, once every few minutes
+    int32_t at_3v = (int32_t)((uint32_t)supply_ts * SUPPLY_VREFINT_CAL / supply_vrefint);
+    return (int16_t)(TS_CAL1_C + (at_3v - TS_CAL1) * (TS_CAL2_C - TS_CAL1_C) / (TS_CAL2 - TS_CAL1));
+}
+
+// RTC->CALR for a correction in ppb (positive: the crystal is slow, the RTC must
+// count faster): pulses = ppb * 2^20 / 10^9, as a multiply and shift (ppb * 4398 >> 22)
+static uint32_t rtc_calr_value(int32_t ppb) {
+    uint32_t magnitude = (uint32_t)(ppb < 0 ? -ppb : ppb);
+    if (magnitude > RTC_CALP_PPB) {
+        magnitude = RTC_CALP_PPB;
+    }
+    uint32_t pulses = (magnitude * 4398U + (1U << 21)) >> 22;
+    if (pulses == 0) {
+        return 0;
     }
+    if (pulses > RTC_CALM_MAX) {
+        pulses = RTC_CALM_MAX;
+    }
+    return ppb > 0 ? RTC_CALR_CALP | (512 - pulses) : pulses;
+}
+
+// New crystal correction (main loop): smooth calibration of the RTC, applied by the
+// RTC from its next 32s calibration cycle; the calendar, the alarms and the tap
+// timestamps all follow it
+void rtc_calibrate(int32_t ppb) {
+    rtc_calr = rtc_calr_value(ppb);
+#ifdef USE_FAST_BOOT
+    if (boot_timebase) {
+        return;  // RTC_Start() writes it at the handover
+    }
+#endif
+    
+    // The RTC handler preempts the core (-DUSE_SLEEP_ON_EXIT) and locks the RTC
+    // registers again when it is done
+    uint32_t primask = __get_PRIMASK();
+    __disable_irq();
+    RTC->WPR = 0xCA;
+    RTC->WPR = 0x53;
+    while (RTC->ISR & RTC_ISR_RECALPF);
+    RTC->CALR = rtc_calr;
+    RTC->WPR = 0xFF;
+    __set_PRIMASK(primask);
 }
 
-// Activate output pin for 50ms pulse
-// Uses blocking delay - more power efficient than timer-based approach
-// since timers would need to run during sleep mode
-void activate_output(void) {
-    GPIOA->ODR |= (1U << 5);  // Set pin high
-    delay_ms(ACTIVATION_DURATION_MS);  // 50ms blocking delay
-    GPIOA->ODR &= ~(1U << 5);  // Set pin low
+// Battery level changed (main loop, in a beat wake): shorten or restore the pulses
+// from the next one, activate_output() rewrites the LPTIM1 ARR on the change
+void power_level_apply(uint8_t level) {
+    pulse_shift = battery_width_shift(level);
 }
 
 // Initialize Independent Watchdog (IWDG) for system reliability
@@ -300,173 +1571,640 @@ void IWDG_Init(void) {
     IWDG->KR = 0xCCCC;
 }
 
+#ifndef USE_LOW_LEAKAGE_PROFILE
+// Watchdog window for every BPM step
+// IWDG_Init() starts with the ~7s boot timeout and no window; from the first beat
+// on, the IWDG is reloaded once per beat (and only then, so no wake exists just to
+// feed it) with a window sized to the tempo. The IWDG counts LSI / 64 and the LSI
+// is only specified to 26-56kHz: over that range the closed window (a reload in it
+// is a reset) lasts at most half a beat and the timeout at least two beats. A hang
+// is caught within ~2 beats, a runaway loop that keeps reloading at once.
+#define IWDG_LSI_MIN_HZ 26000
+#define IWDG_LSI_MAX_HZ 56000
+#define IWDG_PRESCALER  64
+
+struct IwdgWindow {
+    uint16_t rlr;   // Timeout, counts from the reload down to 0
+    uint16_t winr;  // Reloads are only allowed once the counter is below this value
+};
+
+struct IwdgWindowTable {
+    IwdgWindow entry[BPM_TABLE_SIZE];
+};
+
+static_assert(2UL * 60000 / BPM_MIN * IWDG_LSI_MAX_HZ / IWDG_PRESCALER / 1000 <= 0xFFF,
+              "Two beats at BPM_MIN must fit the 12-bit IWDG reload value");
+
+constexpr IwdgWindowTable make_iwdg_window_table() {
+    IwdgWindowTable table{};
+    for (uint8_t i = 0; i < BPM_TABLE_SIZE; i++) {
+        uint32_t beat_ms = bpm_table_ms.entry[i].ticks;
+        
+        // Timeout >= 2 beats with the LSI at its fastest (rounded up)
+        uint32_t rlr = (2 * beat_ms * IWDG_LSI_MAX_HZ / IWDG_PRESCALER + 999) / 1000;
+        
+        // Closed window <= 1/2 beat with the LSI at its slowest (rounded down)
+        uint32_t closed = beat_ms * IWDG_LSI_MIN_HZ / IWDG_PRESCALER / (2 * 1000);
+        
+        table.entry[i].rlr = (uint16_t)rlr;
+        table.entry[i].winr = (uint16_t)(rlr - closed);
+    }
+    return table;
+}
+
+static constexpr IwdgWindowTable iwdg_window_table = make_iwdg_window_table();
+
+static uint8_t watchdog_index = 0xFF;  // Table entry in use, 0xFF: boot timeout (no window)
+
+// Reload the watchdog at a beat and size its window to the beat that starts now
+// The RTC ISR latches a tempo change before this runs, so the window always
+// matches the interval to the next reload. The reload comes first, inside the open
+// window of the previous configuration; the registers are only rewritten on a
+// tempo change.
+static void watchdog_beat(void) {
+    IWDG->KR = 0xAAAA;
+    
+    uint8_t i = beat_active_index();
+    if (i == watchdog_index) {
+        return;
+    }
+    watchdog_index = i;
+    
+    // A register update takes a few LSI cycles to reach the IWDG clock domain,
+    // WINR must be written after the new RLR is in place (writing it reloads the
+    // counter from RLR)
+    while (IWDG->SR & (IWDG_SR_RVU | IWDG_SR_WVU));
+    IWDG->KR = 0x5555;
+    IWDG->RLR = iwdg_window_table.entry[i].rlr;
+    while (IWDG->SR & IWDG_SR_RVU);
+    IWDG->WINR = iwdg_window_table.entry[i].winr;
+}
+
+// The beat in progress was shortened or stretched (tap tempo): until its end,
+// drop the window and use the boot timeout. The next watchdog_beat() sets the
+// window for the tempo from there on.
+static void watchdog_relax(void) {
+    if (watchdog_index == 0xFF) {
+        return;
+    }
+    watchdog_index = 0xFF;
+    
+    while (IWDG->SR & (IWDG_SR_RVU | IWDG_SR_WVU));
+    IWDG->KR = 0x5555;
+    IWDG->RLR = 4095;
+    while (IWDG->SR & IWDG_SR_RVU);
+    IWDG->WINR = 4095;  // Window = reload value: no closed window
+}
+#else
+// -DUSE_LOW_LEAKAGE_PROFILE: the IWDG is not started
+static inline void watchdog_beat(void) {}
+static inline void watchdog_relax(void) {}
+#endif
+
+// Move the next beat edge to one beat at bpm after the last tap (main loop, after
+// the tempo was handed to set_tempo()). The new period starts at that edge, so the
+// beats fall on the phase of the taps. Skipped if the edge has already passed.
+void tap_align_beat(uint16_t bpm) {
+    uint8_t index = bpm_index(bpm);
+    uint32_t period = bpm_table_4096hz.entry[index].ticks;
+    
+    // The RTC handler preempts the core (-DUSE_SLEEP_ON_EXIT) and owns the beat
+    uint32_t primask = __get_PRIMASK();
+    __disable_irq();
+    
+    uint32_t now = rtc_read_ticks();
+    uint32_t elapsed = rtc_ticks_since(tap_last, now);
+    if (!tap_edge_valid || elapsed + 8 >= period) {
+        __set_PRIMASK(primask);
+        return;
+    }
+    
+    uint32_t target = tap_last + period;
+    if (target >= RTC_MINUTE_TICKS) {
+        target -= RTC_MINUTE_TICKS;  // Wrap at the minute
+    }
+    
+    beat_move_edge(now, target);
+    __set_PRIMASK(primask);
+    
+    watchdog_relax();
+}
+
+#ifdef ENABLE_SYNC
+// Sync input edge from the leader (EXTI handler): timestamp it on the RTC, as a
+// position in the beat in progress, and move the next beat edge by the correction
+// of the loop. Skipped while a beat alarm waits for the RTC handler and while
+// LPTIM1 times the beats at boot. The realign only lengthens the beat, to less than
+// two periods, and a correction shortens it by at most the window: both stay
+// inside the IWDG window of the tempo.
+static void sync_input_edge(void) {
+#ifdef USE_FAST_BOOT
+    if (boot_timebase) {
+        return;
+    }
+#endif
+    
+    // The RTC handler preempts this one and owns the beat
+    uint32_t primask = __get_PRIMASK();
+    __disable_irq();
+    
+    uint32_t now = rtc_read_ticks();
+    uint32_t pos = rtc_ticks_since(sync_beat_start, now);
+    uint32_t period = rtc_ticks_since(sync_beat_start, next_beat_ticks);
+    int16_t ticks;
+    if (pos < period && sync_edge(&beat_sync, pos, period, sync_window_4096hz, SYNC_GUARD_TICKS, &ticks)) {
+        int32_t target = (int32_t)next_beat_ticks + ticks;
+        if (target >= (int32_t)RTC_MINUTE_TICKS) {
+            target -= RTC_MINUTE_TICKS;  // Wrap at the minute, both ways
+        } else if (target < 0) {
+            target += RTC_MINUTE_TICKS;
+        }
+        beat_move_edge(now, (uint32_t)target);
+    }
+    __set_PRIMASK(primask);
+}
+
+// Sync input (PB4, EXTI4), rising edges: the leader's pulses. No pull, it would
+// draw current while the leader holds the line low, so -DENABLE_SYNC units need
+// the leader connected (a floating input toggles at random). Called after
+// EXTI_Init(), which turns the SYSCFG clock on.
+void Sync_Init(void) {
+    sync_init(&beat_sync);
+    
+    GPIO_TypeDef* port = gpio_port(board.sync);
+    port->PUPDR &= ~(3U << (board.sync.pin * 2));
+    port->MODER &= ~(3U << (board.sync.pin * 2));  // Input
+    
+    exti_route(board.sync, false, true);  // Rising edge trigger (the leader's pulse)
+}
+#endif
+
+// Select a pattern, started by the RTC handler at the next beat (a single 32-bit
+// pointer write, atomic on the Cortex-M0+)
+void sequencer_request(uint8_t pattern) {
+    seq_request(&sequencer, &seq_patterns[pattern]);
+}
+
+#ifdef ENABLE_SERIAL
+// Values of the serial replies, read by serial_fill() before sleeping
+struct SerialSource {
+    static void status(SerialStatus* status) {
+        status->bpm = App::bpm();
+        status->pattern = App::pattern();
+        status->level = App::power_level();
+        status->mv = battery_mv((uint32_t)SUPPLY_CAL_MV * SUPPLY_VREFINT_CAL, App::supply_reading());
+        status->ppb = App::xtal_trim();
+#ifdef ENABLE_INSTRUMENTATION
+        status->wakes = ::wake_log.wakes;
+        status->beats = ::wake_log.beats;
+#endif
+    }
+    
+    static const WakeLog* wake_log() {
+#ifdef ENABLE_INSTRUMENTATION
+        return &::wake_log;
+#else
+        return nullptr;
+#endif
+    }
+    
+    static uint8_t irq_save() {
+        return Stm32Hal::irq_save();
+    }
+    
+    static void irq_restore(uint8_t state) {
+        Stm32Hal::irq_restore(state);
+    }
+};
+
+// Format the replies and beat stamps into the ring and start sending them (right
+// before sleeping). TXE does not wake the core from Stop mode: SLEEPDEEP stays
+// clear, WFI enters Sleep mode, until the transmission complete interrupt.
+static void serial_service(void) {
+    serial_fill<SerialSource>(&serial_link);
+    
+    // CR1 is also written by the LPUART1 handler
+    uint8_t state = Stm32Hal::irq_save();
+    if (serial_tx_pending(&serial_link)) {
+        LPUART1->CR1 |= USART_CR1_TXEIE;
+        SCB->SCR &= ~SCB_SCR_SLEEPDEEP_Msk;
+    }
+    Stm32Hal::irq_restore(state);
+}
+
+// A request or a stamp waits for serial_service() (PRIMASK set)
+static inline bool serial_pending(void) {
+    return serial_work_pending(&serial_link);
+}
+
+// Bytes are being sent: Sleep mode instead of Stop (PRIMASK set)
+static inline bool serial_tx_busy(void) {
+    return LPUART1->CR1 & (USART_CR1_TXEIE | USART_CR1_TCIE);
+}
+#else
+static inline void serial_service(void) {}
+static inline bool serial_pending(void) {
+    return false;
+}
+static inline bool serial_tx_busy(void) {
+    return false;
+}
+#endif
+
+#ifndef USE_FULL_CLOCK_RESTORE
+// Configure the Stop mode entry/exit path once, so each wake only restores
+// what Stop mode actually clobbers
+void StopMode_Init(void) {
+    // Wake up from Stop mode on MSI (our system clock) instead of HSI16
+    // MSI range and voltage scaling are retained across Stop mode
+    RCC->CFGR &= ~RCC_CFGR_STOPWUCK;
+    
+    // Ultra-low-power mode: VREFINT is switched off in Stop mode
+    // Fast wake-up: do not wait for VREFINT to restart when leaving Stop mode
+    // (anything that needs VREFINT, e.g. the ADC, must check VREFINTRDYF)
+    PWR->CR |= PWR_CR_ULP | PWR_CR_FWU;
+    
+    // Set voltage regulator to low power mode during stop
+    PWR->CR |= PWR_CR_LPSDSR;
+    
+    // Set SLEEPDEEP bit for Stop mode (WFI is only used to enter Stop mode)
+    SCB->SCR |= SCB_SCR_SLEEPDEEP_Msk;
+}
+#endif
+
 // Enter low power stop mode
+#ifdef USE_FULL_CLOCK_RESTORE
+// Full restore variant: reruns the complete clock setup after every wake-up
 void enter_stop_mode(void) {
-    // Reload watchdog before sleeping
-    IWDG->KR = 0xAAAA;
+    serial_service();  // Replies and beat stamps of the serial link
+    instr_stack_check();
+    
+    // Interrupts masked from the event check to WFI (see Sleep Entry)
+    __disable_irq();
+    if (App::events_pending() || serial_pending()) {
+        __enable_irq();
+        return;
+    }
     
     // Set voltage regulator to low power mode during stop
     PWR->CR |= PWR_CR_LPSDSR;
     
+    // Close the wake record and drop the awake marker
+    instr_sleep();
+    
     // Clear wake-up flag
     PWR->CR |= PWR_CR_CWUF;
     
-    // Set SLEEPDEEP bit for Stop mode
-    SCB->SCR |= SCB_SCR_SLEEPDEEP_Msk;
+    // Set SLEEPDEEP bit for Stop mode (Sleep mode while the serial link sends)
+    if (!serial_tx_busy()) {
+        SCB->SCR |= SCB_SCR_SLEEPDEEP_Msk;
+    }
     
-    // Enter Stop mode
+    // Enter Stop mode, the waking interrupt is taken once PRIMASK is cleared
     __WFI();
+    __enable_irq();
     
     // After wake-up, system clock needs to be reconfigured
     SystemClock_Config();
 }
+#else
+// Fast wake variant: Stop mode is configured once by StopMode_Init(), and the
+// core resumes on MSI, so the wake path is just the RTC/EXTI event to the ISR
+void enter_stop_mode(void) {
+    serial_service();  // Replies and beat stamps of the serial link
+    instr_stack_check();
+    
+    // Interrupts masked from the event check to WFI (see Sleep Entry)
+    __disable_irq();
+    if (App::events_pending() || serial_pending()) {
+        __enable_irq();
+        return;
+    }
+    
+    // Close the wake record and drop the awake marker
+    instr_sleep();
+    
+    // Clear wake-up flag
+    PWR->CR |= PWR_CR_CWUF;
+    
+    // Enter Stop mode, the waking interrupt is taken once PRIMASK is cleared
+    __WFI();
+    __enable_irq();
+    
+    // Only a system clock other than MSI would have to be switched back
+    if ((RCC->CFGR & RCC_CFGR_SWS) != RCC_CFGR_SWS_MSI) {
+        SystemClock_Config();
+    }
+}
+#endif
 
-// RTC Wake-up Timer interrupt handler
+// RTC interrupt handler - Alarm A (or the wake-up timer) drives the beats and
+// sub-steps, Alarm B ends a debounce window
 extern "C" void RTC_IRQHandler(void) {
-    if (RTC->ISR & RTC_ISR_WUTF) {
-        // Clear wake-up timer flag
-        RTC->ISR &= ~RTC_ISR_WUTF;
+    if (RTC->ISR & BEAT_RTC_FLAG) {
+        bool beat = !board.sequencer || next_alarm_ticks == next_beat_ticks;  // No sub-steps without the sequencer
+        instr_wake(beat ? WAKE_BEAT : WAKE_STEP);
+#ifdef ENABLE_INSTRUMENTATION
+        // Interrupt latency after the scheduled step edge, in sub-second ticks (the
+        // wake-up timer may fire up to one of its ticks early)
+        int32_t late = (int32_t)rtc_read_ticks() - (int32_t)next_alarm_ticks;
+        if (late < -(int32_t)(RTC_MINUTE_TICKS / 2)) {
+            late += RTC_MINUTE_TICKS;  // Wrapped at the minute
+        }
+        instr_beat_error(late);
+#endif
         
-        // Clear EXTI flag
-        EXTI->PR |= EXTI_PR_PIF20;
+        // Clear the beat timer flag
+        RTC->ISR = ~(BEAT_RTC_FLAG | RTC_ISR_INIT) | (RTC->ISR & RTC_ISR_INIT);
         
-        // Increment millisecond counter based on wake interval
-        uint16_t wake_interval_ms = calculate_wakeup_interval_ms(current_bpm);
-        millis_counter += wake_interval_ms;
+        // Clear EXTI flag
+        EXTI->PR = BEAT_EXTI_FLAG;
         
-        // Check if it's time to activate based on BPM
-        if (millis_counter - last_activation_time >= activation_period_ms) {
-            last_activation_time = millis_counter;
-            activation_flag = true;
+        // Exactly one wake per step: schedule the next one and activate
+        // A pending tempo or pattern change applies from a beat on, the timestamp
+        // of the beat that just fired is kept as phase reference
+        uint32_t edge = next_alarm_ticks;
+        if (beat) {
+            serial_beat_at(edge);
+            sync_beat_at(edge);
+            beat_advance();
+            uint8_t kind = pattern_beat();
+            if (pattern_steps_left()) {
+                step_ticks = substep_table_4096hz.ticks[pattern_subdiv() - 2][beat_active_index()];
+            }
+            step_schedule(edge);
+            App::on_beat(kind);
+        } else {
+            uint8_t kind = seq_step(&sequencer);
+            step_schedule(edge);
+            App::on_step(kind);
         }
+        wake_work_pend(true);
+    }
+    
+    if (RTC->ISR & RTC_ISR_ALRBF) {
+        instr_wake(WAKE_DEBOUNCE);
+        
+        // Clear alarm flag
+        RTC->ISR = ~(RTC_ISR_ALRBF | RTC_ISR_INIT) | (RTC->ISR & RTC_ISR_INIT);
+        
+        // Clear EXTI flag
+        EXTI->PR = EXTI_PR_PIF17;
+        
+        debounce_timer_expired();
+        wake_work_pend(true);  // A press or repeat step may have been reported
     }
 }
 
-// EXTI0-1 interrupt handler (Button Decrease BPM and Button 3)
-extern "C" void EXTI0_1_IRQHandler(void) {
-    // Button Decrease BPM on PB0 (EXTI0)
-    if (EXTI->PR & EXTI_PR_PIF0) {
-        EXTI->PR |= EXTI_PR_PIF0;  // Clear interrupt flag
-        button_dec_pressed = true;
+#if !defined(USE_BLOCKING_PULSE) || defined(USE_FAST_BOOT)
+// LPTIM1 interrupt handler - ends the output pulse (the boot beats and debounce
+// windows with -DUSE_FAST_BOOT, until the handover)
+extern "C" void LPTIM1_IRQHandler(void) {
+#ifdef USE_FAST_BOOT
+    if (boot_timebase) {
+        boot_timebase_irq();
+        return;
     }
+#endif
     
-    // Button 3 on PB1 (EXTI1) - Reserved
-    if (EXTI->PR & EXTI_PR_PIF1) {
-        EXTI->PR |= EXTI_PR_PIF1;  // Clear interrupt flag
-        button3_pressed = true;
+    if (LPTIM1->ISR & LPTIM_ISR_ARRM) {
+        instr_wake(WAKE_PULSE);
+        LPTIM1->ICR = LPTIM_ICR_ARRMCF;  // Clear autoreload match flag
+        supply_pulse_end();
+        gpio_port(board.output)->BRR = board.output.mask();  // Set pin low
+        wake_work_pend(false);
     }
 }
+#endif
 
-// EXTI4-15 interrupt handler (Button Increase BPM)
-extern "C" void EXTI4_15_IRQHandler(void) {
-    // Button Increase BPM on PC13 (EXTI13)
-    if (EXTI->PR & EXTI_PR_PIF13) {
-        EXTI->PR |= EXTI_PR_PIF13;  // Clear interrupt flag
-        button_inc_pressed = true;
+// Button edge, if the button's EXTI line is one of lines: inlined into each EXTI
+// handler with its constant lines, the buttons of the other handlers fold away
+__attribute__((always_inline)) static inline void exti_button(uint16_t lines, ButtonId button) {
+    uint16_t line = board.button[button].mask();
+    if ((lines & line) && (EXTI->PR & line)) {
+        EXTI->PR = line;  // Clear interrupt flag
+        instr_wake(WAKE_BUTTON);
+        debounce_edge(button);
+        wake_work_pend(false);
     }
 }
 
-// Process button press with proper debouncing
-// Stays awake for 50ms to debounce - acceptable since button presses are infrequent
-void process_button_presses() {
-    if (button_inc_pressed) {
-        button_inc_pressed = false;
-        delay_ms(DEBOUNCE_DELAY_MS);  // Wait for bounce to settle
-        
-        // Check if button still pressed after debounce (active low with pull-up)
-        if (!(GPIOC->IDR & (1U << 13))) {
-            if (current_bpm < BPM_MAX) {
-                current_bpm += BPM_STEP;
-                if (current_bpm > BPM_MAX) {
-                    current_bpm = BPM_MAX;
-                }
-                reconfigure_rtc = true;
-            }
-            // Wait for button release
-            while (!(GPIOC->IDR & (1U << 13))) {
-                delay_ms(10);
-            }
-            delay_ms(DEBOUNCE_DELAY_MS);  // Debounce release
-        }
+// Pending edges on the lines of one EXTI handler
+__attribute__((always_inline)) static inline void exti_service(uint16_t lines) {
+    exti_button(lines, BUTTON_INC);
+    exti_button(lines, BUTTON_DEC);
+    exti_button(lines, BUTTON_TAP);
+    
+#ifdef ENABLE_SYNC
+    // Leader's beat on the sync input
+    if ((lines & board.sync.mask()) && (EXTI->PR & board.sync.mask())) {
+        EXTI->PR = board.sync.mask();  // Clear interrupt flag
+        instr_wake(WAKE_SYNC);
+        sync_input_edge();
+        wake_work_pend(false);
     }
+#endif
+}
+
+// EXTI interrupt handlers, enabled by EXTI_Init() for the lines in use
+// (Nucleo-L053R8: PB0 and PB1 on EXTI0-1, PC13 and PB4 on EXTI4-15)
+extern "C" void EXTI0_1_IRQHandler(void) {
+    exti_service(EXTI_LINES_0_1);
+}
+
+extern "C" void EXTI2_3_IRQHandler(void) {
+    exti_service(EXTI_LINES_2_3);
+}
+
+extern "C" void EXTI4_15_IRQHandler(void) {
+    exti_service(EXTI_LINES_4_15);
+}
+
+#ifdef ENABLE_SERIAL
+// LPUART1 interrupt handler - a byte of a command line received, the next byte of
+// the ring to send, or the last one sent
+extern "C" void RNG_LPUART1_IRQHandler(void) {
+    uint32_t isr = LPUART1->ISR;
+    uint32_t cr1 = LPUART1->CR1;
     
-    if (button_dec_pressed) {
-        button_dec_pressed = false;
-        delay_ms(DEBOUNCE_DELAY_MS);  // Wait for bounce to settle
-        
-        // Check if button still pressed after debounce (active low with pull-up)
-        if (!(GPIOB->IDR & (1U << 0))) {
-            if (current_bpm > BPM_MIN) {
-                current_bpm -= BPM_STEP;
-                if (current_bpm < BPM_MIN) {
-                    current_bpm = BPM_MIN;
-                }
-                reconfigure_rtc = true;
-            }
-            // Wait for button release
-            while (!(GPIOB->IDR & (1U << 0))) {
-                delay_ms(10);
-            }
-            delay_ms(DEBOUNCE_DELAY_MS);  // Debounce release
+    if (isr & USART_ISR_ORE) {
+        LPUART1->ICR = USART_ICR_ORECF;  // A byte was lost: the line ends up answered with E
+    }
+    
+    if (isr & USART_ISR_RXNE) {
+        instr_wake(WAKE_SERIAL);
+        uint8_t command = serial_rx_byte(&serial_link, LPUART1->RDR);
+        if (command == SERIAL_CMD_TEMPO) {
+            App::on_remote_tempo(serial_tempo(&serial_link));
         }
+        wake_work_pend(command != SERIAL_CMD_NONE);  // A reply to format
     }
     
-    if (button3_pressed) {
-        button3_pressed = false;
-        delay_ms(DEBOUNCE_DELAY_MS);  // Wait for bounce to settle
-        
-        // Check if button still pressed after debounce (active low with pull-up)
-        if (!(GPIOB->IDR & (1U << 1))) {
-            // Reserved for future functionality
-            
-            // Wait for button release
-            while (!(GPIOB->IDR & (1U << 1))) {
-                delay_ms(10);
-            }
-            delay_ms(DEBOUNCE_DELAY_MS);  // Debounce release
+    if ((cr1 & USART_CR1_TXEIE) && (isr & USART_ISR_TXE)) {
+        instr_wake(WAKE_SERIAL);
+        uint8_t c;
+        if (serial_tx_byte(&serial_link, &c)) {
+            LPUART1->TDR = c;  // Clears TC
+            wake_work_pend(false);
+        } else {
+            LPUART1->CR1 = (cr1 & ~USART_CR1_TXEIE) | USART_CR1_TCIE;
+            wake_work_pend(serial_fill_pending(&serial_link));  // More lines to format
         }
+    } else if ((cr1 & USART_CR1_TCIE) && (isr & USART_ISR_TC)) {
+        // The line is idle: back to Stop mode
+        instr_wake(WAKE_SERIAL);
+        LPUART1->CR1 = cr1 & ~USART_CR1_TCIE;
+        SCB->SCR |= SCB_SCR_SLEEPDEEP_Msk;
+        wake_work_pend(false);
     }
 }
+#endif
+
+#ifdef USE_SLEEP_ON_EXIT
+// PendSV handler - the metronome core work of a wake (button actions, tempo change,
+// output pulse, watchdog reload at a beat). On return the core re-enters Stop mode directly.
+extern "C" void PendSV_Handler(void) {
+    App::service();
+    serial_service();
+    instr_stack_check();
+    
+    // Clear wake-up flag
+    PWR->CR |= PWR_CR_CWUF;
+    
+    // Close the wake record and drop the awake marker
+    instr_sleep();
+}
+
+// Interrupt-only execution model: prioritize the handlers and sleep on exit
+// Called last in main(), after every interrupt source has been configured
+void SleepOnExit_Init(void) {
+    NVIC_SetPriority(RTC_IRQn, IRQ_PRIORITY_RTC);
+#if !defined(USE_BLOCKING_PULSE) || defined(USE_FAST_BOOT)
+    NVIC_SetPriority(LPTIM1_IRQn, IRQ_PRIORITY_LPTIM);
+#endif
+    NVIC_SetPriority(EXTI0_1_IRQn, IRQ_PRIORITY_EXTI);
+    NVIC_SetPriority(EXTI2_3_IRQn, IRQ_PRIORITY_EXTI);
+    NVIC_SetPriority(EXTI4_15_IRQn, IRQ_PRIORITY_EXTI);
+#ifdef ENABLE_SERIAL
+    NVIC_SetPriority(RNG_LPUART1_IRQn, IRQ_PRIORITY_EXTI);
+#endif
+    NVIC_SetPriority(PendSV_IRQn, IRQ_PRIORITY_PENDSV);
+    
+    // Re-enter Stop mode (SLEEPDEEP, see StopMode_Init) on return from the last handler
+    SCB->SCR |= SCB_SCR_SLEEPONEXIT_Msk;
+}
+#endif
+
+// HAL policy for the metronome core (common/metronome.h)
+// Static dispatch: these inline into the core's main loop
+inline void Stm32Hal::set_tempo(uint16_t bpm) {
+    beat_request_tempo(bpm);
+}
+
+inline void Stm32Hal::pulse(uint8_t kind) {
+    activate_output(kind);
+}
+
+inline void Stm32Hal::sleep() {
+    enter_stop_mode();
+}
+
+inline void Stm32Hal::watchdog_kick() {
+    watchdog_beat();
+}
+
+inline void Stm32Hal::save_tempo(uint16_t bpm) {
+    tempo_save(bpm);
+}
+
+inline void Stm32Hal::align_beat(uint16_t bpm) {
+    tap_align_beat(bpm);
+}
+
+inline void Stm32Hal::set_pattern(uint8_t pattern) {
+    sequencer_request(pattern);
+}
+
+inline uint16_t Stm32Hal::measure_supply() {
+    return supply_measure();
+}
+
+inline void Stm32Hal::set_power_level(uint8_t level) {
+    power_level_apply(level);
+}
+
+inline int16_t Stm32Hal::measure_temperature() {
+    return temperature_measure();
+}
+
+inline void Stm32Hal::set_xtal_trim(int32_t ppb) {
+    rtc_calibrate(ppb);
+}
+
+// PRIMASK rather than LDREX/STREX, which the Cortex-M0+ does not have
+inline uint8_t Stm32Hal::irq_save() {
+    uint32_t primask = __get_PRIMASK();
+    __disable_irq();
+    return (uint8_t)primask;
+}
+
+inline void Stm32Hal::irq_restore(uint8_t state) {
+    __set_PRIMASK(state);
+}
 
 int main(void) {
+    stack_paint();  // Stack high-water (-DENABLE_INSTRUMENTATION)
+    
     // Configure system clock for low power
     SystemClock_Config();
+#ifndef USE_FULL_CLOCK_RESTORE
+    StopMode_Init();
+#endif
     
+#ifndef USE_LOW_LEAKAGE_PROFILE
     // Initialize watchdog timer for system reliability
     // IWDG runs on LSI and continues in Stop mode without extra power consumption
     IWDG_Init();
+#endif
     
     // Initialize peripherals
     GPIO_Init();
+    supply_init();
+    tempo_restore();
+#ifdef USE_FAST_BOOT
+    // Beat from LSI right away, the RTC takes over once the LSE is ready
+    LSE_Start();
+    BootTimebase_Init();
+#else
     RTC_Init();
+#ifndef USE_BLOCKING_PULSE
+    LPTIM_Init();
+#endif
+#endif
     EXTI_Init();
+#ifdef ENABLE_SYNC
+    Sync_Init();
+#endif
+    instr_init();
     
     // Disable unused peripherals for power saving
     // Disable debugging in low power modes
     DBGMCU->CR = 0;
     
-    // Main loop
+#ifdef USE_SLEEP_ON_EXIT
+    // All work runs in interrupt handlers from here on, thread mode only enters
+    // Stop mode the first time and is not resumed
+    SleepOnExit_Init();
+    App::service();
+    instr_sleep();
+    PWR->CR |= PWR_CR_CWUF;
     while (1) {
-        // Reload watchdog timer
-        IWDG->KR = 0xAAAA;
-        
-        // Process any pending button presses with proper debouncing
-        process_button_presses();
-        
-        // Update RTC wake-up timer if BPM changed
-        if (reconfigure_rtc) {
-            reconfigure_rtc = false;
-            RTC_UpdateWakeup();
-        }
-        
-        if (activation_flag) {
-            activation_flag = false;
-            activate_output();
-        }
-        
-        // Enter low power stop mode
-        enter_stop_mode();
+        __WFI();
     }
+#else
+    // Main loop: button actions, tempo changes, output pulse, sleep
+    App::run();
+#endif
     
     return 0;
 }
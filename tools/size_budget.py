@@ -0,0 +1,140 @@
+"""
+Flash / RAM size budget of the firmware builds (PlatformIO extra script)
+
+After every link the sections of the ELF are checked against the budget of the
+environment in its platformio.ini, and the build fails when one is exceeded:
+
+    custom_flash_budget   flash bytes: code, constants and the .data initializers
+    custom_ram_budget     RAM bytes: .data + .bss + .noinit plus the stack reserve
+    custom_stack_reserve  RAM bytes kept free for the stack (main loop plus the
+                          deepest interrupt nesting)
+
+`pio run -t size_budget` prints the full report: the section sizes, the largest
+symbols and the largest stack frames (-fstack-usage in build_flags). The
+frames give no call depth, so the stack reserve is checked on the target: a
+-DENABLE_INSTRUMENTATION build paints the free RAM at boot and reports the bytes
+the stack never reached in wake_log.stack_free (common/instrumentation.h).
+"""
+
+import glob
+import os
+import re
+import subprocess
+
+Import("env")
+
+FLASH_SECTIONS = (".text", ".rodata", ".data", ".isr_vector", ".ARM.extab", ".ARM.exidx",
+                  ".preinit_array", ".init_array", ".fini_array")
+RAM_SECTIONS = (".data", ".bss", ".noinit")
+TOP_SYMBOLS = 10
+TOP_FRAMES = 10
+
+# Stack usage per function: -fstack-usage in build_flags writes a .su file per
+# object, and with -flto the code is generated at the link, which needs it as well
+env.Append(LINKFLAGS=["-fstack-usage"])
+
+
+def budget(name):
+    return int(env.GetProjectOption(name))
+
+
+def toolchain(tool):
+    # nm and size of the toolchain in use (avr-size -> avr-nm)
+    size = env.subst("$SIZETOOL")
+    return size[:-len("size")] + tool if size.endswith("size") else tool
+
+
+def sections(elf):
+    out = subprocess.check_output([toolchain("size"), "-A", elf], universal_newlines=True)
+    sizes = {}
+    for line in out.splitlines():
+        fields = line.split()
+        if len(fields) >= 2 and fields[0].startswith(".") and fields[1].isdigit():
+            sizes[fields[0]] = int(fields[1])
+    return sizes
+
+
+def usage(elf):
+    sizes = sections(elf)
+    flash = sum(sizes.get(name, 0) for name in FLASH_SECTIONS)
+    ram = sum(sizes.get(name, 0) for name in RAM_SECTIONS)
+    return sizes, flash, ram
+
+
+def symbols(elf):
+    out = subprocess.check_output([toolchain("nm"), "--size-sort", "--radix=d", "-S", "-C", elf],
+                                  universal_newlines=True)
+    syms = []
+    for line in out.splitlines():
+        fields = line.split(None, 3)
+        if len(fields) == 4:
+            syms.append((int(fields[1]), fields[2], fields[3]))
+    return sorted(syms, reverse=True)[:TOP_SYMBOLS]
+
+
+def frames():
+    build_dir = env.subst("$BUILD_DIR")
+    found = {}
+    for su in glob.glob(os.path.join(build_dir, "**", "*.su"), recursive=True):
+        with open(su) as f:
+            for line in f:
+                fields = line.rstrip("\n").split("\t")
+                where = re.match(r".*?:\d+:\d+:(.*)", fields[0])  # file:line:column:function
+                if len(fields) == 3 and fields[1].isdigit() and where:
+                    name = where.group(1)
+                    size = int(fields[1])
+                    if size >= found.get(name, (0, ""))[0]:
+                        found[name] = (size, fields[2])
+    return sorted(((size, kind, name) for name, (size, kind) in found.items()), reverse=True)[:TOP_FRAMES]
+
+
+def check(elf):
+    _, flash, ram = usage(elf)
+    flash_budget = budget("custom_flash_budget")
+    ram_budget = budget("custom_ram_budget")
+    reserve = budget("custom_stack_reserve")
+    print("Size budget: flash %d / %d, RAM %d + %d stack / %d" % (flash, flash_budget, ram, reserve, ram_budget))
+    ok = True
+    if flash > flash_budget:
+        print("Size budget: flash exceeded by %d bytes" % (flash - flash_budget))
+        ok = False
+    if ram + reserve > ram_budget:
+        print("Size budget: RAM exceeded by %d bytes (stack reserve included)" % (ram + reserve - ram_budget))
+        ok = False
+    return ok
+
+
+def check_action(target, source, env):
+    return 0 if check(str(target[0])) else 1
+
+
+def report_action(target, source, env):
+    elf = str(source[0])
+    sizes, _, _ = usage(elf)
+    print("Sections:")
+    for name, size in sorted(sizes.items(), key=lambda item: -item[1]):
+        where = {(True, True): "flash + RAM", (True, False): "flash", (False, True): "RAM"}.get(
+            (name in FLASH_SECTIONS, name in RAM_SECTIONS))
+        if size and where:
+            print("  %-16s %6d  %s" % (name, size, where))
+    print("Largest symbols:")
+    for size, kind, name in symbols(elf):
+        print("  %6d %s %s" % (size, kind, name))
+    print("Largest stack frames:")
+    found = frames()
+    if not found:
+        print("  no -fstack-usage output in the build directory")
+    for size, kind, name in found:
+        print("  %6d %-16s %s" % (size, kind, name))
+    return 0 if check(elf) else 1
+
+
+env.AddPostAction("$BUILD_DIR/${PROGNAME}.elf", check_action)
+
+env.AddCustomTarget(
+    name="size_budget",
+    dependencies="$BUILD_DIR/${PROGNAME}.elf",
+    actions=[report_action],
+    title="Size Budget",
+    description="Section sizes, largest symbols and stack frames against the size budget",
+)